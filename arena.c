@@ -0,0 +1,111 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+static size_t round_up(size_t n, size_t to) {
+  return (n + to - 1) / to * to;
+}
+
+/* Maps |len| bytes, a multiple of ARENA_HUGE_PAGE_SIZE, aligned to it so
+ * that transparent huge pages can back all of it. Returns MAP_FAILED on
+ * failure. */
+static uint8_t *map_aligned(size_t len) {
+  uint8_t *p = mmap(NULL, len + ARENA_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) {
+    return p;
+  }
+  size_t head = round_up((uintptr_t)p, ARENA_HUGE_PAGE_SIZE) - (uintptr_t)p;
+  if (head > 0) {
+    munmap(p, head);
+  }
+  munmap(p + head + len, ARENA_HUGE_PAGE_SIZE - head);
+  return p + head;
+}
+
+int arena_init(arena_t *a, size_t frame_size, size_t max_frames, bool huge_pages) {
+  memset(a, 0, sizeof(*a));
+  a->frame_size = frame_size;
+  a->max_frames = max_frames;
+  a->page_size = sysconf(_SC_PAGESIZE);
+
+  if (huge_pages) {
+    a->map_len = round_up(frame_size * max_frames, ARENA_HUGE_PAGE_SIZE);
+    a->base = mmap(NULL, a->map_len, PROT_READ | PROT_WRITE,  //reserved now, so faults cannot run out of them
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (a->base == MAP_FAILED) {
+      a->base = map_aligned(a->map_len);
+      if (a->base != MAP_FAILED) {
+        madvise(a->base, a->map_len, MADV_HUGEPAGE);     //a hint: the kernel may have them turned off
+      }
+    }
+    a->huge_pages = a->base != MAP_FAILED;
+    if (a->huge_pages) {
+      a->page_size = ARENA_HUGE_PAGE_SIZE;               //giving part of one back would split it
+      return 0;
+    }
+  }
+  a->map_len = round_up(frame_size * max_frames, a->page_size);
+  a->base = mmap(NULL, a->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (a->base == MAP_FAILED) {
+    a->base = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+void arena_destroy(arena_t *a) {
+  if (a->base != NULL) {
+    munmap(a->base, a->map_len);
+    a->base = NULL;
+  }
+}
+
+int arena_resize(arena_t *a, size_t num_frames) {
+  if (num_frames > a->max_frames) {
+    return -1;
+  }
+  if (num_frames < a->num_frames) {                       //hand the pages no frame uses any more back
+    size_t keep = round_up(num_frames * a->frame_size, a->page_size);
+    if (keep < a->map_len) {
+      madvise(a->base + keep, a->map_len - keep, MADV_DONTNEED);
+    }
+  }
+  a->num_frames = num_frames;                             //growing only takes memory once frames are written
+  return 0;
+}
+
+int arena_map_file(arena_t *a, int fd, off_t offset, size_t num_frames) {
+  size_t len = round_up(num_frames * a->frame_size, sysconf(_SC_PAGESIZE));
+
+  if (num_frames > a->num_frames || len > a->map_len) {
+    return -1;
+  }
+  if (mmap(a->base, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) == MAP_FAILED) {
+    return -1;                                            //as with part of reserved huge pages
+  }
+  return 0;
+}
+
+size_t arena_resident_bytes(const arena_t *a) {
+  return a->base == NULL ? 0 : arena_resident_range(a->base, a->map_len);
+}
+
+size_t arena_resident_range(const void *addr, size_t map_len) {
+  size_t page = sysconf(_SC_PAGESIZE), resident = 0;
+  unsigned char vec[512];
+
+  for (size_t off = 0; off < map_len; off += sizeof(vec) * page) {
+    size_t len = map_len - off < sizeof(vec) * page ? map_len - off : sizeof(vec) * page;
+    if (mincore((uint8_t *)addr + off, len, vec) != 0) {
+      continue;
+    }
+    for (size_t i = 0; i < (len + page - 1) / page; i++) {
+      resident += vec[i] & 1;
+    }
+  }
+  return resident * page;
+}
@@ -0,0 +1,61 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Fixed-size frames carved out of one range of address space, reserved up
+ * front for the most frames the arena may ever hold, so frames never move
+ * when it grows or shrinks. Frames [0, num_frames) are the ones in use.
+ * Pages only take memory once touched, and shrinking gives the pages past
+ * the last frame in use back to the OS. */
+
+#define ARENA_HUGE_PAGE_SIZE (2 << 20)
+
+typedef struct {
+  uint8_t *base;
+  size_t frame_size;
+  size_t max_frames;
+  size_t num_frames;
+  size_t map_len;       /* bytes reserved */
+  size_t page_size;     /* what memory is given back in: a base or a huge page */
+  bool huge_pages;      /* backed by huge pages, reserved or transparent */
+} arena_t;
+
+/* Returns 0 on success and -1 on failure. Reserves room for |max_frames|
+ * frames of |frame_size| bytes, none of them in use. With |huge_pages|, backs
+ * them with reserved huge pages if the system has some left, or else asks
+ * for transparent ones, falling back to base pages silently. */
+int arena_init(arena_t *a, size_t frame_size, size_t max_frames, bool huge_pages);
+
+/* Gives the address space of |a| back. */
+void arena_destroy(arena_t *a);
+
+/* Returns 0 on success and -1 if |num_frames| is more than |a| can hold.
+ * Makes frames [0, num_frames) the ones in use; the contents of frames
+ * past it are lost. */
+int arena_resize(arena_t *a, size_t num_frames);
+
+/* Returns 0 on success and -1 on failure. Backs frames [0, num_frames) of
+ * |a|, which must be in use, with the contents of file |fd| from |offset|, a
+ * multiple of the page size, on: they are read in as they are first touched
+ * and copied once written, never changing the file. The file must reach past
+ * the last page of those frames, which are base pages from then on. Fails
+ * on reserved huge pages. */
+int arena_map_file(arena_t *a, int fd, off_t offset, size_t num_frames);
+
+/* Returns the bytes of |a| resident in memory, as the kernel counts them. */
+size_t arena_resident_bytes(const arena_t *a);
+
+/* Returns the bytes of the |map_len| bytes mapped at |addr|, which must be
+ * page aligned, resident in memory, as the kernel counts them. */
+size_t arena_resident_range(const void *addr, size_t map_len);
+
+/* Returns frame |i| of |a|. */
+static inline void *arena_frame(const arena_t *a, size_t i) {
+  return a->base + i * a->frame_size;
+}
+
+#endif
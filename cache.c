@@ -3,163 +3,1780 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
+#include "arena.h"
 #include "cache.h"
+#include "cache_file.h"
+#include "cache_policy.h"
+#include "cache_shm.h"
 #include "jbod.h"
+#include "net.h"
+#include "stats.h"
 
-static cache_entry_t *cache = NULL;
-static int cache_size = 0;
-static int num_queries = 0;
-static int num_hits = 0;
-static int cache_amount = 0;
+/* A cache is split into shards. The entries of a shard are kept as a
+ * structure of arrays: their bookkeeping in one array, their blocks in the
+ * frames of an arena (see arena.h), and their keys (CACHE_KEY, which fits 16 bits) in
+ * a table of tags, so looking a block up only touches the tags. The tag table
+ * is an open-addressing hash table of groups of CACHE_GROUP tags, each group
+ * one aligned 32-byte load that is compared against a key at once with SSE2
+ * or AVX2, whichever the CPU has. A lookup probes groups from the one the key
+ * hashes to until it finds the key or a group with an empty tag; removed keys
+ * leave a deleted tag unless their group has an empty one, and the table is
+ * rebuilt when too few empty tags are left. Unused entries are kept on a free
+ * list. Which entry to evict when a shard is full is left to the replacement
+ * policy (see cache_policy.h), which keeps separate state for every shard;
+ * entries pinned by cache_pin_r are never evicted.
+ * Resizing a shard evicts what no longer fits, as the policy chooses, moves
+ * the blocks left past the new end into free entries below it, and gives
+ * the frames past the end back. The arena reserves room for the largest
+ * cache, so growing never moves blocks and pinned ones never move at all.
+ * Consecutive blocks go to consecutive shards, and each shard has its own
+ * lock, so threads sharing a cache only wait for each other when they touch
+ * the same shard.
+ *
+ * An entry does not own a frame: frames are handed out from a free list of
+ * their own. In a compact cache (see cache_set_compact) a block made of a
+ * few runs of one byte, such as one a fill wrote, is kept as those runs in
+ * its entry and takes no frame at all, and shards have several entries for
+ * every frame given up to pay for them, so they hold more blocks in the same
+ * memory when many blocks are like that. The runs are found with the same
+ * SIMD instructions as the tags are compared with. A block that needs a frame
+ * when none is free takes the one of the block in a frame the policy would
+ * evict first, and a block kept as runs is decoded into a copy of its own for
+ * as long as it is pinned.
+ *
+ * A cache can be saved to a snapshot file and a new one filled from it, in
+ * another process, as long as the mount epoch of the device (see net.h) is
+ * still the one the snapshot was taken at. The entries of every shard go in
+ * in the order the policy would evict them, which keeps their recency if not
+ * all of their history. When the new cache is split the same way, the blocks
+ * of the snapshot are mapped into its arenas rather than read, so they only
+ * take time and memory once looked up.
+ *
+ * A private cache can have a second tier in a local file (see
+ * cache_file.h), which blocks evicted from memory go to and lookups that
+ * miss memory try before the block is fetched; a block found there moves
+ * back to memory like any block inserted.
+ *
+ * A cache can also be shared by processes, in which case it is a cache_shm_t
+ * (see cache_shm.h) the functions below hand everything on to, as the
+ * pointers of the shards could not be followed by other processes.
+ *
+ * In write-back mode, blocks written with cache_write are only marked dirty
+ * and reach the device through the writeback function when they are evicted
+ * or when the cache is flushed.
+ *
+ * The functions without a cache argument work on the default cache, created
+ * by cache_create with a single shard. */
 
-int cache_create(int num_entries) {
-  if (cache != NULL) {                                    //check if cache exist
+#define CACHE_MAX_ENTRIES 4096
+#define CACHE_GROUP 16                                    //tags compared at once
+#define CACHE_TAG_EMPTY 0xffff                            //tag of a slot never used since the group was last rebuilt
+#define CACHE_TAG_DELETED 0xfffe                          //tag of a slot whose key was removed
+#define CACHE_MAX_RUNS 4                                  //runs of one byte a block kept in its entry may have
+
+/* The runs of one byte a block is made of, first to last. */
+typedef struct {
+  uint8_t num;                  /* 0 if the block is not kept this way */
+  uint8_t end[CACHE_MAX_RUNS];  /* offset of the last byte of each */
+  uint8_t byte[CACHE_MAX_RUNS];
+} runs_t;
+
+/* Bookkeeping of an entry; its key is in the tag table and its block in a
+ * frame of the shard, in |runs|, or, while pinned with neither, in |copy|. */
+typedef struct {
+  bool valid;
+  bool dirty;           /* write-back mode: newer than the block on the device */
+  bool prefetched;      /* read ahead of demand and not read or written since */
+  runs_t runs;          /* the block, if kept as runs */
+  uint16_t key;         /* CACHE_KEY of the block */
+  int16_t frame;        /* holding the block, -1 if none */
+  int num_accesses;
+  int pins;             /* references handed out by cache_pin_r and not yet released */
+  int slot;             /* of its key in the tag table */
+  int next;             /* next unused entry, -1 at the end */
+  uint8_t *copy;        /* the block handed out by cache_pin_r if not in a frame */
+} cache_entry_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  struct cache *cache;                                    //the cache this shard belongs to
+  cache_entry_t *entries;
+  uint8_t (*blocks)[JBOD_BLOCK_SIZE];                     //the frames of |arena|
+  arena_t arena;
+  int size;
+  int share;                                              //of the entries of the cache, its entries and frames are laid out for
+  int amount;                                             //entries in use
+  int num_frames;
+  uint16_t *free_frames;                                  //stack of the frames no entry holds
+  int num_free_frames;
+  uint8_t *spare_copies;                                  //list of copies no pinned entry uses, linked through their first bytes
+  uint16_t *tags;                                         //the tag table, a key, CACHE_TAG_EMPTY or CACHE_TAG_DELETED per slot
+  uint16_t *slot_entry;                                   //entry whose key is in each slot
+  int group_bits;                                         //log2 of the number of groups in the tag table
+  int num_empty;                                          //slots tagged CACHE_TAG_EMPTY
+  int free_head;                                          //first unused entry
+  void *policy_state;
+  cache_stats_t stats;
+} __attribute__((aligned(64))) cache_shard_t;
+
+struct cache {
+  const cache_policy_ops_t *policy;
+  bool write_back;
+  cache_writeback_fn_t writeback_fn;
+  void *writeback_arg;
+  pthread_mutex_t writeback_lock;                         //guards writeback_fn and writeback_arg
+  int num_entries;                                        //changed by cache_resize_r while others read it
+  int num_shards;
+  int compact_slots;                                      //entries per entry's worth of memory, 0 if blocks are never kept as runs
+  cache_shm_t *shm;                                       //in shared memory instead of the shards if set
+  cache_file_t *second;                                   //second tier, if any
+  cache_shard_t shards[];
+};
+
+#define CACHE_SNAPSHOT_MAGIC "JBODSNP1"
+
+/* Start of a snapshot file, followed by a snapshot_shard_t for every shard,
+ * then the entries of every shard and last the blocks of every shard, those
+ * of each starting on a page. */
+typedef struct {
+  char magic[8];        /* CACHE_SNAPSHOT_MAGIC, without its terminating NUL */
+  uint32_t entry_size;  /* sizeof(snapshot_entry_t), also tells the byte order apart */
+  uint32_t num_shards;
+  uint64_t epoch;       /* the mount epoch the blocks were current at */
+  uint64_t page_size;
+} snapshot_header_t;
+
+typedef struct {
+  uint32_t size;        /* entries the shard had */
+  uint32_t num_blocks;  /* blocks it held, and of the entries and blocks below */
+  uint64_t entries_off;
+  uint64_t blocks_off;
+} snapshot_shard_t;
+
+/* A block the shard held, coldest first; its block is at the same index. */
+typedef struct {
+  uint16_t key;
+  uint16_t reserved;
+  int32_t num_accesses;
+} snapshot_entry_t;
+
+static cache_t *default_cache = NULL;
+static cache_stats_t default_stats;                       //of the current or last default cache
+static bool write_back = false;                           //write-back mode of the next default cache
+static const cache_policy_ops_t *policy = &cache_policy_lru;
+static bool huge_pages = false;                           //of the caches created from now on
+static int compact_slots = 0;                             //likewise
+static const char *shared_name = NULL;                    //segment of the next default cache, if shared
+static const char *second_path = NULL;                    //second tier of the next default cache, if any
+static const char *second_admission = NULL;
+
+/* Compares the tags of |group| against |tag| and CACHE_TAG_EMPTY at once.
+ * Returns a mask of the tags equal to |tag| in the low 32 bits and of the
+ * empty ones in the high 32 bits, with two bits per tag: bits 2i and 2i+1
+ * for tag i, the layout the SIMD compares give. */
+typedef uint64_t (*match_fn_t)(const uint16_t *group, uint16_t tag);
+
+#define MATCH_EMPTY(m) ((uint32_t)((m) >> 32))
+#define MATCH_TAG(m) ((uint32_t)(m))
+
+static uint64_t match_scalar(const uint16_t *group, uint16_t tag) {
+  uint32_t eq = 0, empty = 0;
+  for (int i = 0; i < CACHE_GROUP; i++) {
+    eq |= (uint32_t)(group[i] == tag) * 3 << 2 * i;
+    empty |= (uint32_t)(group[i] == CACHE_TAG_EMPTY) * 3 << 2 * i;
+  }
+  return (uint64_t)empty << 32 | eq;
+}
+
+/* Sets bit p of |ends| (four words of 64 bits) for every byte p of |block|
+ * that ends a run of one byte: the last one, and every one the next differs
+ * from. */
+typedef void (*scan_fn_t)(const uint8_t *block, uint64_t *ends);
+
+static void scan_scalar(const uint8_t *block, uint64_t *ends) {
+  memset(ends, 0, JBOD_BLOCK_SIZE / 8);
+  for (int p = 0; p < JBOD_BLOCK_SIZE; p++) {
+    if (p == JBOD_BLOCK_SIZE - 1 || block[p] != block[p + 1]) {
+      ends[p / 64] |= 1ull << p % 64;
+    }
+  }
+}
+
+/* The SIMD versions broadcast |tag| from a register and make the all-ones
+ * CACHE_TAG_EMPTY by comparing a vector with itself: _mm_set1_epi16 builds
+ * vectors element by element in unoptimized builds, such as this repo's. */
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static uint64_t match_sse2(const uint16_t *group, uint16_t tag) {
+  __m128i lo = _mm_load_si128((const __m128i *)group);
+  __m128i hi = _mm_load_si128((const __m128i *)group + 1);
+  __m128i t = _mm_shuffle_epi32(_mm_shufflelo_epi16(_mm_cvtsi32_si128(tag), 0), 0);
+  __m128i e = _mm_cmpeq_epi16(lo, lo);
+  uint32_t eq = _mm_movemask_epi8(_mm_cmpeq_epi16(lo, t)) | _mm_movemask_epi8(_mm_cmpeq_epi16(hi, t)) << 16;
+  uint32_t empty = _mm_movemask_epi8(_mm_cmpeq_epi16(lo, e)) | _mm_movemask_epi8(_mm_cmpeq_epi16(hi, e)) << 16;
+  return (uint64_t)empty << 32 | eq;
+}
+
+__attribute__((target("avx2")))
+static uint64_t match_avx2(const uint16_t *group, uint16_t tag) {
+  __m256i g = _mm256_load_si256((const __m256i *)group);
+  uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi16(g, _mm256_broadcastw_epi16(_mm_cvtsi32_si128(tag))));
+  uint32_t empty = _mm256_movemask_epi8(_mm256_cmpeq_epi16(g, _mm256_cmpeq_epi16(g, g)));
+  return (uint64_t)empty << 32 | eq;
+}
+
+/* The scans compare each vector of the block with the one a byte further on,
+ * and the last one with the one a byte back, dropping the byte compared
+ * twice, which leaves the last byte of the block unmatched, so it ends a run
+ * as well. */
+__attribute__((target("sse2")))
+static void scan_sse2(const uint8_t *block, uint64_t *ends) {
+  uint64_t same[JBOD_BLOCK_SIZE / 16];
+
+  for (int k = 0; k < JBOD_BLOCK_SIZE / 16 - 1; k++) {
+    same[k] = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(block + 16 * k)),
+                                               _mm_loadu_si128((const __m128i *)(block + 16 * k + 1))));
+  }
+  same[JBOD_BLOCK_SIZE / 16 - 1] = _mm_movemask_epi8(_mm_cmpeq_epi8(
+    _mm_loadu_si128((const __m128i *)(block + JBOD_BLOCK_SIZE - 17)),
+    _mm_loadu_si128((const __m128i *)(block + JBOD_BLOCK_SIZE - 16)))) >> 1;
+  for (int w = 0; w < JBOD_BLOCK_SIZE / 64; w++) {
+    ends[w] = ~(same[4 * w] | same[4 * w + 1] << 16 | same[4 * w + 2] << 32 | same[4 * w + 3] << 48);
+  }
+}
+
+__attribute__((target("avx2")))
+static void scan_avx2(const uint8_t *block, uint64_t *ends) {
+  uint64_t same[JBOD_BLOCK_SIZE / 32];
+
+  for (int k = 0; k < JBOD_BLOCK_SIZE / 32 - 1; k++) {
+    same[k] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(block + 32 * k)),
+                                                               _mm256_loadu_si256((const __m256i *)(block + 32 * k + 1))));
+  }
+  same[JBOD_BLOCK_SIZE / 32 - 1] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+    _mm256_loadu_si256((const __m256i *)(block + JBOD_BLOCK_SIZE - 33)),
+    _mm256_loadu_si256((const __m256i *)(block + JBOD_BLOCK_SIZE - 32)))) >> 1;
+  for (int w = 0; w < JBOD_BLOCK_SIZE / 64; w++) {
+    ends[w] = ~(same[2 * w] | same[2 * w + 1] << 32);
+  }
+}
+#endif
+
+static const struct {
+  const char *name;
+  match_fn_t fn;
+  scan_fn_t scan;
+} probes[] = {
+#if defined(__x86_64__) || defined(__i386__)
+  { "avx2", match_avx2, scan_avx2 },                      //best first
+  { "sse2", match_sse2, scan_sse2 },
+#endif
+  { "scalar", match_scalar, scan_scalar },
+};
+
+static match_fn_t match = NULL;                           //the probe in use
+static scan_fn_t scan = NULL;                             //and the scan for runs that goes with it
+static const char *match_name = NULL;
+static pthread_once_t match_once = PTHREAD_ONCE_INIT;
+
+static bool probe_supported(const char *name) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (strcmp(name, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2");
+  } else if (strcmp(name, "sse2") == 0) {
+    return __builtin_cpu_supports("sse2");
+  }
+#endif
+  return strcmp(name, "scalar") == 0;
+}
+
+static void pick_probe(void) {
+  for (size_t i = 0; i < sizeof(probes) / sizeof(probes[0]); i++) {
+    if (probe_supported(probes[i].name)) {
+      match = probes[i].fn;
+      scan = probes[i].scan;
+      match_name = probes[i].name;
+      return;
+    }
+  }
+}
+
+int cache_set_probe(const char *name) {
+  pthread_once(&match_once, pick_probe);
+  for (size_t i = 0; i < sizeof(probes) / sizeof(probes[0]); i++) {
+    if (strcmp(probes[i].name, name) == 0 && probe_supported(name)) {
+      match = probes[i].fn;
+      scan = probes[i].scan;
+      match_name = probes[i].name;
+      return 1;
+    }
+  }
+  return -1;
+}
+
+const char *cache_probe(void) {
+  pthread_once(&match_once, pick_probe);
+  return match_name;
+}
+
+/* Returns the group of the tag table of |s| where probing for |key| starts. */
+static uint32_t group_of(cache_shard_t *s, uint16_t key) {
+  return ((uint32_t)key * 2654435761u) >> (32 - s->group_bits);  //multiplicative hash, keeps the top bits
+}
+
+static cache_shard_t *shard_of(cache_t *c, int disk_num, int block_num) {
+  return &c->shards[CACHE_KEY(disk_num, block_num) % c->num_shards];
+}
+
+static uint64_t clock_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool valid_location(int disk_num, int block_num) {
+  return disk_num >= 0 && disk_num < JBOD_NUM_DISKS
+    && block_num >= 0 && block_num < JBOD_NUM_BLOCKS_PER_DISK;
+}
+
+/* Returns the index of the entry of |s| holding |disk_num| and |block_num|,
+ * or -1. */
+static int find_entry(cache_shard_t *s, int disk_num, int block_num) {
+  uint16_t key = CACHE_KEY(disk_num, block_num);
+  uint32_t mask = (1u << s->group_bits) - 1;
+  uint32_t g = group_of(s, key);
+
+  for (uint32_t n = 0; n <= mask; n++, g = (g + 1) & mask) {
+    const uint16_t *group = s->tags + g * CACHE_GROUP;
+    uint64_t m = match(group, key);
+    if (MATCH_TAG(m) != 0) {                              //keys are unique
+      return s->slot_entry[g * CACHE_GROUP + __builtin_ctz(MATCH_TAG(m)) / 2];
+    }
+    if (MATCH_EMPTY(m) != 0) {                            //the key would have gone here
+      return -1;
+    }
+  }
+  return -1;
+}
+
+/* Puts the key of entry |i| of |s| in the tag table. */
+static void tag_add(cache_shard_t *s, int i) {
+  uint16_t key = s->entries[i].key;
+  uint32_t mask = (1u << s->group_bits) - 1;
+  uint32_t g = group_of(s, key);
+
+  for (;;) {                                              //the table has room for twice the entries
+    const uint16_t *group = s->tags + g * CACHE_GROUP;
+    uint64_t m = match(group, CACHE_TAG_DELETED);
+    uint32_t free = MATCH_TAG(m) | MATCH_EMPTY(m);
+    if (free != 0) {
+      int slot = g * CACHE_GROUP + __builtin_ctz(free) / 2;
+      s->num_empty -= s->tags[slot] == CACHE_TAG_EMPTY;
+      s->tags[slot] = key;
+      s->slot_entry[slot] = i;
+      s->entries[i].slot = slot;
+      return;
+    }
+    g = (g + 1) & mask;
+  }
+}
+
+/* Refills the tag table of |s| with the keys of its entries alone, turning
+ * the deleted tags back into empty ones. */
+static void tags_rebuild(cache_shard_t *s) {
+  int num_slots = CACHE_GROUP << s->group_bits;
+
+  for (int slot = 0; slot < num_slots; slot++) {
+    s->tags[slot] = CACHE_TAG_EMPTY;
+  }
+  s->num_empty = num_slots;
+  for (int i = 0; i < s->size; i++) {
+    if (s->entries[i].valid) {
+      tag_add(s, i);
+    }
+  }
+}
+
+/* Takes the key of entry |i| of |s| out of the tag table. */
+static void tag_remove(cache_shard_t *s, int i) {
+  int slot = s->entries[i].slot;
+  const uint16_t *group = s->tags + slot / CACHE_GROUP * CACHE_GROUP;
+
+  if (MATCH_EMPTY(match(group, CACHE_TAG_EMPTY)) != 0) {  //never full, so no probe went past it
+    s->tags[slot] = CACHE_TAG_EMPTY;
+    s->num_empty++;
+  } else {
+    s->tags[slot] = CACHE_TAG_DELETED;
+  }
+}
+
+/* Returns true if |block| is made of at most CACHE_MAX_RUNS runs of one
+ * byte, which are then put in |r|. */
+static bool runs_of(const uint8_t *block, runs_t *r) {
+  uint64_t ends[JBOD_BLOCK_SIZE / 64];
+  int n = 0;
+
+  scan(block, ends);
+  for (int w = 0; w < JBOD_BLOCK_SIZE / 64; w++) {
+    n += __builtin_popcountll(ends[w]);
+  }
+  if (n > CACHE_MAX_RUNS) {
+    return false;
+  }
+  r->num = 0;
+  for (int w = 0; w < JBOD_BLOCK_SIZE / 64; w++) {
+    for (uint64_t m = ends[w]; m != 0; m &= m - 1) {      //lowest first
+      int p = w * 64 + __builtin_ctzll(m);
+      r->end[r->num] = p;
+      r->byte[r->num++] = block[p];
+    }
+  }
+  return true;
+}
+
+/* Returns the block of entry |i| of |s|: its frame or copy, or |buf| with
+ * the block decoded into it if it is kept as runs. */
+static const uint8_t *block_of(cache_shard_t *s, int i, uint8_t *buf) {
+  cache_entry_t *e = &s->entries[i];
+
+  if (e->frame != -1) {
+    return s->blocks[e->frame];
+  } else if (e->runs.num == 0) {                          //pinned and left without a frame
+    return e->copy;
+  }
+  for (int r = 0, start = 0; r < e->runs.num; start = e->runs.end[r++] + 1) {
+    memset(buf + start, e->runs.byte[r], e->runs.end[r] + 1 - start);
+  }
+  return buf;
+}
+
+/* Copies the block of entry |i| of |s| to |buf|. */
+static void block_get(cache_shard_t *s, int i, uint8_t *buf) {
+  const uint8_t *block = block_of(s, i, buf);
+
+  if (block != buf) {
+    memcpy(buf, block, JBOD_BLOCK_SIZE);
+  }
+}
+
+/* Returns a block-sized buffer for a copy, or NULL. */
+static uint8_t *copy_get(cache_shard_t *s) {
+  uint8_t *copy = s->spare_copies;
+
+  if (copy == NULL) {
+    return malloc(JBOD_BLOCK_SIZE);
+  }
+  memcpy(&s->spare_copies, copy, sizeof(copy));
+  return copy;
+}
+
+/* Lets go of the copy of entry |i| of |s|, if it has one. */
+static void copy_put(cache_shard_t *s, int i) {
+  uint8_t *copy = s->entries[i].copy;
+
+  if (copy != NULL) {
+    memcpy(copy, &s->spare_copies, sizeof(copy));
+    s->spare_copies = copy;
+    s->entries[i].copy = NULL;
+  }
+}
+
+/* Returns the block of entry |i| of |s| and pins it, or NULL if it has to be
+ * copied and there is no memory for that. */
+static const uint8_t *pin_entry(cache_shard_t *s, int i) {
+  cache_entry_t *e = &s->entries[i];
+
+  if (e->frame != -1) {
+    e->pins++;
+    return s->blocks[e->frame];
+  }
+  if (e->copy == NULL && (e->copy = copy_get(s)) != NULL) {
+    block_get(s, i, e->copy);
+  }
+  e->pins += e->copy != NULL;
+  return e->copy;
+}
+
+/* Takes the frame and copy of entry |i| of |s|, whose block is gone, back. */
+static void block_free(cache_shard_t *s, int i) {
+  cache_entry_t *e = &s->entries[i];
+
+  if (e->frame != -1) {
+    s->free_frames[s->num_free_frames++] = e->frame;
+    e->frame = -1;
+  }
+  e->runs.num = 0;
+  copy_put(s, i);
+}
+
+/* Writes entry |i| of |s| back to the device if it is dirty. Returns 1 on
+ * success and -1 on failure, in which case the entry stays dirty. */
+static int writeback_entry(cache_t *c, cache_shard_t *s, int i) {
+  cache_entry_t *e = &s->entries[i];
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  int rc;
+
+  if (!e->dirty) {
+    return 1;
+  }
+  pthread_mutex_lock(&c->writeback_lock);
+  rc = c->writeback_fn == NULL ? -1 : c->writeback_fn(c->writeback_arg, e->key / JBOD_NUM_BLOCKS_PER_DISK,
+                                                      e->key % JBOD_NUM_BLOCKS_PER_DISK, block_of(s, i, buf));
+  pthread_mutex_unlock(&c->writeback_lock);
+  if (rc != 0) {
     return -1;
-  }else if (num_entries < 2) {                            //check lower bound
+  }
+  e->dirty = false;
+  s->stats.writebacks++;
+  return 1;
+}
+
+/* Counts entry |i| of |s| as an unused prefetch if it is about to be
+ * overwritten before anyone read it. */
+static void overwrite_prefetched(cache_shard_t *s, int i) {
+  if (s->entries[i].prefetched) {
+    s->entries[i].prefetched = false;
+    s->stats.prefetch_unused++;
+  }
+}
+
+/* The arrays of a shard sized for some number of entries and frames, all
+ * allocated before any of them replaces the ones in use. */
+typedef struct {
+  cache_entry_t *entries;
+  uint16_t *tags;
+  uint16_t *slot_entry;
+  uint16_t *free_frames;
+  int group_bits;
+} shard_tables_t;
+
+static void tables_free(shard_tables_t *t) {
+  free(t->entries);
+  free(t->tags);
+  free(t->slot_entry);
+  free(t->free_frames);
+}
+
+/* Returns 1 on success and -1 on failure. Allocates |t| for |num_entries|
+ * entries, every one of them invalid, and |num_frames| frames. */
+static int tables_alloc(shard_tables_t *t, int num_entries, int num_frames) {
+  t->group_bits = 1;                                      //at least two slots per entry keeps probes short
+  while ((CACHE_GROUP << t->group_bits) < 2 * num_entries) {
+    t->group_bits++;
+  }
+  int num_slots = CACHE_GROUP << t->group_bits;
+  t->entries = calloc(num_entries, sizeof(cache_entry_t));
+  t->tags = aligned_alloc(64, num_slots * sizeof(uint16_t));  //a multiple of 64 bytes, as groups come in pairs
+  t->slot_entry = malloc(num_slots * sizeof(uint16_t));
+  t->free_frames = malloc(num_frames * sizeof(uint16_t));
+  if (t->entries == NULL || t->tags == NULL || t->slot_entry == NULL || t->free_frames == NULL) {
+    tables_free(t);
     return -1;
-  }else if (num_entries > 4096) {                         //check upper bound
+  }
+  return 1;
+}
+
+/* Puts the invalid entries of |s| on its free list. */
+static void free_list_rebuild(cache_shard_t *s) {
+  s->free_head = -1;
+  for (int i = s->size - 1; i >= 0; i--) {                //lowest first
+    if (!s->entries[i].valid) {
+      s->entries[i].next = s->free_head;
+      s->free_head = i;
+    }
+  }
+}
+
+/* Puts the frames of |s| no valid entry holds on its free frame stack. */
+static void frames_rebuild(cache_shard_t *s) {
+  uint64_t used[CACHE_MAX_ENTRIES / 64] = { 0 };
+
+  for (int i = 0; i < s->size; i++) {
+    if (s->entries[i].valid && s->entries[i].frame != -1) {
+      used[s->entries[i].frame / 64] |= 1ull << s->entries[i].frame % 64;
+    }
+  }
+  s->num_free_frames = 0;
+  for (int f = s->num_frames - 1; f >= 0; f--) {          //lowest on top, for the same reason
+    if ((used[f / 64] >> f % 64 & 1) == 0) {
+      s->free_frames[s->num_free_frames++] = f;
+    }
+  }
+}
+
+/* Makes |t| the arrays of |s|, which has |num_entries| entries and
+ * |num_frames| frames from now on, and puts the invalid entries and unused
+ * frames on their free lists. */
+static void tables_install(cache_shard_t *s, shard_tables_t *t, int num_entries, int num_frames) {
+  shard_tables_t old = { s->entries, s->tags, s->slot_entry, s->free_frames, s->group_bits };
+
+  tables_free(&old);
+  s->entries = t->entries;
+  s->tags = t->tags;
+  s->slot_entry = t->slot_entry;
+  s->free_frames = t->free_frames;
+  s->group_bits = t->group_bits;
+  s->size = num_entries;
+  s->num_frames = num_frames;
+  free_list_rebuild(s);
+  frames_rebuild(s);
+  tags_rebuild(s);
+}
+
+/* Gives the entries and frames a shard of |c| gets for the memory of
+ * |num_entries| entries with a frame each when |c| is split into |num_shards|
+ * shards: as many of both, unless |c| is compact, in which case it has
+ * compact_slots entries for each of those, up to the number of keys it can
+ * hold, and gives up as many frames as the memory of the extra entries and
+ * their tags takes, keeping at least one. */
+static void shard_layout(cache_t *c, int num_entries, int num_shards, int *size, int *num_frames) {
+  int max_size = (CACHE_NUM_KEYS + num_shards - 1) / num_shards;
+  size_t entry_bytes = sizeof(cache_entry_t) + 2 * 2 * sizeof(uint16_t);  //the tag table has two to four slots per entry
+
+  *size = num_entries;
+  *num_frames = num_entries;
+  if (c->compact_slots > 1 && num_entries < max_size) {
+    *size = num_entries * c->compact_slots < max_size ? num_entries * c->compact_slots : max_size;
+    *num_frames -= ((*size - num_entries) * entry_bytes + JBOD_BLOCK_SIZE - 1) / JBOD_BLOCK_SIZE;
+    *num_frames = *num_frames < 1 ? 1 : *num_frames;
+  }
+}
+
+static void shard_free(cache_t *c, cache_shard_t *s) {
+  shard_tables_t t = { s->entries, s->tags, s->slot_entry, s->free_frames, s->group_bits };
+
+  if (s->policy_state != NULL) {
+    c->policy->destroy(s->policy_state);
+  }
+  for (int i = 0; i < s->size; i++) {                     //copies of blocks still pinned
+    free(s->entries[i].copy);
+  }
+  while (s->spare_copies != NULL) {
+    uint8_t *copy = s->spare_copies;
+    memcpy(&s->spare_copies, copy, sizeof(copy));
+    free(copy);
+  }
+  tables_free(&t);
+  arena_destroy(&s->arena);
+  pthread_mutex_destroy(&s->lock);
+}
+
+static int shard_init(cache_t *c, cache_shard_t *s, int num_entries, int num_frames) {
+  shard_tables_t t;
+
+  memset(s, 0, sizeof(*s));
+  pthread_mutex_init(&s->lock, NULL);
+  s->cache = c;
+  if (tables_alloc(&t, num_entries, num_frames) == -1) {
+    shard_free(c, s);
+    return -1;
+  }
+  tables_install(s, &t, num_entries, num_frames);         //all invalid and empty
+  s->policy_state = c->policy->create(num_entries);
+  if (s->policy_state == NULL || arena_init(&s->arena, JBOD_BLOCK_SIZE, CACHE_MAX_ENTRIES, huge_pages) == -1) {
+    shard_free(c, s);
     return -1;
-  } else {
-    cache = malloc(num_entries*sizeof(cache_entry_t));    //memory allocation
-    for (int i = 0; i < cache_size; i++) {                //loop to set all default valid to 0
-      cache[i].valid = 0;
-    }
-    cache_size = num_entries;                             //set cache size
-    num_queries = 0;                                      //reset queries
-    num_hits = 0;                                         //reset hits
-    cache_amount = 0;                                     //reset tracker for items in cache
-    return 1;
   }
+  arena_resize(&s->arena, num_frames);
+  s->blocks = arena_frame(&s->arena, 0);
+  return 1;
 }
 
-int cache_destroy(void) {
-  if (cache == NULL) {                                    //check if cache exist
+cache_t *cache_create_r(int num_entries, int num_shards, const char *policy_name, bool write_back_mode) {
+  const cache_policy_ops_t *p = policy_name == NULL ? &cache_policy_lru : cache_policy_lookup(policy_name);
+  cache_t *c;
+  size_t size = sizeof(cache_t) + num_shards * sizeof(cache_shard_t);
+
+  if (p == NULL || num_shards < 1 || num_shards > CACHE_MAX_SHARDS) {
+    return NULL;
+  } else if (num_entries < 2 * num_shards) {              //check lower bound, at least two entries per shard
+    return NULL;
+  } else if (num_entries > CACHE_MAX_ENTRIES) {           //check upper bound
+    return NULL;
+  }
+
+  pthread_once(&match_once, pick_probe);
+  c = aligned_alloc(64, (size + 63) / 64 * 64);           //shards on their own cache lines
+  if (c == NULL) {
+    return NULL;
+  }
+  c->policy = p;
+  c->write_back = write_back_mode;
+  c->writeback_fn = NULL;
+  c->writeback_arg = NULL;
+  pthread_mutex_init(&c->writeback_lock, NULL);
+  c->num_entries = num_entries;
+  c->num_shards = 0;
+  c->compact_slots = compact_slots;
+  c->shm = NULL;
+  c->second = NULL;
+  for (int i = 0; i < num_shards; i++) {                  //spread the entries as evenly as possible
+    int share = num_entries / num_shards + (i < num_entries % num_shards), size, num_frames;
+    shard_layout(c, share, num_shards, &size, &num_frames);
+    if (shard_init(c, &c->shards[i], size, num_frames) != 1) {
+      cache_destroy_r(c);
+      return NULL;
+    }
+    c->shards[i].share = share;
+    c->num_shards++;
+  }
+  return c;
+}
+
+cache_t *cache_create_shared_r(const char *name, int num_entries, int num_shards) {
+  cache_t *c;
+
+  if (num_entries > CACHE_MAX_ENTRIES || (c = aligned_alloc(64, (sizeof(cache_t) + 63) / 64 * 64)) == NULL) {
+    return NULL;
+  }
+  memset(c, 0, sizeof(*c));
+  c->shm = cache_shm_open(name, num_entries, num_shards);
+  if (c->shm == NULL) {                                   //also checks the bounds
+    free(c);
+    return NULL;
+  }
+  pthread_mutex_init(&c->writeback_lock, NULL);
+  c->num_entries = num_entries;
+  return c;
+}
+
+int cache_destroy_r(cache_t *c) {
+  if (c == NULL) {                                        //check if cache exist
     return -1;
-  } else {
-    cache = NULL;                                         //remove cache
-    free(cache);                                          //free memory for cache
-    cache_size = 0;                                       //reset cache size
-    cache_amount = 0;                                     //reset tracker for items in cache
-    return 1;
   }
+  cache_shm_close(c->shm);
+  cache_file_close(c->second);
+  cache_flush_r(c);                                       //best effort, the device may already be gone
+  for (int i = 0; i < c->num_shards; i++) {
+    shard_free(c, &c->shards[i]);
+  }
+  pthread_mutex_destroy(&c->writeback_lock);
+  free(c);
+  return 1;
 }
 
-int cache_lookup(int disk_num, int block_num, uint8_t *buf) {
-  if (cache == NULL) {                                   //check if cache exist
+int cache_set_writeback_fn_r(cache_t *c, cache_writeback_fn_t fn, void *arg) {
+  int rc = 1;
+  if (c == NULL) {
     return -1;
-  } else if (buf == NULL ) {                             //check if buf exist
+  }
+  pthread_mutex_lock(&c->writeback_lock);
+  if (fn != NULL && c->writeback_fn != NULL && c->writeback_arg != arg) {
+    rc = -1;                                              //dirty blocks already go through someone else
+  } else if (fn != NULL) {
+    c->writeback_fn = fn;
+    c->writeback_arg = arg;
+  } else if (c->writeback_arg == arg) {                   //only the owner lets go
+    c->writeback_fn = NULL;
+    c->writeback_arg = NULL;
+  }
+  pthread_mutex_unlock(&c->writeback_lock);
+  return rc;
+}
+
+int cache_set_second_tier_r(cache_t *c, const char *path, const char *admission) {
+  if (c == NULL || c->shm != NULL || c->second != NULL) {
     return -1;
   }
+  c->second = cache_file_open(path, admission);
+  return c->second == NULL ? -1 : 1;
+}
+
+bool cache_write_back_r(cache_t *c) {
+  return c != NULL && c->write_back;
+}
+
+/* Whether entry |slot| of shard |arg| can make room for another block: it
+ * must hold one, not be pinned, and if dirty must first be written back. */
+static bool evictable(void *arg, int slot) {
+  cache_shard_t *s = arg;
+  return s->entries[slot].valid && s->entries[slot].pins == 0 && writeback_entry(s->cache, s, slot) == 1;
+}
 
-  if (cache_amount == 0) {                               //check if there is any item in cache
+/* Like evictable, for a block in a frame, to make room for another one. */
+static bool evictable_frame(void *arg, int slot) {
+  cache_shard_t *s = arg;
+  return s->entries[slot].valid && s->entries[slot].frame != -1 && evictable(arg, slot);
+}
+
+/* Takes entry |i| of |s|, just evicted by the policy and clean, out of the
+ * tag table, offers it to the second tier and counts the eviction. */
+static void evicted(cache_shard_t *s, int i) {
+  cache_file_t *second = s->cache->second;
+  uint8_t buf[JBOD_BLOCK_SIZE];
+
+  tag_remove(s, i);
+  overwrite_prefetched(s, i);
+  s->stats.evictions++;
+  stats_add(STATS_CACHE_EVICTIONS, 1);
+  if (second != NULL
+      && cache_file_offer(second, s->entries[i].key, block_of(s, i, buf), s->entries[i].num_accesses)) {
+    s->stats.second_admitted++;
+    stats_add(STATS_SECOND_TIER_ADMITTED, 1);
+  }
+  block_free(s, i);
+}
+
+/* Makes entry |i| of |s| unused. */
+static void entry_release(cache_shard_t *s, int i) {
+  s->entries[i].valid = false;
+  s->entries[i].next = s->free_head;
+  s->free_head = i;
+  s->amount--;
+}
+
+/* Evicts the entry of |s| its policy would evict first among those |fn|
+ * accepts, leaving it unused. Called with the shard locked. Returns 1 on
+ * success and -1 if |fn| accepts none. */
+static int evict_entry(cache_t *c, cache_shard_t *s, cache_evictable_fn_t fn) {
+  int i = c->policy->evict(s->policy_state, fn, s);
+  if (i == -1) {
     return -1;
   }
+  evicted(s, i);
+  entry_release(s, i);
+  return 1;
+}
+
+/* Forgets entry |i| of |s|, not pinned, without writing it back or offering
+ * it to the second tier, as its block is being overwritten whole. Called with
+ * the shard locked. */
+static void entry_drop(cache_t *c, cache_shard_t *s, int i) {
+  c->policy->remove(s->policy_state, i);
+  tag_remove(s, i);
+  overwrite_prefetched(s, i);
+  block_free(s, i);
+  entry_release(s, i);
+}
+
+/* Makes |buf| the block of entry |i| of |s|: as runs if |c| is compact and
+ * the block is made of few enough, and in a frame otherwise, evicting the
+ * block in a frame the policy cares for least if no frame is free. A pinned
+ * entry keeps its frame, and keeps the block in its copy if it finds none.
+ * Called with the shard locked. Returns 1 on success and -1 if no frame can
+ * be had, leaving the entry as it was. */
+static int block_put(cache_t *c, cache_shard_t *s, int i, const uint8_t *buf) {
+  cache_entry_t *e = &s->entries[i];
+  runs_t runs;
+
+  if (e->frame != -1 && e->pins > 0) {                    //its frame is out there
+    memcpy(s->blocks[e->frame], buf, JBOD_BLOCK_SIZE);
+  } else if (c->compact_slots > 1 && runs_of(buf, &runs)) {
+    if (e->frame != -1) {
+      s->free_frames[s->num_free_frames++] = e->frame;
+      e->frame = -1;
+    }
+    e->runs = runs;
+  } else {
+    if (e->frame == -1 && s->num_free_frames == 0 && evict_entry(c, s, evictable_frame) == -1 && e->copy == NULL) {
+      return -1;
+    }
+    if (e->frame == -1 && s->num_free_frames > 0) {
+      e->frame = s->free_frames[--s->num_free_frames];
+    }
+    if (e->frame != -1) {
+      memcpy(s->blocks[e->frame], buf, JBOD_BLOCK_SIZE);
+    }
+    e->runs.num = 0;
+  }
+  if (e->copy != NULL && e->pins == 0 && (e->frame != -1 || e->runs.num > 0)) {
+    copy_put(s, i);                                       //held elsewhere again
+  } else if (e->copy != NULL) {                           //pinned, or what holds the block
+    memcpy(e->copy, buf, JBOD_BLOCK_SIZE);
+  }
+  return 1;
+}
+
+/* Puts |buf| into a free or evicted entry of |s| for |disk_num| and
+ * |block_num|, which must not be cached yet. Called with the shard locked.
+ * Returns the entry, or -1 if no entry could be evicted because all of them
+ * are pinned or dirty blocks that could not be written back. */
+static int insert_entry(cache_t *c, cache_shard_t *s, int disk_num, int block_num, const uint8_t *buf) {
+  runs_t runs;
 
-  if (disk_num > JBOD_NUM_DISKS) {                       //set upper bound for disk
+  if (c->compact_slots > 1 && s->num_free_frames == 0 && !runs_of(buf, &runs)
+      && evict_entry(c, s, evictable_frame) == -1) {     //the victim of the policy may have no frame to give
     return -1;
-  } else if (disk_num < 0) {                             //set lower bound for disk
+  }
+  int free_slot = s->free_head;                           //an unused entry, or -1 if the shard is full
+  int i = c->policy->insert(s->policy_state, CACHE_KEY(disk_num, block_num), free_slot, evictable, s);
+  if (i == -1) {
     return -1;
   }
+  if (free_slot != -1) {
+    s->free_head = s->entries[free_slot].next;
+    s->amount++;                                          //increment tracking of item amount in cache
+  } else {                                                //the policy evicted entry i to make room
+    evicted(s, i);
+  }
 
-  if (block_num > JBOD_DISK_SIZE) {                      //set upper bound for block
+  if (c->second != NULL) {                                //the copy there is about to be outdated
+    cache_file_drop(c->second, CACHE_KEY(disk_num, block_num));
+  }
+  cache_entry_t *e = &s->entries[i];                      //this section is to insert data into the entry
+  e->valid = true;
+  e->dirty = false;
+  e->prefetched = false;
+  e->key = CACHE_KEY(disk_num, block_num);
+  e->frame = -1;
+  e->runs.num = 0;
+  e->copy = NULL;
+  block_put(c, s, i, buf);                                //a frame is free if it needs one
+  e->num_accesses = 1;
+  tag_add(s, i);
+  if (s->num_empty < (CACHE_GROUP << s->group_bits) / 8) {  //deleted tags make misses probe too far
+    tags_rebuild(s);
+  }
+  return i;
+}
+
+void cache_update_r(cache_t *c, int disk_num, int block_num, const uint8_t *buf) {
+  if (c == NULL || buf == NULL || !valid_location(disk_num, block_num)) {
+    return;
+  }
+  if (c->shm != NULL) {
+    cache_shm_update(c->shm, CACHE_KEY(disk_num, block_num), buf);
+    return;
+  }
+  cache_shard_t *s = shard_of(c, disk_num, block_num);
+  pthread_mutex_lock(&s->lock);
+  int i = find_entry(s, disk_num, block_num);             //locate selected disk and block
+  if (i != -1) {
+    overwrite_prefetched(s, i);
+    if (block_put(c, s, i, buf) == 1) {                   //update the block with input buf
+      s->entries[i].num_accesses++;
+      c->policy->hit(s->policy_state, i);
+    } else {                                              //no frame for it: better gone than stale
+      entry_drop(c, s, i);
+    }
+  } else if (c->second != NULL) {
+    cache_file_drop(c->second, CACHE_KEY(disk_num, block_num));
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+/* Looks the block at |disk_num| and |block_num|, which memory missed, up in
+ * the second tier of |c|, moving it into |s| if found there. Called with the
+ * shard locked. Returns its entry, or -1. */
+static int second_tier_lookup(cache_t *c, cache_shard_t *s, int disk_num, int block_num, uint64_t start) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  int key = CACHE_KEY(disk_num, block_num), i = -1;
+
+  s->stats.second_queries++;
+  if (cache_file_take(c->second, key, buf) && (i = insert_entry(c, s, disk_num, block_num, buf)) == -1) {
+    cache_file_offer(c->second, key, buf, 2);             //no room in memory: leave it where it was
+  }
+  if (i == -1) {
+    stats_add(STATS_SECOND_TIER_MISSES, 1);
     return -1;
-  } else if (block_num < 0) {                            //set lower bound for block
+  }
+  s->stats.second_hits++;
+  stats_add(STATS_SECOND_TIER_HITS, 1);
+  stats_record(STATS_SECOND_TIER_HIT_NS, clock_ns() - start);
+  return i;
+}
+
+int cache_lookup_r(cache_t *c, int disk_num, int block_num, uint8_t *buf) {
+  if (c == NULL || buf == NULL) {                         //check if cache and buf exist
+    return -1;
+  }
+  if (!valid_location(disk_num, block_num)) {             //check disk and block bounds
     return -1;
   }
 
-  for (int i = 0; i < cache_size; i++) {                 //loop to check for if selected disk and block exists
-    if (cache[i].disk_num == disk_num) {            
-      if (cache[i].block_num == block_num) {
-	memcpy(buf, cache[i].block, JBOD_BLOCK_SIZE);    //copy memory if exists
-	num_hits++;                                      //increment hits if exists
-	num_queries++;                                   //increment queries
-	cache[i].num_accesses++;                         //increment times accessed
-	return 1;
+  if (c->shm != NULL) {
+    return cache_shm_lookup(c->shm, CACHE_KEY(disk_num, block_num), buf);
+  }
+  cache_shard_t *s = shard_of(c, disk_num, block_num);
+  uint64_t start = c->second != NULL ? clock_ns() : 0;    //hits are only timed to tell the tiers apart
+  int rc = -1, i = -1;
+  pthread_mutex_lock(&s->lock);
+  if (s->amount > 0 || c->second != NULL) {               //a lookup going on to the second tier counts too,
+    s->stats.queries++;                                   //so its hits are part of the queries
+  }
+  if (s->amount > 0) {                                    //check if there is any item in cache
+    i = find_entry(s, disk_num, block_num);
+    if (i != -1) {
+      block_get(s, i, buf);                               //copy memory if exists
+      s->stats.hits++;                                    //increment hits if exists
+      if (s->entries[i].prefetched) {                     //read ahead in time
+        s->entries[i].prefetched = false;
+        s->stats.prefetch_hits++;
       }
+      s->entries[i].num_accesses++;
+      c->policy->hit(s->policy_state, i);
+      rc = 1;
     }
   }
-  num_queries++;                                         //increment queries
-  return -1;
+  stats_add(rc == 1 ? STATS_CACHE_HITS : STATS_CACHE_MISSES, 1);
+  if (c->second != NULL && rc == 1) {
+    stats_record(STATS_CACHE_HIT_NS, clock_ns() - start);
+  } else if (c->second != NULL && (i = second_tier_lookup(c, s, disk_num, block_num, start)) != -1) {
+    block_get(s, i, buf);
+    rc = 1;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return rc;
 }
 
-void cache_update(int disk_num, int block_num, const uint8_t *buf) {
-  for (int i = 0; i < cache_size; i++) {                 //locate selected disk and block
-    if (cache[i].disk_num == disk_num) {
-      if (cache[i].block_num == block_num) {
-	memcpy(cache[i].block, buf, JBOD_BLOCK_SIZE);    //update the block with input buf
-	cache[i].num_accesses++;                         //increment times accessed
+/* Returns 1 on success and -1 on failure. Gives |s| the entries and frames
+ * of its share of |num_entries| entries, keeping as many of its blocks as
+ * fit. Called with the shard locked. Fails if a pinned block would have to
+ * move, or if too few blocks can be evicted, in which case those that could
+ * stay evicted. */
+static int shard_resize(cache_t *c, cache_shard_t *s, int num_entries) {
+  shard_tables_t t;
+  int old_size = s->size, old_frames = s->num_frames, size, num_frames;
+
+  shard_layout(c, num_entries, c->num_shards, &size, &num_frames);
+  if (size == old_size && num_frames == old_frames) {
+    s->share = num_entries;
+    return 1;
+  }
+  for (int i = 0; i < old_size; i++) {                    //its pointer is out there
+    if (s->entries[i].valid && s->entries[i].pins > 0 && s->entries[i].frame >= num_frames) {
+      return -1;
+    }
+  }
+  if (num_frames > old_frames && arena_resize(&s->arena, num_frames) == -1) {
+    return -1;
+  }
+  while (old_frames - s->num_free_frames > num_frames) {  //make room, starting with what the policy cares for least
+    if (evict_entry(c, s, evictable_frame) == -1) {
+      return -1;
+    }
+  }
+  while (s->amount > size) {
+    if (evict_entry(c, s, evictable) == -1) {
+      return -1;
+    }
+  }
+
+  int *map = malloc(old_size * sizeof(int));              //where each entry goes, -1 for unused ones
+  if (map == NULL || tables_alloc(&t, size, num_frames) == -1) {
+    free(map);
+    return -1;
+  }
+  for (int i = 0, to = 0; i < old_size; i++) {
+    if (!s->entries[i].valid) {
+      map[i] = -1;
+    } else if (i < size) {                                //stays where it is
+      map[i] = i;
+    } else {                                              //into the next entry below the end nothing uses
+      while (s->entries[to].valid) {
+        to++;
       }
+      map[i] = to++;
     }
   }
+  void *state = c->policy->resize(s->policy_state, size, map);
+  if (state == NULL) {
+    tables_free(&t);
+    free(map);
+    return -1;
+  }
+
+  uint64_t used[CACHE_MAX_ENTRIES / 64] = { 0 };          //frames below the new end
+  for (int i = 0; i < old_size; i++) {                    //nothing can fail from here on
+    if (map[i] != -1) {
+      t.entries[map[i]] = s->entries[i];
+      int frame = s->entries[i].frame;
+      if (frame != -1 && frame < num_frames) {
+        used[frame / 64] |= 1ull << frame % 64;
+      }
+    }
+  }
+  for (int i = 0, to = 0; i < size; i++) {                //blocks past the new end go into frames below it nothing uses
+    cache_entry_t *e = &t.entries[i];
+    if (e->valid && e->frame >= num_frames) {
+      while (used[to / 64] >> to % 64 & 1) {
+        to++;
+      }
+      memcpy(s->blocks[to], s->blocks[e->frame], JBOD_BLOCK_SIZE);
+      e->frame = to++;
+    }
+  }
+  c->policy->destroy(s->policy_state);
+  s->policy_state = state;
+  tables_install(s, &t, size, num_frames);
+  if (num_frames < old_frames) {
+    arena_resize(&s->arena, num_frames);
+  }
+  s->share = num_entries;
+  free(map);
+  return 1;
 }
 
-int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
-  if (cache == NULL) {                                   //check if cache exist
+int cache_resize_r(cache_t *c, int num_entries) {
+  int rc = 1, total = 0;
+
+  if (c == NULL || c->shm != NULL || num_entries < 2 * c->num_shards || num_entries > CACHE_MAX_ENTRIES) {
+    return -1;                                            //a shared one is laid out once for all
+  }
+  for (int i = 0; i < c->num_shards; i++) {               //spread the entries the way cache_create_r does
+    cache_shard_t *s = &c->shards[i];
+    pthread_mutex_lock(&s->lock);
+    if (shard_resize(c, s, num_entries / c->num_shards + (i < num_entries % c->num_shards)) == -1) {
+      rc = -1;                                            //the other shards still get their share
+    }
+    total += s->share;
+    pthread_mutex_unlock(&s->lock);
+  }
+  __atomic_store_n(&c->num_entries, total, __ATOMIC_RELAXED);
+  return rc;
+}
+
+size_t cache_resident_bytes_r(cache_t *c) {
+  size_t bytes;
+
+  if (c == NULL) {
+    return 0;
+  }
+  bytes = sizeof(cache_t) + c->num_shards * sizeof(cache_shard_t);
+  if (c->shm != NULL) {
+    return bytes + cache_shm_resident_bytes(c->shm);
+  }
+  for (int i = 0; i < c->num_shards; i++) {
+    cache_shard_t *s = &c->shards[i];
+    pthread_mutex_lock(&s->lock);
+    bytes += arena_resident_bytes(&s->arena) + s->size * sizeof(cache_entry_t)
+      + (CACHE_GROUP << s->group_bits) * 2 * sizeof(uint16_t);  //the tags and the entry of each
+    pthread_mutex_unlock(&s->lock);
+  }
+  return bytes;
+}
+
+static void lock_all(cache_t *c) {
+  for (int i = 0; i < c->num_shards; i++) {               //always in the same order
+    pthread_mutex_lock(&c->shards[i].lock);
+  }
+}
+
+static void unlock_all(cache_t *c) {
+  for (int i = c->num_shards - 1; i >= 0; i--) {
+    pthread_mutex_unlock(&c->shards[i].lock);
+  }
+}
+
+/* What unordered needs: the shard and which of its entries are ordered. */
+typedef struct {
+  cache_shard_t *shard;
+  bool *taken;
+} order_arg_t;
+
+/* Whether entry |slot| holds a block not yet ordered, for eviction_order. */
+static bool unordered(void *arg, int slot) {
+  order_arg_t *o = arg;
+  return o->shard->entries[slot].valid && !o->taken[slot];
+}
+
+/* Fills |order| with the entries of |s| holding blocks, in the order its
+ * policy would evict them, by evicting all of them from a copy of its state.
+ * Returns how many, or -1 on failure. */
+static int eviction_order(cache_t *c, cache_shard_t *s, int *order) {
+  int *map = malloc(s->size * sizeof(int));
+  bool *taken = calloc(s->size, sizeof(bool));
+  void *copy = NULL;
+  int n = -1;
+
+  if (map != NULL && taken != NULL) {
+    for (int i = 0; i < s->size; i++) {
+      map[i] = s->entries[i].valid ? i : -1;
+    }
+    copy = c->policy->resize(s->policy_state, s->size, map);
+  }
+  if (copy != NULL) {
+    order_arg_t arg = { s, taken };
+    int i;
+    for (n = 0; (i = c->policy->evict(copy, unordered, &arg)) != -1; n++) {
+      order[n] = i;
+      taken[i] = true;
+    }
+    c->policy->destroy(copy);
+  }
+  free(map);
+  free(taken);
+  return n;
+}
+
+static size_t round_up(size_t n, size_t to) {
+  return (n + to - 1) / to * to;
+}
+
+/* Writes the snapshot of |c|, locked, to |f|, with |orders| and |counts|
+ * giving the blocks of each shard. Returns 0 on success and -1 on failure. */
+static int write_snapshot(cache_t *c, FILE *f, uint64_t epoch, int **orders, const int *counts) {
+  snapshot_header_t header;
+  snapshot_shard_t shards[CACHE_MAX_SHARDS];
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  size_t page = sysconf(_SC_PAGESIZE), off;
+  int rc = 0;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.entry_size = sizeof(snapshot_entry_t);
+  header.num_shards = c->num_shards;
+  header.epoch = epoch;
+  header.page_size = page;
+  off = sizeof(header) + c->num_shards * sizeof(snapshot_shard_t);
+  for (int i = 0; i < c->num_shards; i++) {               //lay the file out first
+    shards[i].size = c->shards[i].size;
+    shards[i].num_blocks = counts[i];
+    shards[i].entries_off = off;
+    off += counts[i] * sizeof(snapshot_entry_t);
+  }
+  for (int i = 0; i < c->num_shards; i++) {
+    off = round_up(off, page);                            //so they can be mapped
+    shards[i].blocks_off = off;
+    off += round_up(counts[i] * JBOD_BLOCK_SIZE, page);
+  }
+
+  rc |= fwrite(&header, sizeof(header), 1, f) != 1;
+  rc |= fwrite(shards, sizeof(snapshot_shard_t), c->num_shards, f) != (size_t)c->num_shards;
+  for (int i = 0; i < c->num_shards; i++) {
+    for (int j = 0; j < counts[i]; j++) {
+      cache_entry_t *e = &c->shards[i].entries[orders[i][j]];
+      snapshot_entry_t rec = { e->key, 0, e->num_accesses };
+      rc |= fwrite(&rec, sizeof(rec), 1, f) != 1;
+    }
+  }
+  for (int i = 0; i < c->num_shards; i++) {
+    rc |= fseek(f, shards[i].blocks_off, SEEK_SET) != 0;  //the gaps read as zeros
+    for (int j = 0; j < counts[i]; j++) {
+      rc |= fwrite(block_of(&c->shards[i], orders[i][j], buf), JBOD_BLOCK_SIZE, 1, f) != 1;
+    }
+  }
+  rc |= fflush(f) != 0 || ftruncate(fileno(f), off) != 0;  //up to the end of the last page, which gets mapped whole
+  return rc ? -1 : 0;
+}
+
+int cache_checkpoint_r(cache_t *c, const char *path, uint64_t epoch) {
+  int *orders[CACHE_MAX_SHARDS] = { NULL };
+  int counts[CACHE_MAX_SHARDS];
+  char tmp[4096];
+  FILE *f;
+  int rc = 0;
+
+  if (c == NULL || c->shm != NULL || cache_flush_r(c) == -1) {  //the device must hold what the snapshot claims it does
     return -1;
-  } else if (buf == NULL ) {                             //check if buf exist
+  }
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  f = fopen(tmp, "wb");
+  if (f == NULL) {
     return -1;
   }
-
-  if (disk_num > JBOD_NUM_DISKS) {                       //upper bound for disk
+  lock_all(c);                                            //one consistent picture of all shards
+  for (int i = 0; i < c->num_shards && rc == 0; i++) {
+    cache_shard_t *s = &c->shards[i];
+    orders[i] = malloc(s->size * sizeof(int));
+    counts[i] = orders[i] == NULL ? -1 : eviction_order(c, s, orders[i]);
+    for (int j = 0; j < counts[i] && rc == 0; j++) {     //written again since the flush
+      rc = writeback_entry(c, s, orders[i][j]) == 1 ? 0 : -1;
+    }
+    rc = counts[i] == -1 ? -1 : rc;
+  }
+  if (rc == 0) {
+    rc = write_snapshot(c, f, epoch, orders, counts);
+  }
+  unlock_all(c);
+  for (int i = 0; i < c->num_shards; i++) {
+    free(orders[i]);
+  }
+  if (fclose(f) != 0 || rc != 0 || rename(tmp, path) != 0) {  //readers only ever see a whole snapshot
+    unlink(tmp);
     return -1;
-  } else if (disk_num < 0) {                             //lower bound for disk
+  }
+  return 1;
+}
+
+/* Checks that the snapshot of |len| bytes at |map| is whole and taken at
+ * |epoch|. */
+static bool snapshot_valid(const uint8_t *map, size_t len, uint64_t epoch) {
+  const snapshot_header_t *h = (const snapshot_header_t *)map;
+
+  if (len < sizeof(*h) || memcmp(h->magic, CACHE_SNAPSHOT_MAGIC, sizeof(h->magic)) != 0
+      || h->entry_size != sizeof(snapshot_entry_t) || h->epoch != epoch
+      || h->num_shards < 1 || h->num_shards > CACHE_MAX_SHARDS
+      || len < sizeof(*h) + h->num_shards * sizeof(snapshot_shard_t)) {
+    return false;
+  }
+  const snapshot_shard_t *shards = (const snapshot_shard_t *)(h + 1);
+  for (uint32_t i = 0; i < h->num_shards; i++) {
+    if (shards[i].num_blocks > CACHE_MAX_ENTRIES || shards[i].entries_off > len
+        || shards[i].num_blocks * sizeof(snapshot_entry_t) > len - shards[i].entries_off
+        || shards[i].blocks_off > len || shards[i].num_blocks * JBOD_BLOCK_SIZE > len - shards[i].blocks_off) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Makes entry |i| of |s|, unused, hold |key| as recorded in |rec|, with its
+ * block already in frame |i|. Called with the shard locked. */
+static void attach_entry(cache_t *c, cache_shard_t *s, int i, const snapshot_entry_t *rec) {
+  cache_entry_t *e = &s->entries[i];
+
+  c->policy->insert(s->policy_state, rec->key, i, evictable, s);  //a free slot is always taken
+  e->valid = true;
+  e->dirty = false;
+  e->prefetched = false;
+  e->key = rec->key;
+  e->frame = i;
+  e->runs.num = 0;
+  e->copy = NULL;
+  e->num_accesses = rec->num_accesses;
+  e->pins = 0;
+  tag_add(s, i);
+  s->amount++;
+  if (c->second != NULL) {
+    cache_file_drop(c->second, rec->key);
+  }
+}
+
+int cache_attach_r(cache_t *c, const char *path, uint64_t epoch) {
+  struct stat st;
+  uint8_t *map;
+  int fd, n = 0;
+
+  if (c == NULL || c->shm != NULL || (fd = open(path, O_RDONLY)) == -1) {
     return -1;
   }
-  
-  if (block_num > JBOD_DISK_SIZE) {                      //upper bound for block
+  if (fstat(fd, &st) != 0 || st.st_size == 0
+      || (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    close(fd);
     return -1;
-  } else if (block_num < 0) {                            //lower bound for block
+  }
+  if (!snapshot_valid(map, st.st_size, epoch)) {          //stale blocks must never be served
+    munmap(map, st.st_size);
+    close(fd);
     return -1;
   }
 
-  for (int i = 0; i < cache_size; i++) {                 //loop to check if selected disk and block exists
-    if (cache[i].disk_num == disk_num) {
-      if (cache[i].block_num == block_num) {
-	if(cache[i].valid == 1) {
-	  return -1;                                     //return -1 if it exists
-	}
-      }
+  const snapshot_header_t *h = (const snapshot_header_t *)map;
+  const snapshot_shard_t *shards = (const snapshot_shard_t *)(h + 1);
+  lock_all(c);
+  for (int i = 0; i < c->num_shards; i++) {
+    if (c->shards[i].amount > 0) {                        //only ever into an empty cache
+      n = -1;
     }
   }
+  bool same_layout = h->num_shards == (uint32_t)c->num_shards && h->page_size == (uint64_t)sysconf(_SC_PAGESIZE);
+  for (uint32_t i = 0; i < h->num_shards && n != -1; i++) {
+    const snapshot_entry_t *recs = (const snapshot_entry_t *)(map + shards[i].entries_off);
+    cache_shard_t *s = same_layout ? &c->shards[i] : NULL;
 
-  if (cache_amount == cache_size) {                      //check if cache is full
-    int least_amount_used_position = 0;                  //this section is to find the position of least used cache
-    int current_least_value = cache[0].num_accesses;
-    for(int i = 0; i < cache_size; i++) {
-      if (cache[i].num_accesses < current_least_value) {
-	least_amount_used_position = i;
-	current_least_value = cache[i].num_accesses;
+    if (s != NULL && shards[i].num_blocks <= (uint32_t)s->num_frames
+        && arena_map_file(&s->arena, fd, shards[i].blocks_off, shards[i].num_blocks) == 0) {
+      for (uint32_t j = 0; j < shards[i].num_blocks; j++) {  //block j is already in frame j
+        int disk_num = recs[j].key / JBOD_NUM_BLOCKS_PER_DISK, block_num = recs[j].key % JBOD_NUM_BLOCKS_PER_DISK;
+        if (recs[j].key < CACHE_NUM_KEYS && shard_of(c, disk_num, block_num) == s
+            && find_entry(s, disk_num, block_num) == -1) {
+          attach_entry(c, s, j, &recs[j]);
+        }
       }
+      free_list_rebuild(s);
+      frames_rebuild(s);
+      continue;
     }
-    cache[least_amount_used_position].valid = 1;               //this section is to replace the least used cache
-    cache[least_amount_used_position].disk_num = disk_num;
-    cache[least_amount_used_position].block_num = block_num;
-    memcpy(cache[least_amount_used_position].block, buf, JBOD_BLOCK_SIZE);
-    cache[least_amount_used_position].num_accesses = 1;
-  } else {                                               //if cache is not full
-    int avaliable_position = 0;                          //this section is to find an open spot
-    for(int i = 0; i < cache_size; i++) {                
-      if(cache[i].valid != 1) {
-	avaliable_position = i;
-	break;
+    for (uint32_t j = 0; j < shards[i].num_blocks; j++) { //split differently: copy them over, coldest first
+      int disk_num = recs[j].key / JBOD_NUM_BLOCKS_PER_DISK, block_num = recs[j].key % JBOD_NUM_BLOCKS_PER_DISK;
+      if (recs[j].key >= CACHE_NUM_KEYS) {
+        continue;
+      }
+      cache_shard_t *to = shard_of(c, disk_num, block_num);
+      int k = find_entry(to, disk_num, block_num);
+      if (k == -1 && (k = insert_entry(c, to, disk_num, block_num, map + shards[i].blocks_off + j * JBOD_BLOCK_SIZE)) != -1) {
+        to->entries[k].num_accesses = recs[j].num_accesses;
+      }
+    }
+  }
+  for (int i = 0; i < c->num_shards && n != -1; i++) {    //what it took in and kept, if smaller
+    n += c->shards[i].amount;
+  }
+  unlock_all(c);
+  munmap(map, st.st_size);
+  close(fd);                                              //the arenas keep their own hold on it
+  return n;
+}
+
+int cache_insert_r(cache_t *c, int disk_num, int block_num, const uint8_t *buf) {
+  if (c == NULL || buf == NULL) {                         //check if cache and buf exist
+    return -1;
+  }
+  if (!valid_location(disk_num, block_num)) {             //check disk and block bounds
+    return -1;
+  }
+
+  if (c->shm != NULL) {
+    return cache_shm_insert(c->shm, CACHE_KEY(disk_num, block_num), buf, false);
+  }
+  cache_shard_t *s = shard_of(c, disk_num, block_num);
+  int rc = -1;
+  pthread_mutex_lock(&s->lock);
+  if (find_entry(s, disk_num, block_num) == -1) {         //fail if it exists
+    rc = insert_entry(c, s, disk_num, block_num, buf) == -1 ? -1 : 1;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return rc;
+}
+
+int cache_prefetch_r(cache_t *c, int disk_num, int block_num, const uint8_t *buf) {
+  if (c == NULL || buf == NULL || !valid_location(disk_num, block_num)) {
+    return -1;
+  }
+  if (c->shm != NULL) {
+    return cache_shm_insert(c->shm, CACHE_KEY(disk_num, block_num), buf, true);
+  }
+
+  cache_shard_t *s = shard_of(c, disk_num, block_num);
+  int rc = -1;
+  pthread_mutex_lock(&s->lock);
+  int i = find_entry(s, disk_num, block_num) == -1 ? insert_entry(c, s, disk_num, block_num, buf) : -1;
+  if (i != -1) {
+    s->entries[i].prefetched = true;
+    s->stats.prefetched++;
+    rc = 1;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return rc;
+}
+
+const uint8_t *cache_pin_r(cache_t *c, int disk_num, int block_num) {
+  if (c == NULL || !valid_location(disk_num, block_num)) {
+    return NULL;
+  }
+  if (c->shm != NULL) {
+    return cache_shm_pin(c->shm, CACHE_KEY(disk_num, block_num));
+  }
+
+  cache_shard_t *s = shard_of(c, disk_num, block_num);
+  uint64_t start = c->second != NULL ? clock_ns() : 0;
+  const uint8_t *block = NULL;
+  int i;
+  pthread_mutex_lock(&s->lock);
+  if (s->amount > 0 || c->second != NULL) {               //counted exactly like cache_lookup_r
+    s->stats.queries++;
+  }
+  if (s->amount > 0) {
+    i = find_entry(s, disk_num, block_num);
+    if (i != -1) {
+      s->stats.hits++;
+      if (s->entries[i].prefetched) {
+        s->entries[i].prefetched = false;
+        s->stats.prefetch_hits++;
       }
+      s->entries[i].num_accesses++;
+      c->policy->hit(s->policy_state, i);
+      block = pin_entry(s, i);
+    }
+  }
+  stats_add(block != NULL ? STATS_CACHE_HITS : STATS_CACHE_MISSES, 1);
+  if (c->second != NULL && block != NULL) {
+    stats_record(STATS_CACHE_HIT_NS, clock_ns() - start);
+  } else if (c->second != NULL && (i = second_tier_lookup(c, s, disk_num, block_num, start)) != -1) {
+    block = pin_entry(s, i);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return block;
+}
+
+void cache_unpin_r(cache_t *c, int disk_num, int block_num) {
+  if (c == NULL || !valid_location(disk_num, block_num)) {
+    return;
+  }
+  if (c->shm != NULL) {
+    cache_shm_unpin(c->shm, CACHE_KEY(disk_num, block_num));
+    return;
+  }
+  cache_shard_t *s = shard_of(c, disk_num, block_num);
+  pthread_mutex_lock(&s->lock);
+  int i = find_entry(s, disk_num, block_num);             //a pinned entry cannot have moved
+  if (i != -1 && s->entries[i].pins > 0 && --s->entries[i].pins == 0
+      && (s->entries[i].frame != -1 || s->entries[i].runs.num > 0)) {
+    copy_put(s, i);                                       //unless the copy is what holds the block
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+bool cache_contains_r(cache_t *c, int disk_num, int block_num) {
+  if (c == NULL || !valid_location(disk_num, block_num)) {
+    return false;
+  }
+  if (c->shm != NULL) {
+    return cache_shm_contains(c->shm, CACHE_KEY(disk_num, block_num));
+  }
+  cache_shard_t *s = shard_of(c, disk_num, block_num);
+  pthread_mutex_lock(&s->lock);
+  bool found = find_entry(s, disk_num, block_num) != -1
+    || (c->second != NULL && cache_file_contains(c->second, CACHE_KEY(disk_num, block_num)));
+  pthread_mutex_unlock(&s->lock);
+  return found;
+}
+
+int cache_num_entries_r(cache_t *c) {
+  return c == NULL ? 0 : __atomic_load_n(&c->num_entries, __ATOMIC_RELAXED);
+}
+
+int cache_write_r(cache_t *c, int disk_num, int block_num, const uint8_t *buf) {
+  if (!cache_write_back_r(c) || buf == NULL || !valid_location(disk_num, block_num)) {
+    return -1;
+  }
+
+  cache_shard_t *s = shard_of(c, disk_num, block_num);
+  int rc = 1;
+  pthread_mutex_lock(&s->lock);
+  int i = find_entry(s, disk_num, block_num);
+  if (i != -1) {                                          //absorb the write into the cached block
+    overwrite_prefetched(s, i);
+    if (block_put(c, s, i, buf) == 1) {
+      s->entries[i].num_accesses++;
+      c->policy->hit(s->policy_state, i);
+    } else {                                              //no frame for it: the write goes through
+      entry_drop(c, s, i);
+      i = -1;
     }
-    cache[avaliable_position].valid = 1;                       //this section is to insert data into the open spot
-    cache[avaliable_position].disk_num = disk_num;
-    cache[avaliable_position].block_num = block_num;
-    memcpy(cache[avaliable_position].block, buf, JBOD_BLOCK_SIZE);
-    cache[avaliable_position].num_accesses = 1;
-    cache_amount++;                                            //increment tracking of item amount in cache
+  } else {
+    i = insert_entry(c, s, disk_num, block_num, buf);
   }
+  if (i == -1) {
+    rc = -1;
+  } else {
+    s->entries[i].dirty = true;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return rc;
+}
+
+int cache_flush_r(cache_t *c) {
+  int rc = 1;
+  if (!cache_write_back_r(c)) {
+    return 1;
+  }
+  for (int key = 0; key < CACHE_NUM_KEYS; key++) {        //in block order, so the device head sweeps forward
+    int disk_num = key / JBOD_NUM_BLOCKS_PER_DISK, block_num = key % JBOD_NUM_BLOCKS_PER_DISK;
+    cache_shard_t *s = shard_of(c, disk_num, block_num);
+    pthread_mutex_lock(&s->lock);
+    int i = find_entry(s, disk_num, block_num);
+    if (i != -1 && writeback_entry(c, s, i) == -1) {      //keep going past failures, report them at the end
+      rc = -1;
+    }
+    pthread_mutex_unlock(&s->lock);
+  }
+  return rc;
+}
+
+void cache_get_stats_r(cache_t *c, cache_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (c == NULL) {
+    return;
+  }
+  if (c->shm != NULL) {
+    cache_shm_get_stats(c->shm, stats);
+    return;
+  }
+  for (int i = 0; i < c->num_shards; i++) {
+    cache_shard_t *s = &c->shards[i];
+    pthread_mutex_lock(&s->lock);
+    stats->queries += s->stats.queries;
+    stats->hits += s->stats.hits;
+    stats->evictions += s->stats.evictions;
+    stats->writebacks += s->stats.writebacks;
+    stats->prefetched += s->stats.prefetched;
+    stats->prefetch_hits += s->stats.prefetch_hits;
+    stats->prefetch_unused += s->stats.prefetch_unused;
+    stats->second_queries += s->stats.second_queries;
+    stats->second_hits += s->stats.second_hits;
+    stats->second_admitted += s->stats.second_admitted;
+    stats->blocks += s->amount;
+    for (int j = 0; j < s->size; j++) {
+      stats->run_blocks += s->entries[j].valid && s->entries[j].runs.num > 0;
+    }
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+cache_t *cache_default(void) {
+  return default_cache;
+}
+
+int cache_create(int num_entries) {
+  if (default_cache != NULL) {                            //check if cache exist
+    return -1;
+  }
+  if (shared_name != NULL) {
+    default_cache = write_back ? NULL : cache_create_shared_r(shared_name, num_entries, 1);
+  } else {
+    default_cache = cache_create_r(num_entries, 1, policy->name, write_back);
+  }
+  if (default_cache != NULL && second_path != NULL
+      && cache_set_second_tier_r(default_cache, second_path, second_admission) == -1) {
+    cache_destroy_r(default_cache);
+    default_cache = NULL;
+  }
+  if (default_cache == NULL) {
+    return -1;
+  }
+  memset(&default_stats, 0, sizeof(default_stats));      //reset queries, hits and friends
   return 1;
 }
 
+int cache_set_policy(const char *name) {
+  const cache_policy_ops_t *p = cache_policy_lookup(name);
+  if (p == NULL || default_cache != NULL) {               //policy must exist and cache must not
+    return -1;
+  }
+  policy = p;
+  return 1;
+}
+
+void cache_set_huge_pages(bool enabled) {
+  huge_pages = enabled;
+}
+
+int cache_set_compact(int slots) {
+  if (slots < 0 || slots > CACHE_MAX_COMPACT_SLOTS) {
+    return -1;
+  }
+  compact_slots = slots;
+  return 1;
+}
+
+int cache_set_second_tier(const char *path, const char *admission) {
+  if (default_cache != NULL) {                            //only a cache no one uses yet can take one
+    return -1;
+  }
+  second_path = path;
+  second_admission = admission;
+  return 1;
+}
+
+int cache_set_shared(const char *name) {
+  if (default_cache != NULL) {                            //a cache cannot move into or out of a segment
+    return -1;
+  }
+  if (name != NULL && !cache_shm_valid_name(name)) {
+    return -1;
+  }
+  shared_name = name;
+  return 1;
+}
+
+int cache_checkpoint(const char *path, uint64_t epoch) {
+  return cache_checkpoint_r(default_cache, path, epoch);
+}
+
+int cache_attach(const char *path, uint64_t epoch) {
+  return cache_attach_r(default_cache, path, epoch);
+}
+
+int cache_resize(int num_entries) {
+  return cache_resize_r(default_cache, num_entries);
+}
+
+size_t cache_resident_bytes(void) {
+  return cache_resident_bytes_r(default_cache);
+}
+
+int cache_set_write_back(bool enabled) {
+  if (default_cache != NULL) {                            //mode cannot change under an existing cache
+    return -1;
+  }
+  write_back = enabled;
+  return 1;
+}
+
+bool cache_write_back(void) {
+  return cache_write_back_r(default_cache);
+}
+
+int cache_destroy(void) {
+  if (default_cache == NULL) {                            //check if cache exist
+    return -1;
+  }
+  cache_flush_r(default_cache);                           //counts the last writebacks too
+  cache_get_stats_r(default_cache, &default_stats);      //keep the numbers for cache_print_hit_rate
+  cache_destroy_r(default_cache);
+  default_cache = NULL;
+  return 1;
+}
+
+int cache_lookup(int disk_num, int block_num, uint8_t *buf) {
+  return cache_lookup_r(default_cache, disk_num, block_num, buf);
+}
+
+void cache_update(int disk_num, int block_num, const uint8_t *buf) {
+  cache_update_r(default_cache, disk_num, block_num, buf);
+}
+
+int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
+  return cache_insert_r(default_cache, disk_num, block_num, buf);
+}
+
+int cache_write(int disk_num, int block_num, const uint8_t *buf) {
+  return cache_write_r(default_cache, disk_num, block_num, buf);
+}
+
+int cache_flush(void) {
+  return cache_flush_r(default_cache);
+}
+
 bool cache_enabled(void) {
-	return cache != NULL && cache_size > 0;
+	return default_cache != NULL;
+}
+
+void cache_get_stats(cache_stats_t *stats) {
+  *stats = default_stats;
+  if (default_cache != NULL) {
+    cache_get_stats_r(default_cache, stats);
+  }
 }
 
 void cache_print_hit_rate(void) {
-	fprintf(stderr, "num_hits: %d, num_queries: %d\n", num_hits, num_queries);
-	fprintf(stderr, "Hit rate: %5.1f%%\n", 100 * (float) num_hits / num_queries);
+	cache_stats_t stats;
+	cache_get_stats(&stats);
+	fprintf(stderr, "num_hits: %lu, num_queries: %lu\n", stats.hits, stats.queries);
+	fprintf(stderr, "Hit rate: %5.1f%%\n", stats.queries ? 100 * (float) stats.hits / stats.queries : 0.0);
+	fprintf(stderr, "Policy: %s, evictions: %lu\n", shared_name != NULL ? "clock, shared" : policy->name,
+	        stats.evictions);
+	if (write_back) {
+		fprintf(stderr, "Write-back: %lu blocks written back\n", stats.writebacks);
+	}
+	if (compact_slots > 1 && shared_name == NULL) {
+		fprintf(stderr, "Compact: %lu blocks held, %lu of them as runs (%.1f%%)\n", stats.blocks, stats.run_blocks,
+		        stats.blocks ? 100.0 * stats.run_blocks / stats.blocks : 0.0);
+	}
+	if (second_path != NULL) {
+		histogram_t memory_ns, second_ns;
+		stats_histogram_total(STATS_CACHE_HIT_NS, &memory_ns);
+		stats_histogram_total(STATS_SECOND_TIER_HIT_NS, &second_ns);
+		fprintf(stderr, "Second tier: %lu hits of %lu memory misses (%.1f%%), %lu blocks admitted, "
+		        "combined hit rate %5.1f%%\n", stats.second_hits, stats.second_queries,
+		        stats.second_queries ? 100.0 * stats.second_hits / stats.second_queries : 0.0,
+		        stats.second_admitted, stats.queries ? 100.0 * (stats.hits + stats.second_hits) / stats.queries : 0.0);
+		fprintf(stderr, "Hit latency: memory p50 %llu ns p99 %llu ns, second tier p50 %llu ns p99 %llu ns\n",
+		        (unsigned long long)histogram_percentile(&memory_ns, 50),
+		        (unsigned long long)histogram_percentile(&memory_ns, 99),
+		        (unsigned long long)histogram_percentile(&second_ns, 50),
+		        (unsigned long long)histogram_percentile(&second_ns, 99));
+	}
+	if (stats.prefetched > 0) {
+		fprintf(stderr, "Prefetch: %lu blocks, %lu used, %lu unused (JBOD cost %lu), %lu still cached\n",
+		        stats.prefetched, stats.prefetch_hits, stats.prefetch_unused,
+		        stats.prefetch_unused * jbod_op_cost(JBOD_READ_BLOCK),
+		        stats.prefetched - stats.prefetch_hits - stats.prefetch_unused);
+	}
+	fprintf(stderr, "JBOD cost: %lu, reads: %lu, writes: %lu, round trips: %lu\n", jbod_client_cost(),
+	        jbod_client_op_count(JBOD_READ_BLOCK), jbod_client_op_count(JBOD_WRITE_BLOCK),
+	        jbod_client_round_trips());
 }
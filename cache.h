@@ -2,28 +2,215 @@
 #define CACHE_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "jbod.h"
 #include "util.h"
 
+/* Most shards a cache can be split into. */
+#define CACHE_MAX_SHARDS 64
+
+/* Most entries a compact cache can have for the memory of one, see
+ * cache_set_compact. */
+#define CACHE_MAX_COMPACT_SLOTS 4
+
+/* A block cache. Caches are safe to share between threads: every shard has
+ * its own lock. */
+typedef struct cache cache_t;
+
+/* Counters of a cache, summed over its shards. */
 typedef struct {
-  bool valid;
-  int disk_num;
-  int block_num;
-  uint8_t block[JBOD_BLOCK_SIZE];
-  int num_accesses;
-} cache_entry_t;
+  unsigned long queries;
+  unsigned long hits;
+  unsigned long evictions;
+  unsigned long writebacks;
+  unsigned long prefetched;     /* blocks put in by cache_prefetch_r */
+  unsigned long prefetch_hits;  /* of those, blocks later found by a lookup */
+  unsigned long prefetch_unused;  /* of those, blocks evicted or overwritten before any lookup */
+  unsigned long second_queries;   /* lookups that missed memory and tried the second tier */
+  unsigned long second_hits;      /* of those, blocks found there */
+  unsigned long second_admitted;  /* evicted blocks the second tier took in */
+  unsigned long blocks;           /* blocks held when the counters were taken */
+  unsigned long run_blocks;       /* of those, blocks kept as runs of one byte */
+} cache_stats_t;
+
+/* Writes a dirty block back to the device; |arg| is the one given to
+ * cache_set_writeback_fn_r. Returns 0 on success and -1 on failure. */
+typedef int (*cache_writeback_fn_t)(void *arg, int disk_num, int block_num, const uint8_t *buf);
+
+/* Returns a new cache of |num_entries| entries split into |num_shards| shards
+ * (1 to CACHE_MAX_SHARDS, at least two entries each), using the replacement
+ * policy called |policy| (NULL for "lru") and write-back mode if |write_back|
+ * is true. Returns NULL on failure. */
+cache_t *cache_create_r(int num_entries, int num_shards, const char *policy, bool write_back);
+
+/* Returns a write-through cache like cache_create_r, shared with every other
+ * process opening the shared memory segment called |name| (see cache_shm.h),
+ * or NULL on failure. Replacement is always CLOCK. The cache is made empty if
+ * no other process has it, and it must be split the same way otherwise. It
+ * cannot be resized, saved or filled from a snapshot. */
+cache_t *cache_create_shared_r(const char *name, int num_entries, int num_shards);
+
+/* The functions below ending in _r work like the ones of the same name
+ * without the suffix, on cache |c| instead of the default cache. A NULL |c|
+ * behaves like a disabled cache. */
+int cache_destroy_r(cache_t *c);
+int cache_lookup_r(cache_t *c, int disk_num, int block_num, uint8_t *buf);
+int cache_insert_r(cache_t *c, int disk_num, int block_num, const uint8_t *buf);
+void cache_update_r(cache_t *c, int disk_num, int block_num, const uint8_t *buf);
+int cache_write_r(cache_t *c, int disk_num, int block_num, const uint8_t *buf);
+int cache_flush_r(cache_t *c);
+bool cache_write_back_r(cache_t *c);
+
+/* Returns 1 on success and -1 on failure. Like cache_insert_r, for a block
+ * read ahead of demand: it counts as a prefetch hit if a lookup finds it
+ * before it is evicted or overwritten, and as unused otherwise. */
+int cache_prefetch_r(cache_t *c, int disk_num, int block_num, const uint8_t *buf);
+
+/* Returns a read-only pointer to the block at |disk_num| and |block_num| in
+ * |c|, or NULL if it is not cached, counting a query and a hit the way
+ * cache_lookup_r does. The entry is pinned until cache_unpin_r: it is not
+ * evicted, so the pointer stays valid, though a write of the same block by
+ * another thread may still change its contents. */
+const uint8_t *cache_pin_r(cache_t *c, int disk_num, int block_num);
+
+/* Releases one pin taken by cache_pin_r on the block at |disk_num| and
+ * |block_num|. */
+void cache_unpin_r(cache_t *c, int disk_num, int block_num);
+
+/* Returns true if |c| holds the block at |disk_num| and |block_num|, in
+ * memory or in its second tier, without counting a query or making the block
+ * more recently used. */
+bool cache_contains_r(cache_t *c, int disk_num, int block_num);
+
+/* Returns the number of entries of |c|, 0 if |c| is NULL. */
+int cache_num_entries_r(cache_t *c);
+
+/* Returns 1 on success and -1 on failure. Gives |c| |num_entries| entries,
+ * within the bounds of cache_create_r, while other threads keep using it.
+ * Growing keeps every block; shrinking keeps those the policy would evict
+ * last, moving them but never a pinned one. Fails, leaving a shard at its
+ * old size, if that shard would have to move a pinned block or cannot evict
+ * enough of them; the other shards are still resized, and
+ * cache_num_entries_r tells the size reached. */
+int cache_resize_r(cache_t *c, int num_entries);
+
+/* Returns 1 on success and -1 on failure. Saves the blocks of |c| and the
+ * order its policy would evict them in to the snapshot file at |path|,
+ * replacing it whole, first writing dirty blocks back, as the snapshot
+ * stands for blocks the device holds at mount epoch |epoch| (see
+ * jbod_epoch_r in net.h). */
+int cache_checkpoint_r(cache_t *c, const char *path, uint64_t epoch);
+
+/* Returns the number of blocks |c| takes in from the snapshot file at
+ * |path|, or -1 if there is none, it is damaged or was taken at another
+ * mount epoch than |epoch|, or |c| holds blocks already. The blocks keep
+ * the order of recency they were saved in; if |c| is split into
+ * as many shards as the cache saved and each of them is large enough, they
+ * are mapped from the file and only read in once looked up. */
+int cache_attach_r(cache_t *c, const char *path, uint64_t epoch);
+
+/* Returns the bytes of memory |c| takes up: the pages of blocks resident,
+ * as the kernel counts them, and its bookkeeping, apart from the state of
+ * the replacement policy and the pages of its second tier the kernel keeps
+ * in its page cache. */
+size_t cache_resident_bytes_r(cache_t *c);
+
+/* Returns 1 on success and -1 on failure. Makes |fn| called with |arg| the
+ * way dirty blocks of |c| reach the device. Fails if another |arg| already
+ * holds that role, since a write-back cache can only write through one
+ * connection. A NULL |fn| gives the role up if |arg| holds it. */
+int cache_set_writeback_fn_r(cache_t *c, cache_writeback_fn_t fn, void *arg);
+
+/* Returns 1 on success and -1 on failure. Gives |c| a second tier in a new
+ * file at |path| (see cache_file.h) admitting blocks with the policy called
+ * |admission|: "all" (NULL, the default) or "reused". Lookups that miss
+ * memory then try it before failing, and the hits of memory and of the
+ * second tier are timed for the stats. Fails for a shared cache or if |c|
+ * has a second tier already. Must be called before other threads use |c|. */
+int cache_set_second_tier_r(cache_t *c, const char *path, const char *admission);
+
+/* Fills |stats| with the counters of |c|. */
+void cache_get_stats_r(cache_t *c, cache_stats_t *stats);
+
+/* Returns 1 on success and -1 on failure. Makes every cache look blocks up
+ * with the key compare called |name|: "avx2", "sse2" or "scalar", and scan
+ * them for runs (see cache_set_compact) with the same instructions. Fails if
+ * the CPU cannot run it. The best one the CPU has is used otherwise. Meant
+ * for benchmarks: it must not be called while another thread uses a cache. */
+int cache_set_probe(const char *name);
+
+/* Returns the name of the key compare in use. */
+const char *cache_probe(void);
+
+/* Makes caches created afterwards keep their blocks in huge pages, or in
+ * base pages again if |enabled| is false. Every shard then takes at least
+ * one huge page. Where the system has no huge pages to give, blocks quietly
+ * go in base pages. */
+void cache_set_huge_pages(bool enabled);
+
+/* Returns 1 on success and -1 on failure. Makes private caches created
+ * afterwards compact if |slots| is 2 to CACHE_MAX_COMPACT_SLOTS: a block made
+ * of up to four runs of one byte, as the blocks a fill writes are, is kept as
+ * those runs in its entry, with no frame, and a cache has |slots| entries for
+ * the memory of every one it is created or resized with, giving up as many
+ * frames as the extra entries take. It then holds up to |slots| times as
+ * many blocks when most blocks are like that, and fewer when most are not;
+ * cache_num_entries_r still counts the entries it was given. A |slots| of 0
+ * or 1 makes caches keep every block in a frame again. */
+int cache_set_compact(int slots);
+
+/* Returns 1 on success and -1 on failure. Makes default caches created
+ * afterwards have a second tier, as cache_set_second_tier_r gives them, or
+ * none again if |path| is NULL. Fails if a default cache currently exists. */
+int cache_set_second_tier(const char *path, const char *admission);
+
+/* Returns 1 on success and -1 on failure. Makes default caches created
+ * afterwards shared through the segment called |name|, as
+ * cache_create_shared_r does, or private again if |name| is NULL. Those
+ * cannot be in write-back mode. Fails if a default cache currently exists or
+ * |name| is not a valid segment name. */
+int cache_set_shared(const char *name);
+
+/* Returns the default cache, NULL if there is none. */
+cache_t *cache_default(void);
 
 /* Returns 1 on success and -1 on failure. Should allocate a space for
- * |num_entries| cache entries, each of type cache_entry_t. Calling it again
- * without first calling cache_destroy (see below) should fail. */
+ * |num_entries| cache entries, each holding a block, as the default
+ * cache. Calling it again without first calling cache_destroy (see below)
+ * should fail. */
 int cache_create(int num_entries);
 
+/* Returns 1 on success and -1 on failure. Selects the replacement policy used
+ * by default caches created afterwards: "lru" (the default), "clock", "2q" or
+ * "arc". Fails if |name| is unknown or a default cache currently exists. */
+int cache_set_policy(const char *name);
+
+/* Returns 1 on success and -1 on failure. Selects write-back mode (|enabled|
+ * true) or the default write-through mode for default caches created
+ * afterwards. Fails if a default cache currently exists. */
+int cache_set_write_back(bool enabled);
+
+/* Returns true if the cache is enabled and in write-back mode. */
+bool cache_write_back(void);
+
 /* Returns 1 on success and -1 on failure. Frees the space allocated by
- * cache_create function above. */
+ * cache_create function above, first trying to write back dirty blocks. */
 int cache_destroy(void);
 
+/* Like cache_checkpoint_r and cache_attach_r, on the default cache. */
+int cache_checkpoint(const char *path, uint64_t epoch);
+int cache_attach(const char *path, uint64_t epoch);
+
+/* Returns 1 on success and -1 on failure. Resizes the default cache to
+ * |num_entries| entries, as cache_resize_r does. */
+int cache_resize(int num_entries);
+
+/* Returns the bytes of memory the default cache takes up, 0 if there is
+ * none. */
+size_t cache_resident_bytes(void);
+
 /* Returns 1 on success and -1 on failure. Looks up the block located at
  * |disk_num| and |block_num| in cache and if found, copies the corresponding
  * block to |buf|, which must not be NULL. */
@@ -31,18 +218,34 @@ int cache_lookup(int disk_num, int block_num, uint8_t *buf);
 
 /* Returns 1 on success and -1 on failure. Inserts an entry for |disk_num| and
  * |block_num| into cache. Returns -1 if there is already an existing entry in the cache
- * with |disk_num| and |block_num|.If there cache is full, should evict least
- * recently used entry and insert the new entry. */
+ * with |disk_num| and |block_num|. If the cache is full, evicts the entry
+ * chosen by the replacement policy and inserts the new entry; pinned entries
+ * are passed over, and the insert fails if every entry is pinned. */
 int cache_insert(int disk_num, int block_num, const uint8_t *buf);
 
 /* If the entry with |disk_num| and |block_num| exists, updates the
- * corresponding block with data from |buf| */
+ * corresponding block with data from |buf| and marks it most recently used. */
 void cache_update(int disk_num, int block_num, const uint8_t *buf);
 
+/* Returns 1 on success and -1 on failure. Write-back mode only: inserts or
+ * updates the entry for |disk_num| and |block_num| with |buf| and marks it
+ * dirty, so that it is written to the device when evicted or flushed. */
+int cache_write(int disk_num, int block_num, const uint8_t *buf);
+
+/* Returns 1 on success and -1 on failure. Writes every dirty block back to
+ * the device and marks it clean. Does nothing in write-through mode. */
+int cache_flush(void);
+
 /* Returns true if cache is enabled and false if not. */
 bool cache_enabled(void);
 
-/* Prints the hit rate of the cache. */
+/* Fills |stats| with the counters of the default cache, or of the last one
+ * if it was destroyed. */
+void cache_get_stats(cache_stats_t *stats);
+
+/* Prints the hit rate and evictions of the default cache, the policy in use,
+ * the hits and hit latencies of each tier if it has a second one and the JBOD
+ * cost of all operations sent over the default connection. */
 void cache_print_hit_rate(void);
 
 #endif
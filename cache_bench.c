@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "cache.h"
+#include "cache_policy.h"
+#include "jbod.h"
+
+/* Microbenchmark for the block cache alone. Replays the block accesses of a
+ * trace file (READ and WRITE lines, split into the blocks they touch) against
+ * caches of increasing size and reports the average time per cache operation,
+ * so changes to cache.c can be measured without a jbod_server.
+ *
+ * With -t, it instead measures how lookups that all hit scale with the number
+ * of threads sharing one cache of -S shards, from 1 thread up to -t.
+ *
+ * With -P, it measures how fast full caches of increasing size find blocks,
+ * half of which they hold, with every key compare the CPU can run, along with
+ * the last level cache misses per probe where the kernel lets it count them.
+ *
+ * With -Z, it replays the trace against one cache of -S shards resized
+ * between passes, from 4096 entries down to 64 and back up, and reports how
+ * long each resize took, how many blocks it kept, and the hit rate of the
+ * pass after and the memory the cache took up by its end. -H puts the blocks in huge pages. */
+
+#define USAGE "USAGE: cache_bench [-w workload-file] [-r repeat] [-p cache_policy] [-t threads] [-S shards] [-P] [-Z] [-H]\n"
+
+typedef struct {
+  int disk_num;
+  int block_num;
+  int is_write;
+} access_t;
+
+static access_t *accesses = NULL;
+static int num_accesses = 0;
+
+static void add_access(int disk_num, int block_num, int is_write) {
+  static int capacity = 0;
+  if (num_accesses == capacity) {
+    capacity = capacity ? capacity * 2 : 4096;
+    accesses = realloc(accesses, capacity * sizeof(access_t));
+    if (accesses == NULL)
+      err(1, "realloc");
+  }
+  accesses[num_accesses].disk_num = disk_num;
+  accesses[num_accesses].block_num = block_num;
+  accesses[num_accesses].is_write = is_write;
+  num_accesses++;
+}
+
+static void load_workload(const char *workload) {
+  char line[256], cmd[32];
+  uint32_t addr, len, ch;
+
+  FILE *f = fopen(workload, "r");
+  if (!f)
+    err(1, "Cannot open workload file %s", workload);
+
+  while (fgets(line, 256, f)) {
+    if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4 || len == 0)
+      continue;                                   //MOUNT, SIGNALL and friends do not touch the cache
+    int is_write = strcmp(cmd, "WRITE") == 0;
+    for (uint32_t a = addr / JBOD_BLOCK_SIZE; a <= (addr + len - 1) / JBOD_BLOCK_SIZE; a++)
+      add_access(a / JBOD_NUM_BLOCKS_PER_DISK, a % JBOD_NUM_BLOCKS_PER_DISK, is_write);
+  }
+  fclose(f);
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+typedef struct {
+  cache_t *cache;
+  int first;                                      //where in the accesses this thread starts
+  int repeat;
+  long hits;
+} hit_worker_t;
+
+static void *hit_worker(void *arg) {
+  hit_worker_t *w = arg;
+  uint8_t block[JBOD_BLOCK_SIZE];
+  for (int r = 0; r < w->repeat; r++) {
+    for (int i = 0; i < num_accesses; i++) {
+      access_t *a = &accesses[(w->first + i) % num_accesses];
+      w->hits += cache_lookup_r(w->cache, a->disk_num, a->block_num, block) == 1;
+    }
+  }
+  return NULL;
+}
+
+/* Fills a cache of every block of the array, then times the trace's lookups,
+ * all of them hits, from 1 up to |max_threads| threads sharing the cache. */
+static void bench_threads(int max_threads, int num_shards, int repeat, const char *policy) {
+  uint8_t block[JBOD_BLOCK_SIZE];
+  pthread_t threads[max_threads];
+  hit_worker_t workers[max_threads];
+  double base = 0;
+
+  cache_t *cache = cache_create_r(4096, num_shards, policy, false);
+  if (cache == NULL)
+    errx(1, "Failed to create cache of %d shards.", num_shards);
+  memset(block, 0, JBOD_BLOCK_SIZE);
+  for (int d = 0; d < JBOD_NUM_DISKS; d++)
+    for (int b = 0; b < JBOD_NUM_BLOCKS_PER_DISK; b++)
+      cache_insert_r(cache, d, b, block);
+
+  printf("%8s %12s %10s\n", "threads", "Mlookups/s", "speedup");
+  for (int n = 1; n <= max_threads; n *= 2) {
+    long hits = 0;
+    double start = now_ns();
+    for (int i = 0; i < n; i++) {
+      workers[i] = (hit_worker_t){ cache, i * num_accesses / n, repeat, 0 };
+      if (pthread_create(&threads[i], NULL, hit_worker, &workers[i]) != 0)
+        errx(1, "Failed to start thread %d.", i);
+    }
+    for (int i = 0; i < n; i++) {
+      pthread_join(threads[i], NULL);
+      hits += workers[i].hits;
+    }
+    double rate = (double)n * repeat * num_accesses / (now_ns() - start) * 1e3;
+    if (n == 1)
+      base = rate;
+    if (hits != (long)n * repeat * num_accesses)
+      errx(1, "Lookups missed a full cache.");
+    printf("%8d %12.2f %9.2fx\n", n, rate, rate / base);
+    if (n < max_threads && n * 2 > max_threads)
+      n = max_threads / 2;                        //always end with max_threads
+  }
+  cache_destroy_r(cache);
+}
+
+/* Returns a counter of the last level cache misses of this thread, or -1 if
+ * there is none, as in most virtual machines. */
+static int llc_counter(void) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long llc_read(int fd) {
+  long long count = 0;
+  if (fd == -1 || read(fd, &count, sizeof(count)) != sizeof(count))
+    return -1;
+  return count;
+}
+
+/* Returns the number of blocks of the array |c| holds. */
+static int count_cached(cache_t *c) {
+  int n = 0;
+  for (int key = 0; key < CACHE_NUM_KEYS; key++)
+    n += cache_contains_r(c, key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK);
+  return n;
+}
+
+/* Times cache_contains_r on full caches of 64 to 4096 entries in |num_shards|
+ * shards, for keys half of which are cached, with every key compare. */
+static void bench_probes(int num_shards, int repeat, const char *policy) {
+  static const char *probes[] = { "scalar", "sse2", "avx2" };
+  enum { NUM_KEYS = 1 << 16 };
+  static uint16_t keys[NUM_KEYS];
+  uint8_t block[JBOD_BLOCK_SIZE];
+  int fd = llc_counter();
+
+  memset(block, 0, JBOD_BLOCK_SIZE);
+  printf("%8s %8s %12s %14s\n", "entries", "probe", "Mprobes/s", "LLC miss/probe");
+  for (int size = 64; size <= 4096; size *= 4) {
+    cache_t *cache = cache_create_r(size, size / 2 < num_shards ? size / 2 : num_shards, policy, false);
+    bool cached[CACHE_NUM_KEYS] = { false };
+    int hits = 0;
+
+    if (cache == NULL)
+      errx(1, "Failed to create cache of %d entries.", size);
+    srand(size);
+    for (int held = 0; held < size; held = count_cached(cache)) {  //fill it with random blocks, until every
+      for (int n = held; n < size; n++) {         //shard is full: a key landing in a full one evicts another
+        int key = rand() % CACHE_NUM_KEYS;
+        if (!cache_contains_r(cache, key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK))
+          cache_insert_r(cache, key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, block);
+      }
+    }
+    for (int key = 0; key < CACHE_NUM_KEYS; key++)
+      cached[key] = cache_contains_r(cache, key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK);
+    for (int i = 0; i < NUM_KEYS; i++) {          //then probe for as many cached blocks as others
+      int key;
+      do {
+        key = rand() % CACHE_NUM_KEYS;
+      } while (cached[key] != (i % 2 == 0) && size < CACHE_NUM_KEYS);
+      keys[i] = key;
+      hits += cached[key];
+    }
+
+    for (size_t p = 0; p < sizeof(probes) / sizeof(probes[0]); p++) {
+      long found = 0;
+      if (cache_set_probe(probes[p]) != 1)
+        continue;
+      if (fd != -1) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+      double start = now_ns();
+      for (int r = 0; r < repeat; r++)
+        for (int i = 0; i < NUM_KEYS; i++)
+          found += cache_contains_r(cache, keys[i] / JBOD_NUM_BLOCKS_PER_DISK, keys[i] % JBOD_NUM_BLOCKS_PER_DISK);
+      double elapsed = now_ns() - start;
+      if (fd != -1)
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      long long misses = llc_read(fd);
+      if (found != (long)hits * repeat)
+        errx(1, "The %s probe found %ld blocks instead of %ld.", probes[p], found, (long)hits * repeat);
+      printf("%8d %8s %12.2f ", size, probes[p], (double)repeat * NUM_KEYS / elapsed * 1e3);
+      if (misses >= 0)
+        printf("%14.3f\n", (double)misses / repeat / NUM_KEYS);
+      else
+        printf("%14s\n", "n/a");
+    }
+    cache_destroy_r(cache);
+  }
+  if (fd != -1)
+    close(fd);
+}
+
+/* Replays the trace |repeat| times against |c|, inserting what misses.
+ * Returns the hit rate in percent. */
+static double replay(cache_t *c, int repeat) {
+  uint8_t block[JBOD_BLOCK_SIZE];
+  long hits = 0;
+
+  memset(block, 0, JBOD_BLOCK_SIZE);
+  for (int r = 0; r < repeat; r++) {
+    for (int i = 0; i < num_accesses; i++) {
+      access_t *a = &accesses[i];
+      if (cache_lookup_r(c, a->disk_num, a->block_num, block) == 1) {
+        hits++;
+        if (a->is_write)
+          cache_update_r(c, a->disk_num, a->block_num, block);
+      } else {
+        cache_insert_r(c, a->disk_num, a->block_num, block);
+      }
+    }
+  }
+  return 100.0 * hits / ((long)repeat * num_accesses);
+}
+
+/* Resizes one cache of |num_shards| shards down and back up between
+ * replays of the trace. */
+static void bench_resize(int num_shards, int repeat, const char *policy) {
+  static const int sizes[] = { 4096, 1024, 256, 64, 256, 1024, 4096 };
+  cache_t *cache = cache_create_r(sizes[0], num_shards, policy, false);
+
+  if (cache == NULL)
+    errx(1, "Failed to create cache of %d shards.", num_shards);
+  printf("%8s %12s %8s %12s %10s\n", "entries", "resize us", "kept", "KiB used", "hit rate");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    int before = count_cached(cache);
+    double start = now_ns();
+    if (cache_resize_r(cache, sizes[i]) != 1)
+      errx(1, "Failed to resize the cache to %d entries.", sizes[i]);
+    double elapsed = now_ns() - start;
+    int kept = count_cached(cache);
+    if (kept != (before < sizes[i] ? before : sizes[i]))
+      errx(1, "Resizing to %d entries kept %d of %d blocks.", sizes[i], kept, before);
+    double hit_rate = replay(cache, repeat);
+    printf("%8d %12.1f %8d %12.1f %9.1f%%\n", sizes[i], elapsed / 1e3, kept, cache_resident_bytes_r(cache) / 1024.0, hit_rate);
+  }
+  cache_destroy_r(cache);
+}
+
+int main(int argc, char *argv[]) {
+  const char *workload = "traces/random-input";
+  const char *policy = NULL;
+  int repeat = 20, max_threads = 0, num_shards = 16, ch;
+  bool probes = false, resize = false;
+  uint8_t block[JBOD_BLOCK_SIZE];
+
+  while ((ch = getopt(argc, argv, "hw:r:p:t:S:PZH")) != -1) {
+    switch (ch) {
+      case 'w':
+        workload = optarg;
+        break;
+      case 'r':
+        repeat = atoi(optarg);
+        break;
+      case 'p':
+        if (cache_set_policy(optarg) != 1)
+          errx(1, "Unknown cache policy (%s).", optarg);
+        policy = optarg;
+        break;
+      case 't':
+        max_threads = atoi(optarg);
+        break;
+      case 'S':
+        num_shards = atoi(optarg);
+        break;
+      case 'P':
+        probes = true;
+        break;
+      case 'Z':
+        resize = true;
+        break;
+      case 'H':
+        cache_set_huge_pages(true);
+        break;
+      default:
+        fprintf(stderr, USAGE);
+        return ch == 'h' ? 0 : -1;
+    }
+  }
+
+  if (probes) {
+    bench_probes(num_shards, repeat, policy);
+    return 0;
+  }
+
+  load_workload(workload);
+  memset(block, 0, JBOD_BLOCK_SIZE);
+
+  if (resize) {
+    bench_resize(num_shards, repeat, policy);
+    free(accesses);
+    return 0;
+  }
+
+  if (max_threads > 0) {
+    bench_threads(max_threads, num_shards, repeat, policy);
+    free(accesses);
+    return 0;
+  }
+
+  printf("%8s %12s %10s\n", "entries", "ns/op", "hit rate");
+  for (int size = 2; size <= 4096; size *= 2) {
+    long hits = 0, ops = 0;
+    if (cache_create(size) != 1)
+      errx(1, "Failed to create cache of %d entries.", size);
+
+    double start = now_ns();
+    for (int r = 0; r < repeat; r++) {
+      for (int i = 0; i < num_accesses; i++) {
+        access_t *a = &accesses[i];
+        if (cache_lookup(a->disk_num, a->block_num, block) == 1) {
+          hits++;
+          if (a->is_write)
+            cache_update(a->disk_num, a->block_num, block);
+        } else {
+          cache_insert(a->disk_num, a->block_num, block);
+        }
+        ops++;
+      }
+    }
+    double elapsed = now_ns() - start;
+
+    cache_destroy();
+    printf("%8d %12.1f %9.1f%%\n", size, elapsed / ops, 100.0 * hits / ops);
+  }
+
+  free(accesses);
+  return 0;
+}
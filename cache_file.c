@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache_file.h"
+#include "cache_policy.h"
+
+enum {
+  FILE_ABSENT,
+  FILE_EVICTED,                                           //not in the file, but evicted from memory before
+  FILE_HELD,
+};
+
+struct cache_file {
+  int fd;
+  bool admit_all;
+  uint8_t state[CACHE_NUM_KEYS];                          //a byte each, so blocks of different shards never share one
+};
+
+cache_file_t *cache_file_open(const char *path, const char *admission) {
+  cache_file_t *f;
+
+  if (admission != NULL && strcmp(admission, "all") != 0 && strcmp(admission, "reused") != 0) {
+    return NULL;
+  }
+  f = calloc(1, sizeof(*f));
+  if (f == NULL) {
+    return NULL;
+  }
+  f->admit_all = admission == NULL || strcmp(admission, "all") == 0;
+  f->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (f->fd == -1) {
+    free(f);
+    return NULL;
+  }
+  unlink(path);                                           //its blocks are only good for this cache
+  return f;
+}
+
+void cache_file_close(cache_file_t *f) {
+  if (f != NULL) {
+    close(f->fd);
+    free(f);
+  }
+}
+
+/* Returns 0 on success and -1 on failure. Reads or writes the whole block
+ * of |key|. */
+static int transfer(cache_file_t *f, int key, uint8_t *buf, bool write) {
+  off_t off = (off_t)key * JBOD_BLOCK_SIZE;
+  size_t done = 0;
+
+  while (done < JBOD_BLOCK_SIZE) {
+    ssize_t n = write ? pwrite(f->fd, buf + done, JBOD_BLOCK_SIZE - done, off + done)
+                      : pread(f->fd, buf + done, JBOD_BLOCK_SIZE - done, off + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+bool cache_file_offer(cache_file_t *f, int key, const uint8_t *buf, int num_accesses) {
+  bool admit = f->admit_all || num_accesses > 1 || f->state[key] == FILE_EVICTED;
+
+  if (!admit) {
+    f->state[key] = FILE_EVICTED;                         //taken in if it comes back and goes again
+    return false;
+  }
+  if (transfer(f, key, (uint8_t *)buf, true) == -1) {     //as good as not admitted: the server still has it
+    f->state[key] = FILE_EVICTED;
+    return false;
+  }
+  f->state[key] = FILE_HELD;
+  return true;
+}
+
+bool cache_file_take(cache_file_t *f, int key, uint8_t *buf) {
+  if (f->state[key] != FILE_HELD) {
+    return false;
+  }
+  f->state[key] = FILE_EVICTED;                           //in memory from now on
+  return transfer(f, key, buf, false) == 0;
+}
+
+void cache_file_drop(cache_file_t *f, int key) {
+  if (f->state[key] == FILE_HELD) {
+    f->state[key] = FILE_EVICTED;
+  }
+}
+
+bool cache_file_contains(cache_file_t *f, int key) {
+  return f->state[key] == FILE_HELD;
+}
@@ -0,0 +1,52 @@
+#ifndef CACHE_FILE_H_
+#define CACHE_FILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A second tier for a cache, in a local file: blocks evicted from memory go
+ * there, if its admission policy takes them, and a lookup that misses memory
+ * looks there before the block is fetched from the server. The file has a
+ * place for every block of the array, at CACHE_KEY times the block size, so
+ * the two tiers together always hold the whole array and the file never has
+ * to evict anything. A block is only ever in one tier: it leaves the file
+ * when it goes back to memory, and it is dropped when written, as only clean
+ * blocks are taken in. The file is removed once open, so it goes away with
+ * the cache, also if the process dies.
+ *
+ * Admission policies: "all" (the default) takes every block evicted, which
+ * costs nothing but a local write since the file has room for all of them;
+ * "reused" only takes a block with some sign that it will be wanted again,
+ * either a hit while in memory or an earlier eviction, which saves the writes
+ * of blocks read once, such as those of a scan, where writing the file is
+ * dear.
+ *
+ * Each block has its own state, so calls for different blocks may run at
+ * the same time; calls for the same block must not. */
+typedef struct cache_file cache_file_t;
+
+/* Returns the tier kept in a new file at |path|, replacing any file there,
+ * admitting blocks with the policy called |admission| (NULL for "all"),
+ * or NULL on failure. */
+cache_file_t *cache_file_open(const char *path, const char *admission);
+
+/* Closes |f|, which frees the file. */
+void cache_file_close(cache_file_t *f);
+
+/* Offers |f| the block of CACHE_KEY |key| held in |buf|, just evicted from
+ * memory after |num_accesses| lookups and writes. Returns true if it was
+ * taken in. */
+bool cache_file_offer(cache_file_t *f, int key, const uint8_t *buf, int num_accesses);
+
+/* Returns true if |f| held the block of |key|, which is then read into |buf|
+ * and dropped from |f|. */
+bool cache_file_take(cache_file_t *f, int key, uint8_t *buf);
+
+/* Forgets the block of |key|, whose contents are about to change, if |f|
+ * holds it. */
+void cache_file_drop(cache_file_t *f, int key);
+
+/* Returns true if |f| holds the block of |key|. */
+bool cache_file_contains(cache_file_t *f, int key);
+
+#endif
@@ -0,0 +1,531 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache_policy.h"
+
+/* Doubly linked lists over an index space (cache slots or block keys). The
+ * links live in a separate node array so that the same index can be moved
+ * between several lists of one policy in constant time. */
+
+typedef struct {
+  int prev;
+  int next;
+} dl_node_t;
+
+typedef struct {
+  int head;                                               //most recently inserted index
+  int tail;                                               //least recently inserted index
+  int size;
+} dl_list_t;
+
+static void dl_init(dl_list_t *l) {
+  l->head = -1;
+  l->tail = -1;
+  l->size = 0;
+}
+
+static void dl_push_front(dl_list_t *l, dl_node_t *n, int i) {
+  n[i].prev = -1;
+  n[i].next = l->head;
+  if (l->head != -1) {
+    n[l->head].prev = i;
+  } else {
+    l->tail = i;
+  }
+  l->head = i;
+  l->size++;
+}
+
+static void dl_remove(dl_list_t *l, dl_node_t *n, int i) {
+  if (n[i].prev != -1) {
+    n[n[i].prev].next = n[i].next;
+  } else {
+    l->head = n[i].next;
+  }
+  if (n[i].next != -1) {
+    n[n[i].next].prev = n[i].prev;
+  } else {
+    l->tail = n[i].prev;
+  }
+  l->size--;
+}
+
+static int dl_pop_back(dl_list_t *l, dl_node_t *n) {
+  int i = l->tail;
+  dl_remove(l, n, i);
+  return i;
+}
+
+/* Removes and returns the index closest to the tail of |l| that |evictable|
+ * accepts, or -1 if there is none. */
+static int dl_pop_evictable(dl_list_t *l, dl_node_t *n, cache_evictable_fn_t evictable, void *arg) {
+  int i = l->tail;
+  while (i != -1 && !evictable(arg, i)) {                 //pinned or unsaved blocks stay where they are
+    i = n[i].prev;
+  }
+  if (i != -1) {
+    dl_remove(l, n, i);
+  }
+  return i;
+}
+
+/* Puts the slots of |from| on |to|, each i as |map|[i], in the same order. */
+static void dl_copy_mapped(dl_list_t *to, dl_node_t *to_nodes, const dl_list_t *from, const dl_node_t *from_nodes,
+                           const int *map) {
+  for (int i = from->tail; i != -1; i = from_nodes[i].prev) {  //oldest first, so it ends up at the tail
+    dl_push_front(to, to_nodes, map[i]);
+  }
+}
+
+/* ---- LRU: one recency list over the slots ---- */
+
+typedef struct {
+  dl_list_t list;
+  dl_node_t nodes[];
+} lru_state_t;
+
+static void *lru_create(int num_entries) {
+  lru_state_t *lru = malloc(sizeof(lru_state_t) + num_entries * sizeof(dl_node_t));
+  if (lru == NULL) {
+    return NULL;
+  }
+  dl_init(&lru->list);
+  return lru;
+}
+
+static void lru_destroy(void *state) {
+  free(state);
+}
+
+static void lru_hit(void *state, int slot) {
+  lru_state_t *lru = state;
+  if (lru->list.head != slot) {                           //move to the most recently used end
+    dl_remove(&lru->list, lru->nodes, slot);
+    dl_push_front(&lru->list, lru->nodes, slot);
+  }
+}
+
+static int lru_evict(void *state, cache_evictable_fn_t evictable, void *arg) {
+  lru_state_t *lru = state;
+  return dl_pop_evictable(&lru->list, lru->nodes, evictable, arg);
+}
+
+static void lru_remove(void *state, int slot) {
+  lru_state_t *lru = state;
+  dl_remove(&lru->list, lru->nodes, slot);
+}
+
+static void *lru_resize(void *state, int num_entries, const int *map) {
+  lru_state_t *lru = state, *to = lru_create(num_entries);
+  if (to != NULL) {
+    dl_copy_mapped(&to->list, to->nodes, &lru->list, lru->nodes, map);
+  }
+  return to;
+}
+
+static int lru_insert(void *state, int key, int free_slot, cache_evictable_fn_t evictable, void *arg) {
+  lru_state_t *lru = state;
+  int slot = free_slot != -1 ? free_slot : lru_evict(lru, evictable, arg);
+  if (slot == -1) {
+    return -1;
+  }
+  dl_push_front(&lru->list, lru->nodes, slot);
+  return slot;
+}
+
+const cache_policy_ops_t cache_policy_lru = {
+  "lru", lru_create, lru_destroy, lru_hit, lru_insert, lru_evict, lru_remove, lru_resize,
+};
+
+/* ---- CLOCK: a reference bit per slot and a hand sweeping over them ---- */
+
+typedef struct {
+  int size;
+  int hand;
+  uint8_t ref[];
+} clock_state_t;
+
+static void *clock_create(int num_entries) {
+  clock_state_t *clk = calloc(1, sizeof(clock_state_t) + num_entries * sizeof(uint8_t));
+  if (clk == NULL) {
+    return NULL;
+  }
+  clk->size = num_entries;
+  return clk;
+}
+
+static void clock_destroy(void *state) {
+  free(state);
+}
+
+static void clock_hit(void *state, int slot) {
+  clock_state_t *clk = state;
+  clk->ref[slot] = 1;
+}
+
+static int clock_evict(void *state, cache_evictable_fn_t evictable, void *arg) {
+  clock_state_t *clk = state;
+  for (int turns = 0; turns < 2 * clk->size; turns++) {  //two sweeps clear every bit, so nothing can go after
+    int h = clk->hand;
+    clk->hand = (clk->hand + 1) % clk->size;
+    if (clk->ref[h]) {                                    //give referenced slots a second chance
+      clk->ref[h] = 0;
+    } else if (evictable(arg, h)) {
+      return h;
+    }
+  }
+  return -1;
+}
+
+static void clock_remove(void *state, int slot) {
+  clock_state_t *clk = state;
+  clk->ref[slot] = 0;                                     //the hand passes empty slots by
+}
+
+static void *clock_resize(void *state, int num_entries, const int *map) {
+  clock_state_t *clk = state, *to = clock_create(num_entries);
+  if (to == NULL) {
+    return NULL;
+  }
+  for (int i = 0; i < clk->size; i++) {
+    if (map[i] != -1) {
+      to->ref[map[i]] = clk->ref[i];
+    }
+  }
+  to->hand = map[clk->hand] != -1 ? map[clk->hand] : 0;  //carry on sweeping from the same block if it stays
+  return to;
+}
+
+static int clock_insert(void *state, int key, int free_slot, cache_evictable_fn_t evictable, void *arg) {
+  clock_state_t *clk = state;
+  int slot = free_slot != -1 ? free_slot : clock_evict(clk, evictable, arg);
+  if (slot == -1) {
+    return -1;
+  }
+  clk->ref[slot] = 1;
+  return slot;
+}
+
+static const cache_policy_ops_t cache_policy_clock = {
+  "clock", clock_create, clock_destroy, clock_hit, clock_insert, clock_evict, clock_remove, clock_resize,
+};
+
+/* ---- 2Q (Johnson and Shasha): new blocks enter the A1in FIFO, blocks seen
+ * again after leaving it (remembered by key in the A1out ghost FIFO) go to the
+ * Am LRU list. A one-time sequential scan only ever cycles through A1in. ---- */
+
+enum { TWOQ_A1IN = 1, TWOQ_AM };
+
+typedef struct {
+  dl_node_t *slot_nodes;
+  uint8_t *where;                                         //which resident list a slot is on
+  int *slot_key;
+  dl_node_t key_nodes[CACHE_NUM_KEYS];
+  bool ghost[CACHE_NUM_KEYS];                             //key is on A1out
+  dl_list_t a1in, am, a1out;
+  int kin;                                                //target size of A1in
+  int kout;                                               //maximum size of A1out
+} twoq_state_t;
+
+static void twoq_destroy(void *state) {
+  twoq_state_t *q = state;
+  free(q->slot_nodes);
+  free(q->where);
+  free(q->slot_key);
+  free(q);
+}
+
+static void *twoq_create(int num_entries) {
+  twoq_state_t *q = calloc(1, sizeof(twoq_state_t));
+  if (q == NULL) {
+    return NULL;
+  }
+  q->slot_nodes = malloc(num_entries * sizeof(dl_node_t));
+  q->where = calloc(num_entries, sizeof(uint8_t));
+  q->slot_key = malloc(num_entries * sizeof(int));
+  if (q->slot_nodes == NULL || q->where == NULL || q->slot_key == NULL) {
+    twoq_destroy(q);
+    return NULL;
+  }
+  dl_init(&q->a1in);
+  dl_init(&q->am);
+  dl_init(&q->a1out);
+  q->kin = num_entries / 4 > 0 ? num_entries / 4 : 1;     //tuning suggested by the 2Q paper
+  q->kout = num_entries / 2 > 0 ? num_entries / 2 : 1;
+  return q;
+}
+
+static void twoq_hit(void *state, int slot) {
+  twoq_state_t *q = state;
+  if (q->where[slot] == TWOQ_AM && q->am.head != slot) {  //hits in A1in do not change its order
+    dl_remove(&q->am, q->slot_nodes, slot);
+    dl_push_front(&q->am, q->slot_nodes, slot);
+  }
+}
+
+static int twoq_reclaim(twoq_state_t *q, cache_evictable_fn_t evictable, void *arg) {
+  bool from_a1in = q->a1in.size > q->kin || q->am.size == 0;
+  int slot = dl_pop_evictable(from_a1in ? &q->a1in : &q->am, q->slot_nodes, evictable, arg);
+  if (slot == -1) {                                       //everything there is pinned, try the other list
+    from_a1in = !from_a1in;
+    slot = dl_pop_evictable(from_a1in ? &q->a1in : &q->am, q->slot_nodes, evictable, arg);
+  }
+  if (slot != -1 && from_a1in) {                          //page out of A1in and remember the key
+    int old_key = q->slot_key[slot];
+    dl_push_front(&q->a1out, q->key_nodes, old_key);
+    q->ghost[old_key] = true;
+    if (q->a1out.size > q->kout) {
+      q->ghost[dl_pop_back(&q->a1out, q->key_nodes)] = false;
+    }
+  }
+  return slot;
+}
+
+static int twoq_evict(void *state, cache_evictable_fn_t evictable, void *arg) {
+  return twoq_reclaim(state, evictable, arg);
+}
+
+static void twoq_remove(void *state, int slot) {
+  twoq_state_t *q = state;
+  dl_remove(q->where[slot] == TWOQ_AM ? &q->am : &q->a1in, q->slot_nodes, slot);
+  q->where[slot] = 0;
+}
+
+static void *twoq_resize(void *state, int num_entries, const int *map) {
+  twoq_state_t *q = state, *to = twoq_create(num_entries);
+  if (to == NULL) {
+    return NULL;
+  }
+  memcpy(to->key_nodes, q->key_nodes, sizeof(q->key_nodes));  //the ghosts are kept by key, which stay the same
+  memcpy(to->ghost, q->ghost, sizeof(q->ghost));
+  to->a1out = q->a1out;
+  while (to->a1out.size > to->kout) {                    //a smaller cache remembers fewer
+    to->ghost[dl_pop_back(&to->a1out, to->key_nodes)] = false;
+  }
+  dl_copy_mapped(&to->a1in, to->slot_nodes, &q->a1in, q->slot_nodes, map);
+  dl_copy_mapped(&to->am, to->slot_nodes, &q->am, q->slot_nodes, map);
+  for (int i = q->a1in.head; i != -1; i = q->slot_nodes[i].next) {
+    to->slot_key[map[i]] = q->slot_key[i];
+    to->where[map[i]] = TWOQ_A1IN;
+  }
+  for (int i = q->am.head; i != -1; i = q->slot_nodes[i].next) {
+    to->slot_key[map[i]] = q->slot_key[i];
+    to->where[map[i]] = TWOQ_AM;
+  }
+  return to;
+}
+
+static int twoq_insert(void *state, int key, int free_slot, cache_evictable_fn_t evictable, void *arg) {
+  twoq_state_t *q = state;
+  int slot = free_slot != -1 ? free_slot : twoq_reclaim(q, evictable, arg);
+  if (slot == -1) {
+    return -1;
+  }
+  q->slot_key[slot] = key;
+  if (q->ghost[key]) {                                    //seen recently: it is a hot block
+    dl_remove(&q->a1out, q->key_nodes, key);
+    q->ghost[key] = false;
+    dl_push_front(&q->am, q->slot_nodes, slot);
+    q->where[slot] = TWOQ_AM;
+  } else {
+    dl_push_front(&q->a1in, q->slot_nodes, slot);
+    q->where[slot] = TWOQ_A1IN;
+  }
+  return slot;
+}
+
+static const cache_policy_ops_t cache_policy_2q = {
+  "2q", twoq_create, twoq_destroy, twoq_hit, twoq_insert, twoq_evict, twoq_remove, twoq_resize,
+};
+
+/* ---- ARC (Megiddo and Modha): resident lists T1 (seen once) and T2 (seen
+ * at least twice), ghost lists B1 and B2 remembering keys recently evicted
+ * from each, and a target size p for T1 that ghost hits move up and down. ---- */
+
+enum { ARC_T1 = 1, ARC_T2, ARC_B1, ARC_B2 };
+
+typedef struct {
+  dl_node_t *slot_nodes;
+  uint8_t *where;                                         //which resident list a slot is on
+  int *slot_key;
+  dl_node_t key_nodes[CACHE_NUM_KEYS];
+  uint8_t ghost[CACHE_NUM_KEYS];                          //which ghost list a key is on, 0 if none
+  dl_list_t t1, t2, b1, b2;
+  int c;                                                  //cache size
+  int p;                                                  //target size of T1
+} arc_state_t;
+
+static void arc_destroy(void *state) {
+  arc_state_t *arc = state;
+  free(arc->slot_nodes);
+  free(arc->where);
+  free(arc->slot_key);
+  free(arc);
+}
+
+static void *arc_create(int num_entries) {
+  arc_state_t *arc = calloc(1, sizeof(arc_state_t));
+  if (arc == NULL) {
+    return NULL;
+  }
+  arc->slot_nodes = malloc(num_entries * sizeof(dl_node_t));
+  arc->where = calloc(num_entries, sizeof(uint8_t));
+  arc->slot_key = malloc(num_entries * sizeof(int));
+  if (arc->slot_nodes == NULL || arc->where == NULL || arc->slot_key == NULL) {
+    arc_destroy(arc);
+    return NULL;
+  }
+  dl_init(&arc->t1);
+  dl_init(&arc->t2);
+  dl_init(&arc->b1);
+  dl_init(&arc->b2);
+  arc->c = num_entries;
+  arc->p = 0;
+  return arc;
+}
+
+static void arc_hit(void *state, int slot) {
+  arc_state_t *arc = state;
+  dl_list_t *from = arc->where[slot] == ARC_T1 ? &arc->t1 : &arc->t2;
+  dl_remove(from, arc->slot_nodes, slot);                 //any hit promotes to the MRU end of T2
+  dl_push_front(&arc->t2, arc->slot_nodes, slot);
+  arc->where[slot] = ARC_T2;
+}
+
+static void arc_drop_ghost(arc_state_t *arc, dl_list_t *l) {
+  arc->ghost[dl_pop_back(l, arc->key_nodes)] = 0;
+}
+
+/* Evicts the LRU block of T1 or T2 depending on p and remembers its key on
+ * the matching ghost list. Returns the freed slot, or -1 if none can go. */
+static int arc_replace(arc_state_t *arc, bool in_b2, cache_evictable_fn_t evictable, void *arg) {
+  bool from_t1 = arc->t1.size > 0 && (arc->t1.size > arc->p || (in_b2 && arc->t1.size == arc->p) || arc->t2.size == 0);
+  int slot = dl_pop_evictable(from_t1 ? &arc->t1 : &arc->t2, arc->slot_nodes, evictable, arg);
+  if (slot == -1) {                                       //everything there is pinned, try the other list
+    from_t1 = !from_t1;
+    slot = dl_pop_evictable(from_t1 ? &arc->t1 : &arc->t2, arc->slot_nodes, evictable, arg);
+  }
+  if (slot != -1) {
+    dl_push_front(from_t1 ? &arc->b1 : &arc->b2, arc->key_nodes, arc->slot_key[slot]);
+    arc->ghost[arc->slot_key[slot]] = from_t1 ? ARC_B1 : ARC_B2;
+  }
+  return slot;
+}
+
+static int arc_evict(void *state, cache_evictable_fn_t evictable, void *arg) {
+  return arc_replace(state, false, evictable, arg);      //the ghost takes its place, so the lists keep their sizes
+}
+
+static void arc_remove(void *state, int slot) {
+  arc_state_t *arc = state;
+  dl_remove(arc->where[slot] == ARC_T1 ? &arc->t1 : &arc->t2, arc->slot_nodes, slot);  //p stays: nothing was learnt
+  arc->where[slot] = 0;
+}
+
+static void *arc_resize(void *state, int num_entries, const int *map) {
+  arc_state_t *arc = state, *to = arc_create(num_entries);
+  if (to == NULL) {
+    return NULL;
+  }
+  memcpy(to->key_nodes, arc->key_nodes, sizeof(arc->key_nodes));  //the ghosts are kept by key, which stay the same
+  memcpy(to->ghost, arc->ghost, sizeof(arc->ghost));
+  to->b1 = arc->b1;
+  to->b2 = arc->b2;
+  dl_copy_mapped(&to->t1, to->slot_nodes, &arc->t1, arc->slot_nodes, map);
+  dl_copy_mapped(&to->t2, to->slot_nodes, &arc->t2, arc->slot_nodes, map);
+  for (int i = arc->t1.head; i != -1; i = arc->slot_nodes[i].next) {
+    to->slot_key[map[i]] = arc->slot_key[i];
+    to->where[map[i]] = ARC_T1;
+  }
+  for (int i = arc->t2.head; i != -1; i = arc->slot_nodes[i].next) {
+    to->slot_key[map[i]] = arc->slot_key[i];
+    to->where[map[i]] = ARC_T2;
+  }
+  to->p = arc->p < num_entries ? arc->p : num_entries;
+  while (to->t1.size + to->b1.size > to->c && to->b1.size > 0) {  //restore the bounds of ARC for the new size
+    arc_drop_ghost(to, &to->b1);
+  }
+  while (to->t1.size + to->t2.size + to->b1.size + to->b2.size > 2 * to->c) {
+    arc_drop_ghost(to, to->b2.size > 0 ? &to->b2 : &to->b1);
+  }
+  return to;
+}
+
+static int arc_insert(void *state, int key, int free_slot, cache_evictable_fn_t evictable, void *arg) {
+  arc_state_t *arc = state;
+  int slot = free_slot;
+  int old_p = arc->p;
+  int delta;
+
+  if (arc->ghost[key] == ARC_B1) {                        //recency list was too short: grow T1
+    delta = arc->b2.size > arc->b1.size ? arc->b2.size / arc->b1.size : 1;
+    arc->p = arc->p + delta < arc->c ? arc->p + delta : arc->c;
+    if (slot == -1 && (slot = arc_replace(arc, false, evictable, arg)) == -1) {
+      arc->p = old_p;
+      return -1;
+    }
+    dl_remove(&arc->b1, arc->key_nodes, key);
+  } else if (arc->ghost[key] == ARC_B2) {                 //frequency list was too short: shrink T1
+    delta = arc->b1.size > arc->b2.size ? arc->b1.size / arc->b2.size : 1;
+    arc->p = arc->p - delta > 0 ? arc->p - delta : 0;
+    if (slot == -1 && (slot = arc_replace(arc, true, evictable, arg)) == -1) {
+      arc->p = old_p;
+      return -1;
+    }
+    dl_remove(&arc->b2, arc->key_nodes, key);
+  } else {                                                //a block not seen recently at all
+    if (slot == -1) {
+      if (arc->t1.size + arc->b1.size == arc->c) {
+        if (arc->t1.size < arc->c) {
+          slot = arc_replace(arc, false, evictable, arg);
+          if (slot != -1) {                               //the new ghost goes in front, so the oldest one is the same
+            arc_drop_ghost(arc, &arc->b1);
+          }
+        } else {
+          slot = dl_pop_evictable(&arc->t1, arc->slot_nodes, evictable, arg);  //T1 fills the cache: evict without a ghost
+        }
+      } else {
+        bool full = arc->t1.size + arc->t2.size + arc->b1.size + arc->b2.size == 2 * arc->c;
+        slot = arc_replace(arc, false, evictable, arg);
+        if (slot != -1 && full) {
+          arc_drop_ghost(arc, &arc->b2);
+        }
+      }
+      if (slot == -1) {
+        return -1;
+      }
+    } else if (arc->t1.size + arc->b1.size == arc->c) {   //a slot arc_evict freed: its ghost still counts
+      arc_drop_ghost(arc, &arc->b1);
+    } else if (arc->t1.size + arc->t2.size + arc->b1.size + arc->b2.size == 2 * arc->c) {
+      arc_drop_ghost(arc, &arc->b2);
+    }
+    arc->slot_key[slot] = key;
+    dl_push_front(&arc->t1, arc->slot_nodes, slot);
+    arc->where[slot] = ARC_T1;
+    return slot;
+  }
+
+  arc->ghost[key] = 0;                                    //ghost hit: the block goes straight to T2
+  arc->slot_key[slot] = key;
+  dl_push_front(&arc->t2, arc->slot_nodes, slot);
+  arc->where[slot] = ARC_T2;
+  return slot;
+}
+
+static const cache_policy_ops_t cache_policy_arc = {
+  "arc", arc_create, arc_destroy, arc_hit, arc_insert, arc_evict, arc_remove, arc_resize,
+};
+
+static const cache_policy_ops_t *policies[] = {
+  &cache_policy_lru, &cache_policy_clock, &cache_policy_2q, &cache_policy_arc,
+};
+
+const cache_policy_ops_t *cache_policy_lookup(const char *name) {
+  for (int i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    if (strcmp(policies[i]->name, name) == 0) {
+      return policies[i];
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,68 @@
+#ifndef CACHE_POLICY_H_
+#define CACHE_POLICY_H_
+
+#include <stdbool.h>
+
+#include "jbod.h"
+
+/* Every block of the array has a small integer key, which the policies use to
+ * remember blocks that are no longer resident (ghost entries). */
+#define CACHE_NUM_KEYS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+#define CACHE_KEY(disk_num, block_num) ((disk_num) * JBOD_NUM_BLOCKS_PER_DISK + (block_num))
+
+/* A replacement policy decides which cache slot to reuse when the cache is
+ * full. cache.c owns the slots and the lookup index; the policy only sees slot
+ * numbers in [0, num_entries) and block keys in [0, CACHE_NUM_KEYS). All the
+ * policy's bookkeeping lives in the state returned by create, so every cache
+ * (or cache shard) has its own and callers serialize access to it. */
+/* Tells whether the block in |slot| may be evicted now; |arg| is the one
+ * given to insert. May write the block back first, so it is only asked about
+ * a slot the policy will evict if the answer is true. */
+typedef bool (*cache_evictable_fn_t)(void *arg, int slot);
+
+typedef struct {
+  const char *name;
+
+  /* Allocates the policy state for a cache of |num_entries| slots, all of
+   * them initially empty. Returns NULL on failure. */
+  void *(*create)(int num_entries);
+
+  /* Frees the state allocated by create. */
+  void (*destroy)(void *state);
+
+  /* Called on a cache hit on |slot|. */
+  void (*hit)(void *state, int slot);
+
+  /* Called on a miss that is being inserted. |free_slot| is an empty slot, or
+   * -1 if the cache is full, in which case the policy must pick a victim and
+   * forget it: the first slot |evictable| accepts, asked in the order the
+   * policy prefers its victims. Returns the slot that now holds |key|, or -1,
+   * leaving the state unchanged, if no slot can be evicted. */
+  int (*insert)(void *state, int key, int free_slot, cache_evictable_fn_t evictable, void *arg);
+
+  /* Picks a victim the way insert does when the cache is full, asking
+   * |evictable| the same way, and forgets it, leaving its slot empty.
+   * Returns the slot, or -1 if no slot can be evicted. */
+  int (*evict)(void *state, cache_evictable_fn_t evictable, void *arg);
+
+  /* Forgets the block in |slot|, leaving the slot empty, as if it had never
+   * been inserted: unlike evict, it leaves no ghost and moves no other slot
+   * on, as the block is not leaving for lack of room. */
+  void (*remove)(void *state, int slot);
+
+  /* Returns a new state for a cache of |num_entries| slots, holding the
+   * blocks resident in |state| in the same order and with the same history,
+   * each moved from slot i to slot |map|[i]: -1 for the empty slots, and a
+   * distinct slot below |num_entries| for the others. Returns NULL on
+   * failure. |state| is left as it was, for the caller to destroy. */
+  void *(*resize)(void *state, int num_entries, const int *map);
+} cache_policy_ops_t;
+
+/* Returns the policy called |name| ("lru", "clock", "2q" or "arc"), or NULL
+ * if there is no such policy. */
+const cache_policy_ops_t *cache_policy_lookup(const char *name);
+
+/* The policy used when none is selected. */
+extern const cache_policy_ops_t cache_policy_lru;
+
+#endif
@@ -0,0 +1,382 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "cache_policy.h"
+#include "cache_shm.h"
+#include "stats.h"
+
+#define CACHE_SHM_MAGIC "JBODSHM1"
+#define CACHE_SHM_NAME_MAX 255
+
+/* Start of the segment. After it come the shards, the index, the entries
+ * and, from a page on, the blocks, entry i holding block i. */
+typedef struct {
+  char magic[8];        /* CACHE_SHM_MAGIC, without its terminating NUL */
+  uint32_t num_entries;
+  uint32_t num_shards;
+  uint64_t size;        /* bytes of the segment */
+} shm_header_t;
+
+typedef struct {
+  pthread_mutex_t lock;                                   //robust and process-shared
+  int first;                                              //its entries are [first, first + size)
+  int size;
+  int amount;                                             //entries in use, always the first ones
+  int hand;                                               //next entry the clock looks at, from first
+} __attribute__((aligned(64))) shm_shard_t;
+
+typedef struct {
+  int16_t key;                                            //CACHE_KEY of the block, -1 if unused
+  uint8_t referenced;                                     //hit since the clock hand last passed
+  uint8_t prefetched;                                     //read ahead of demand and not read or written since
+  int32_t pins;                                           //of all processes
+} shm_entry_t;
+
+/* Where everything is in a segment for some number of entries and shards. */
+typedef struct {
+  size_t shards;
+  size_t index;                                           //entry holding each key, -1 if none
+  size_t entries;
+  size_t blocks;
+  size_t size;
+} shm_layout_t;
+
+struct cache_shm {
+  int fd;                                                 //holds the flock telling the segment is in use
+  char name[CACHE_SHM_NAME_MAX + 1];
+  uint8_t *base;
+  size_t size;
+  int num_entries;
+  int num_shards;
+  shm_header_t *header;
+  shm_shard_t *shards;
+  int16_t *index;
+  shm_entry_t *entries;
+  uint8_t (*blocks)[JBOD_BLOCK_SIZE];
+  cache_stats_t stats[CACHE_MAX_SHARDS];                  //of this process, each under the lock of its shard
+};
+
+static size_t round_up(size_t n, size_t to) {
+  return (n + to - 1) / to * to;
+}
+
+static void layout(shm_layout_t *l, int num_entries, int num_shards) {
+  l->shards = round_up(sizeof(shm_header_t), 64);
+  l->index = l->shards + num_shards * sizeof(shm_shard_t);
+  l->entries = round_up(l->index + CACHE_NUM_KEYS * sizeof(int16_t), 64);
+  l->blocks = round_up(l->entries + num_entries * sizeof(shm_entry_t), sysconf(_SC_PAGESIZE));
+  l->size = l->blocks + (size_t)num_entries * JBOD_BLOCK_SIZE;
+}
+
+/* Empties shard |s|, locked. */
+static void shard_reset(cache_shm_t *m, shm_shard_t *s) {
+  for (int i = s->first; i < s->first + s->size; i++) {
+    if (m->entries[i].key != -1) {
+      m->index[m->entries[i].key] = -1;
+    }
+    memset(&m->entries[i], 0, sizeof(m->entries[i]));
+    m->entries[i].key = -1;
+  }
+  s->amount = 0;
+  s->hand = 0;
+}
+
+/* Builds the empty cache in the segment of |m|, which no other process has
+ * open. Returns 0 on success and -1 on failure. */
+static int segment_init(cache_shm_t *m) {
+  pthread_mutexattr_t attr;
+  int first = 0;
+
+  memcpy(m->header->magic, CACHE_SHM_MAGIC, sizeof(m->header->magic));
+  m->header->num_entries = m->num_entries;
+  m->header->num_shards = m->num_shards;
+  m->header->size = m->size;
+  for (int key = 0; key < CACHE_NUM_KEYS; key++) {
+    m->index[key] = -1;
+  }
+  if (pthread_mutexattr_init(&attr) != 0) {
+    return -1;
+  }
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  for (int i = 0; i < m->num_shards; i++) {               //spread the entries the way cache_create_r does
+    shm_shard_t *s = &m->shards[i];
+    if (pthread_mutex_init(&s->lock, &attr) != 0) {
+      pthread_mutexattr_destroy(&attr);
+      return -1;
+    }
+    s->first = first;
+    s->size = m->num_entries / m->num_shards + (i < m->num_entries % m->num_shards);
+    first += s->size;
+    for (int j = s->first; j < s->first + s->size; j++) {
+      m->entries[j].key = -1;
+    }
+  }
+  pthread_mutexattr_destroy(&attr);
+  return 0;
+}
+
+/* Checks that the segment of |m|, made by another process, is whole and
+ * split the way |m| expects. */
+static bool segment_valid(cache_shm_t *m) {
+  return memcmp(m->header->magic, CACHE_SHM_MAGIC, sizeof(m->header->magic)) == 0
+    && m->header->num_entries == (uint32_t)m->num_entries && m->header->num_shards == (uint32_t)m->num_shards
+    && m->header->size == m->size;
+}
+
+/* Opens the segment of |m|, holding a flock on it: an exclusive one if no
+ * other process has it open, a shared one otherwise. Returns 1 if exclusive,
+ * 0 if shared and -1 on failure. */
+static int segment_open(cache_shm_t *m) {
+  struct stat st;
+
+  for (;;) {
+    bool alone = false;
+    m->fd = shm_open(m->name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (m->fd == -1) {
+      return -1;
+    }
+    if (flock(m->fd, LOCK_EX | LOCK_NB) == 0) {           //nobody else in it, maybe left over from a crash
+      alone = true;
+    } else if (errno != EWOULDBLOCK || flock(m->fd, LOCK_SH) == -1) {  //waits for one being built or removed
+      close(m->fd);
+      return -1;
+    }
+    if (fstat(m->fd, &st) == 0 && st.st_nlink > 0) {
+      return alone;
+    }
+    close(m->fd);                                         //removed by the last one out while we waited: start anew
+  }
+}
+
+bool cache_shm_valid_name(const char *name) {
+  size_t len = name == NULL ? 0 : strlen(name);
+
+  return len > 1 && len <= CACHE_SHM_NAME_MAX && name[0] == '/' && strchr(name + 1, '/') == NULL;
+}
+
+cache_shm_t *cache_shm_open(const char *name, int num_entries, int num_shards) {
+  shm_layout_t l;
+  cache_shm_t *m;
+  int alone;
+
+  if (!cache_shm_valid_name(name) || num_shards < 1 || num_shards > CACHE_MAX_SHARDS
+      || num_entries < 2 * num_shards || num_entries > CACHE_NUM_KEYS) {
+    return NULL;
+  }
+  m = calloc(1, sizeof(*m));
+  if (m == NULL) {
+    return NULL;
+  }
+  strcpy(m->name, name);
+  m->num_entries = num_entries;
+  m->num_shards = num_shards;
+  layout(&l, num_entries, num_shards);
+  m->size = l.size;
+  if ((alone = segment_open(m)) == -1) {
+    free(m);
+    return NULL;
+  }
+  if (alone && (ftruncate(m->fd, 0) == -1 || ftruncate(m->fd, m->size) == -1)) {  //drops whatever was in it
+    alone = -1;
+  }
+  m->base = alone == -1 ? MAP_FAILED : mmap(NULL, m->size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+  if (m->base == MAP_FAILED) {
+    close(m->fd);
+    free(m);
+    return NULL;
+  }
+  m->header = (shm_header_t *)m->base;
+  m->shards = (shm_shard_t *)(m->base + l.shards);
+  m->index = (int16_t *)(m->base + l.index);
+  m->entries = (shm_entry_t *)(m->base + l.entries);
+  m->blocks = (uint8_t (*)[JBOD_BLOCK_SIZE])(m->base + l.blocks);
+
+  struct stat st;
+  if (alone ? segment_init(m) == -1 || flock(m->fd, LOCK_SH) == -1  //let the others in, now it is whole
+            : fstat(m->fd, &st) == -1 || (size_t)st.st_size < m->size || !segment_valid(m)) {
+    munmap(m->base, m->size);
+    close(m->fd);
+    free(m);
+    return NULL;
+  }
+  return m;
+}
+
+void cache_shm_close(cache_shm_t *m) {
+  if (m == NULL) {
+    return;
+  }
+  munmap(m->base, m->size);
+  if (flock(m->fd, LOCK_EX | LOCK_NB) == 0) {             //the last one out: nobody else can vouch for the blocks
+    shm_unlink(m->name);
+  }
+  close(m->fd);
+  free(m);
+}
+
+/* Locks and returns the shard of |key|, emptying it if its last owner died
+ * holding the lock, possibly halfway through changing it. */
+static shm_shard_t *lock_shard(cache_shm_t *m, int key) {
+  shm_shard_t *s = &m->shards[key % m->num_shards];
+
+  if (pthread_mutex_lock(&s->lock) == EOWNERDEAD) {
+    shard_reset(m, s);
+    pthread_mutex_consistent(&s->lock);
+  }
+  return s;
+}
+
+static cache_stats_t *stats_of(cache_shm_t *m, int key) {
+  return &m->stats[key % m->num_shards];
+}
+
+/* Returns the entry holding |key| in |s|, locked, or -1, counting a query
+ * and a hit the way cache_lookup_r does. */
+static int hit(cache_shm_t *m, shm_shard_t *s, int key) {
+  cache_stats_t *stats = stats_of(m, key);
+  int i = m->index[key];
+
+  if (s->amount > 0) {
+    stats->queries++;
+  }
+  if (i != -1) {
+    stats->hits++;
+    if (m->entries[i].prefetched) {
+      m->entries[i].prefetched = 0;
+      stats->prefetch_hits++;
+    }
+    m->entries[i].referenced = 1;
+  }
+  stats_add(i != -1 ? STATS_CACHE_HITS : STATS_CACHE_MISSES, 1);
+  return i;
+}
+
+/* Returns an entry of |s|, locked, for a new block: an unused one, or else
+ * the one the clock evicts, or -1 if all of them are pinned. */
+static int victim(cache_shm_t *m, shm_shard_t *s) {
+  if (s->amount < s->size) {                              //entries are only ever freed all at once
+    return s->first + s->amount++;
+  }
+  for (int turns = 0; turns < 2 * s->size; turns++) {     //two sweeps clear every bit, so nothing can go after
+    shm_entry_t *e = &m->entries[s->first + s->hand];
+    int i = s->first + s->hand;
+    s->hand = (s->hand + 1) % s->size;
+    if (e->referenced) {                                  //give referenced entries a second chance
+      e->referenced = 0;
+    } else if (e->pins == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int cache_shm_lookup(cache_shm_t *m, int key, uint8_t *buf) {
+  shm_shard_t *s = lock_shard(m, key);
+  int i = hit(m, s, key);
+
+  if (i != -1) {
+    memcpy(buf, m->blocks[i], JBOD_BLOCK_SIZE);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return i == -1 ? -1 : 1;
+}
+
+int cache_shm_insert(cache_shm_t *m, int key, const uint8_t *buf, bool prefetch) {
+  shm_shard_t *s = lock_shard(m, key);
+  cache_stats_t *stats = stats_of(m, key);
+  int i = m->index[key] == -1 ? victim(m, s) : -1;        //fail if it exists, maybe read by another process
+
+  if (i != -1) {
+    shm_entry_t *e = &m->entries[i];
+    if (e->key != -1) {
+      m->index[e->key] = -1;
+      stats->evictions++;                                 //counted against whoever made room
+      stats->prefetch_unused += e->prefetched;
+      stats_add(STATS_CACHE_EVICTIONS, 1);
+    }
+    e->key = key;
+    e->referenced = 1;
+    e->prefetched = prefetch;
+    e->pins = 0;
+    stats->prefetched += prefetch;
+    memcpy(m->blocks[i], buf, JBOD_BLOCK_SIZE);
+    m->index[key] = i;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return i == -1 ? -1 : 1;
+}
+
+bool cache_shm_update(cache_shm_t *m, int key, const uint8_t *buf) {
+  shm_shard_t *s = lock_shard(m, key);
+  int i = m->index[key];
+
+  if (i != -1) {                                          //the one copy, so every process sees the write
+    stats_of(m, key)->prefetch_unused += m->entries[i].prefetched;
+    m->entries[i].prefetched = 0;
+    m->entries[i].referenced = 1;
+    memcpy(m->blocks[i], buf, JBOD_BLOCK_SIZE);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return i != -1;
+}
+
+const uint8_t *cache_shm_pin(cache_shm_t *m, int key) {
+  shm_shard_t *s = lock_shard(m, key);
+  int i = hit(m, s, key);
+
+  if (i != -1) {
+    m->entries[i].pins++;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return i == -1 ? NULL : m->blocks[i];
+}
+
+void cache_shm_unpin(cache_shm_t *m, int key) {
+  shm_shard_t *s = lock_shard(m, key);
+  int i = m->index[key];                                  //a pinned entry cannot have been evicted
+
+  if (i != -1 && m->entries[i].pins > 0) {
+    m->entries[i].pins--;
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+bool cache_shm_contains(cache_shm_t *m, int key) {
+  shm_shard_t *s = lock_shard(m, key);
+  bool found = m->index[key] != -1;
+
+  pthread_mutex_unlock(&s->lock);
+  return found;
+}
+
+int cache_shm_num_entries(cache_shm_t *m) {
+  return m->num_entries;
+}
+
+void cache_shm_get_stats(cache_shm_t *m, cache_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  for (int i = 0; i < m->num_shards; i++) {
+    pthread_mutex_t *lock = &lock_shard(m, i)->lock;      //shard i holds key i
+    stats->queries += m->stats[i].queries;
+    stats->hits += m->stats[i].hits;
+    stats->evictions += m->stats[i].evictions;
+    stats->prefetched += m->stats[i].prefetched;
+    stats->prefetch_hits += m->stats[i].prefetch_hits;
+    stats->prefetch_unused += m->stats[i].prefetch_unused;
+    pthread_mutex_unlock(lock);
+  }
+}
+
+size_t cache_shm_resident_bytes(cache_shm_t *m) {
+  return arena_resident_range(m->base, m->size);
+}
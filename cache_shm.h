@@ -0,0 +1,58 @@
+#ifndef CACHE_SHM_H_
+#define CACHE_SHM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+
+/* A block cache in a POSIX shared memory segment, so that processes on one
+ * host holding the same segment cache every block once between them: a block
+ * one of them reads is a hit for all the others, and a write updates the one
+ * copy all of them see. Everything in the segment is addressed by offsets, as
+ * every process maps it elsewhere, and each shard is guarded by a robust
+ * process-shared mutex; the shard of a process that dies holding it is
+ * emptied by the next to lock it, as its state cannot be trusted any more.
+ * Replacement is CLOCK, whose hits only set a bit. Pins a process dies
+ * holding are only dropped along with the segment.
+ *
+ * The blocks are only good while the device stays mounted, which no process
+ * can tell about the others, so the segment lives exactly as long as some
+ * process has it open: every one holds a shared flock on it, the first to
+ * open it (re)builds it empty and the last to close it removes it. Only
+ * write-through caching is supported, as a dirty block could only be written
+ * back by the process that wrote it. */
+typedef struct cache_shm cache_shm_t;
+
+/* Returns the shared cache called |name| (a shm_open name, "/" and up to 254
+ * more characters), creating it with |num_entries| entries split into
+ * |num_shards| shards if no process has it open, or NULL on failure, also if
+ * it is open elsewhere with another number of entries or shards. */
+cache_shm_t *cache_shm_open(const char *name, int num_entries, int num_shards);
+
+/* Returns true if |name| is one cache_shm_open takes. */
+bool cache_shm_valid_name(const char *name);
+
+/* Lets go of |m|, removing the segment if no other process has it open. */
+void cache_shm_close(cache_shm_t *m);
+
+/* These work like cache_lookup_r, cache_insert_r and so on, on the block of
+ * CACHE_KEY |key|, which must be valid. cache_shm_insert marks the block as
+ * read ahead of demand if |prefetch|; cache_shm_update returns whether the
+ * block was there to update. The counters of cache_shm_get_stats are those of
+ * this process alone. */
+int cache_shm_lookup(cache_shm_t *m, int key, uint8_t *buf);
+int cache_shm_insert(cache_shm_t *m, int key, const uint8_t *buf, bool prefetch);
+bool cache_shm_update(cache_shm_t *m, int key, const uint8_t *buf);
+const uint8_t *cache_shm_pin(cache_shm_t *m, int key);
+void cache_shm_unpin(cache_shm_t *m, int key);
+bool cache_shm_contains(cache_shm_t *m, int key);
+int cache_shm_num_entries(cache_shm_t *m);
+void cache_shm_get_stats(cache_shm_t *m, cache_stats_t *stats);
+
+/* Returns the bytes of the segment resident in memory, which every process
+ * holding it shares. */
+size_t cache_shm_resident_bytes(cache_shm_t *m);
+
+#endif
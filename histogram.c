@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "histogram.h"
+
+#define SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+
+/* Returns the bucket of |value|: the power of two it falls in picks a group
+ * of SUB_BUCKETS buckets, the HISTOGRAM_SUB_BITS bits below its top bit the
+ * bucket in the group. Values below SUB_BUCKETS are their own bucket. */
+static int bucket_of(uint64_t value) {
+  if (value < SUB_BUCKETS) {
+    return value;
+  }
+  int top = 63 - __builtin_clzll(value);                  //position of the highest bit set
+  int shift = top - HISTOGRAM_SUB_BITS;
+  return ((shift + 1) << HISTOGRAM_SUB_BITS) + (int)(value >> shift) - SUB_BUCKETS;
+}
+
+uint64_t histogram_bucket_low(int i) {
+  if (i < SUB_BUCKETS) {
+    return i;
+  }
+  int shift = (i >> HISTOGRAM_SUB_BITS) - 1;
+  return (uint64_t)(i % SUB_BUCKETS + SUB_BUCKETS) << shift;
+}
+
+uint64_t histogram_bucket_high(int i) {
+  if (i < SUB_BUCKETS) {
+    return i;
+  }
+  int shift = (i >> HISTOGRAM_SUB_BITS) - 1;
+  return histogram_bucket_low(i) + ((uint64_t)1 << shift) - 1;
+}
+
+void histogram_init(histogram_t *h) {
+  memset(h, 0, sizeof(*h));
+}
+
+void histogram_record(histogram_t *h, uint64_t value) {
+  if (h->count == 0 || value < h->min) {
+    h->min = value;
+  }
+  if (value > h->max) {
+    h->max = value;
+  }
+  h->count++;
+  h->sum += value;
+  h->buckets[bucket_of(value)]++;
+}
+
+void histogram_merge(histogram_t *h, const histogram_t *from) {
+  if (from->count == 0) {
+    return;
+  }
+  if (h->count == 0 || from->min < h->min) {
+    h->min = from->min;
+  }
+  if (from->max > h->max) {
+    h->max = from->max;
+  }
+  h->count += from->count;
+  h->sum += from->sum;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    h->buckets[i] += from->buckets[i];
+  }
+}
+
+uint64_t histogram_percentile(const histogram_t *h, double p) {
+  double exact = p / 100 * h->count;
+  uint64_t rank = (uint64_t)exact;                        //how many values must be at most the answer
+  uint64_t seen = 0;
+
+  if (h->count == 0) {
+    return 0;
+  }
+  if (rank < exact || rank < 1) {
+    rank++;
+  }
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      uint64_t high = histogram_bucket_high(i);
+      return high < h->max ? high : h->max;
+    }
+  }
+  return h->max;
+}
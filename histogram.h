@@ -0,0 +1,40 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <stdint.h>
+
+/* A histogram of non-negative values such as latencies in nanoseconds, in
+ * the style of HdrHistogram: values below 2^HISTOGRAM_SUB_BITS have a bucket
+ * each, and every power of two above is split into 2^HISTOGRAM_SUB_BITS
+ * buckets of equal width, so a value is known to within about 3% whatever
+ * its size, in a fixed amount of memory. */
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+typedef struct {
+  uint64_t count;
+  uint64_t min;
+  uint64_t max;
+  uint64_t sum;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+/* Empties |h|. */
+void histogram_init(histogram_t *h);
+
+/* Counts |value| in |h|. */
+void histogram_record(histogram_t *h, uint64_t value);
+
+/* Adds the values counted in |from| to |h|. */
+void histogram_merge(histogram_t *h, const histogram_t *from);
+
+/* Returns the value that |p| percent (0 to 100) of the values counted in |h|
+ * are at most, rounded up to the end of its bucket but no more than the
+ * largest value counted, or 0 if |h| is empty. */
+uint64_t histogram_percentile(const histogram_t *h, double p);
+
+/* Returns the smallest and the largest value counted in bucket |i|. */
+uint64_t histogram_bucket_low(int i);
+uint64_t histogram_bucket_high(int i);
+
+#endif
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/uio.h>
+
+#include "cache.h"
+#include "mdadm.h"
+#include "net.h"
+
+/* Benchmark for transfers larger than a block. For each transfer size, moves
+ * the same bytes through mdadm_readv/mdadm_writev in one call and through
+ * mdadm_read/mdadm_write in calls of at most 2048 bytes, and reports the time
+ * per byte, the round trips and the JBOD cost per transfer of both, plus the
+ * resident set size after each size so growth of the heap shows up. Reads
+ * also report how many times mdadm copied each byte on its way to the caller:
+ * at most once, less when whole blocks come from the device straight into the
+ * caller's buffer. With -u and -c, the same numbers come for a striped layout
+ * and requests spread over several connections. Needs a jbod_server, one
+ * taking several clients for -c. */
+
+#define IO_BENCH_ARGUMENTS "hs:b:u:c:"
+#define USAGE                                                           \
+  "USAGE: io_bench [-h] [-s cache_size] [-b bytes_per_size] [-u stripe_unit] [-c connections]\n" \
+  "\n"                                                                  \
+  "where:\n"                                                            \
+  "    -h - help mode (display this message)\n"                         \
+  "    -s - cache size (default 0, no cache)\n"                         \
+  "    -b - bytes moved per transfer size and direction (default 4 MiB)\n" \
+  "    -u - stripe the disks in units of this many bytes (default linear)\n" \
+  "    -c - spread requests over this many connections (default 1)\n"  \
+  "\n"
+
+#define IO_BENCH_LEGACY_MAX 2048                        //largest mdadm_read/mdadm_write call
+#define IO_BENCH_IOVCNT 4                               //pieces each vectored transfer is split into
+
+static const uint32_t sizes[] = { 256, 1024, 2048, 8192, 65536, 262144, 1048576 };
+
+static uint8_t buf[JBOD_NUM_DISKS * JBOD_DISK_SIZE];
+static jbod_conn_t lanes[MDADM_MAX_LANES];              //connections besides the default one
+static int num_conns = 1;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long resident_kib(void) {
+  long pages = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f) {
+    if (fscanf(f, "%*d %ld", &pages) != 1)
+      pages = 0;
+    fclose(f);
+  }
+  return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static uint64_t round_trips(void) {
+  uint64_t n = jbod_client_round_trips();
+  for (int i = 1; i < num_conns; i++)
+    n += lanes[i].round_trips;
+  return n;
+}
+
+static uint64_t cost(void) {
+  uint64_t n = jbod_client_cost();
+  for (int i = 1; i < num_conns; i++)
+    n += lanes[i].cost;
+  return n;
+}
+
+/* Moves |len| bytes at |addr| in one vectored call. */
+static int transfer_vectored(int is_write, uint32_t addr, uint32_t len) {
+  struct iovec iov[IO_BENCH_IOVCNT];
+  uint32_t piece = len / IO_BENCH_IOVCNT;
+
+  for (int i = 0; i < IO_BENCH_IOVCNT; i++) {
+    iov[i].iov_base = buf + i * piece;
+    iov[i].iov_len = i == IO_BENCH_IOVCNT - 1 ? len - i * piece : piece;
+  }
+  if (is_write)
+    return mdadm_writev(addr, iov, IO_BENCH_IOVCNT);
+  return mdadm_readv(addr, iov, IO_BENCH_IOVCNT);
+}
+
+/* Moves |len| bytes at |addr| in calls the size of the old limit. */
+static int transfer_legacy(int is_write, uint32_t addr, uint32_t len) {
+  for (uint32_t done = 0; done < len; done += IO_BENCH_LEGACY_MAX) {
+    uint32_t n = len - done < IO_BENCH_LEGACY_MAX ? len - done : IO_BENCH_LEGACY_MAX;
+    int rc = is_write ? mdadm_write(addr + done, n, buf + done) : mdadm_read(addr + done, n, buf + done);
+    if (rc != (int)n)
+      return -1;
+  }
+  return len;
+}
+
+/* Runs transfers of |len| bytes over the array until |total| bytes moved and
+ * prints the cost of one way of doing them. */
+static void run(const char *name, int (*transfer)(int, uint32_t, uint32_t), int is_write,
+                uint32_t len, uint64_t total) {
+  uint32_t array_size = JBOD_NUM_DISKS * JBOD_DISK_SIZE;
+  uint64_t count = (total + len - 1) / len;
+  uint64_t trips = round_trips(), jbod_cost = cost();
+  mdadm_ctx_t *ctx = mdadm_default_ctx();
+  unsigned long read_bytes = ctx->read_bytes, copied_bytes = ctx->read_copied_bytes;
+  uint32_t addr = 0;
+
+  uint64_t start = now_ns();
+  for (uint64_t i = 0; i < count; i++) {
+    if (transfer(is_write, addr, len) != (int)len)
+      errx(1, "%s %s of %u bytes at %u failed", name, is_write ? "write" : "read", len, addr);
+    addr = addr + 2 * len <= array_size ? addr + len : 0;
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  printf("  %-8s %-5s %8.2f ns/byte %8.1f round trips %10.0f JBOD cost/transfer", name, is_write ? "write" : "read",
+         (double)elapsed / (count * len), (double)(round_trips() - trips) / count, (double)(cost() - jbod_cost) / count);
+  if (!is_write)
+    printf(" %6.2f copies/byte", (double)(ctx->read_copied_bytes - copied_bytes) / (ctx->read_bytes - read_bytes));
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  int ch, cache_size = 0;
+  uint64_t total = 4 << 20;
+
+  while ((ch = getopt(argc, argv, IO_BENCH_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 's':
+        cache_size = atoi(optarg);
+        break;
+      case 'b':
+        total = strtoull(optarg, NULL, 0);
+        break;
+      case 'u':
+        if (mdadm_set_stripe_unit(atoi(optarg)) != 1)
+          errx(1, "bad stripe unit %s", optarg);
+        break;
+      case 'c':
+        num_conns = atoi(optarg);
+        if (num_conns < 1 || num_conns > MDADM_MAX_LANES)
+          errx(1, "connections must be 1 to %d", MDADM_MAX_LANES);
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+
+  if (!jbod_connect(JBOD_SERVER, JBOD_PORT))
+    errx(1, "connect failed");
+  for (int i = 1; i < num_conns; i++) {
+    if (!jbod_connect_r(&lanes[i], JBOD_SERVER, JBOD_PORT) || mdadm_add_lane(&lanes[i]) != 1)
+      errx(1, "cannot open connection %d", i + 1);
+  }
+  if (cache_size && cache_create(cache_size) != 1)
+    errx(1, "cannot create a cache of %d entries", cache_size);
+  if (mdadm_mount() != 1 || mdadm_write_permission() == -1)
+    errx(1, "cannot mount the array");
+  for (uint32_t i = 0; i < sizeof(buf); i++)
+    buf[i] = i * 31;
+
+  printf("cache size: %d, %llu bytes per size, stripe unit: %u, connections: %d\n", cache_size,
+         (unsigned long long)total, mdadm_default_ctx()->stripe_unit, num_conns);
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    printf("%u bytes:\n", sizes[i]);
+    for (int is_write = 1; is_write >= 0; is_write--) {
+      run("vectored", transfer_vectored, is_write, sizes[i], total);
+      run("legacy", transfer_legacy, is_write, sizes[i], total);
+    }
+    printf("  resident: %ld KiB\n", resident_kib());
+  }
+
+  mdadm_unmount();
+  if (cache_size)
+    cache_destroy();
+  for (int i = 1; i < num_conns; i++)
+    jbod_disconnect_r(&lanes[i]);
+  jbod_disconnect();
+  return 0;
+}
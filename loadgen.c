@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "cache.h"
+#include "mdadm.h"
+#include "net.h"
+#include "tester.h"
+#include "trace.h"
+
+#define LOADGEN_ARGUMENTS "hw:n:s:m:"
+#define USAGE                                                           \
+  "USAGE: loadgen [-h] [-w workload-file] [-n clients] [-s cache_size] [-m shared-cache]\n" \
+  "\n"                                                                  \
+  "where:\n"                                                            \
+  "    -h - help mode (display this message)\n"                         \
+  "    -w - workload to replay, a text or binary trace (default\n"      \
+  "         traces/random-input)\n"                                    \
+  "    -n - number of concurrent clients (default 4)\n"                 \
+  "    -s - cache size of every client (default 0, no cache)\n"         \
+  "    -m - clients share one cache of the -s size in the shared memory\n" \
+  "         segment of this name, such as /jbod, instead of a cache each\n" \
+  "\n"
+
+/* Load generator for a JBOD server that takes several clients, such as the
+ * in-tree server. Every client is a separate process with its own connection
+ * and mdadm state replaying the whole workload, a text or binary trace;
+ * SIGNALL commands are skipped as they only produce output. Latencies are
+ * those of whole mdadm calls. The JBOD cost and cache memory reported are
+ * those of all clients together, counting a shared cache once. */
+
+/* what a client reports back through shared memory */
+typedef struct {
+  int num_ops;
+  int failed;                                           //the client could not connect or the workload failed
+  unsigned long round_trips;
+  uint64_t cost;
+  unsigned long queries;
+  unsigned long hits;
+  size_t cache_bytes;                                   //taken up by the cache just before it went
+  uint64_t latency_ns[];                                //one per operation, num_ops of them
+} client_report_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* Returns the number of commands of |workload|, which a binary trace has in
+ * its header. */
+static int count_records(const char *workload) {
+  const trace_record_t *rec;
+  trace_t trace;
+  int more, n;
+
+  if (trace_open(&trace, workload) == -1)
+    err(1, "Cannot open workload file %s", workload);
+  if (trace.text == NULL) {
+    n = trace.num_records;
+  } else {
+    for (n = 0; (more = trace_next(&trace, &rec)) == 1; n++)
+      ;
+    if (more == -1)
+      errx(1, "Failed to parse command: [%s] on line %llu, aborting.", trace.line,
+           (unsigned long long)trace.position);
+  }
+  trace_close(&trace);
+  return n;
+}
+
+/* Replays |workload| over a fresh connection, timing every operation into
+ * |report|. Runs in the child process. */
+static void run_client(const char *workload, int cache_size, client_report_t *report) {
+  const trace_record_t *rec;
+  trace_t trace;
+  uint8_t buf[MAX_IO_SIZE];
+  int rc = 0, more;
+
+  if (trace_open(&trace, workload) == -1 || !jbod_connect(JBOD_SERVER, JBOD_PORT)) {
+    report->failed = 1;
+    return;
+  }
+  if (cache_size && cache_create(cache_size) != 1) {
+    report->failed = 1;
+    return;
+  }
+
+  while ((more = trace_next(&trace, &rec)) == 1) {
+    uint64_t start = now_ns();
+    switch (rec->cmd) {
+      case TRACE_MOUNT:
+        rc = mdadm_mount();
+        break;
+      case TRACE_UNMOUNT:
+        rc = mdadm_unmount();
+        break;
+      case TRACE_WRITE_PERMIT:
+        rc = mdadm_write_permission();
+        break;
+      case TRACE_WRITE_PERMIT_REVOKE:
+        rc = mdadm_revoke_write_permission();
+        break;
+      case TRACE_SIGNALL:
+        continue;
+      case TRACE_READ:
+        rc = mdadm_read(rec->addr, rec->len, buf);
+        break;
+      case TRACE_WRITE:
+        memset(buf, rec->ch, rec->len);
+        rc = mdadm_write(rec->addr, rec->len, buf);
+        break;
+      default:
+        errx(1, "Unknown command %d in record %llu, aborting.", rec->cmd, (unsigned long long)trace.position);
+    }
+    report->latency_ns[report->num_ops++] = now_ns() - start;
+    if (rc == -1) {
+      report->failed = 1;
+    }
+  }
+  if (more == -1)
+    errx(1, "Failed to parse command: [%s] on line %llu, aborting.", trace.line, (unsigned long long)trace.position);
+  trace_close(&trace);
+
+  if (cache_size) {
+    cache_stats_t stats;
+    cache_get_stats_r(cache_default(), &stats);
+    report->queries = stats.queries;
+    report->hits = stats.hits;
+    report->cache_bytes = cache_resident_bytes();
+    cache_destroy();
+  }
+  report->round_trips = jbod_client_round_trips();
+  report->cost = jbod_client_cost();
+  jbod_disconnect();
+}
+
+int main(int argc, char *argv[]) {
+  int ch, num_clients = 4, cache_size = 0;
+  char *workload = "traces/random-input";
+  char *shared = NULL;
+
+  while ((ch = getopt(argc, argv, LOADGEN_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'w':
+        workload = optarg;
+        break;
+      case 'n':
+        num_clients = atoi(optarg);
+        break;
+      case 's':
+        cache_size = atoi(optarg);
+        break;
+      case 'm':
+        if (cache_set_shared(optarg) != 1) {
+          fprintf(stderr, "Bad shared cache name (%s), aborting.\n", optarg);
+          return -1;
+        }
+        shared = optarg;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+  if (num_clients < 1) {
+    fprintf(stderr, USAGE);
+    return -1;
+  }
+  if (shared && cache_size < 1) {
+    fprintf(stderr, "A shared cache needs a cache size (-s), aborting.\n");
+    return -1;
+  }
+
+  int max_ops = count_records(workload);
+  size_t report_size = sizeof(client_report_t) + max_ops * sizeof(uint64_t);
+  uint8_t *reports = mmap(NULL, num_clients * report_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (reports == MAP_FAILED)
+    err(1, "Cannot map client reports");
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < num_clients; i++) {
+    pid_t pid = fork();
+    if (pid == -1)
+      err(1, "Cannot start client %d", i);
+    if (pid == 0) {
+      run_client(workload, cache_size, (client_report_t *)(reports + i * report_size));
+      _exit(0);
+    }
+  }
+  while (wait(NULL) > 0)
+    ;
+  double elapsed = (now_ns() - start) / 1e9;
+
+  uint64_t *all = malloc((size_t)num_clients * max_ops * sizeof(uint64_t));
+  unsigned long round_trips = 0, queries = 0, hits = 0;
+  uint64_t cost = 0;
+  size_t cache_bytes = 0;
+  int total = 0, failed = 0;
+  if (all == NULL)
+    err(1, "Cannot allocate latency table");
+  for (int i = 0; i < num_clients; i++) {
+    client_report_t *r = (client_report_t *)(reports + i * report_size);
+    memcpy(all + total, r->latency_ns, r->num_ops * sizeof(uint64_t));
+    total += r->num_ops;
+    round_trips += r->round_trips;
+    cost += r->cost;
+    queries += r->queries;
+    hits += r->hits;
+    if (!shared)
+      cache_bytes += r->cache_bytes;
+    else if (r->cache_bytes > cache_bytes)              //the same segment, grown as far as it got
+      cache_bytes = r->cache_bytes;
+    failed += r->failed;
+  }
+  qsort(all, total, sizeof(uint64_t), compare_u64);
+
+  printf("clients: %d, ops: %d, failed clients: %d, elapsed: %.3f s\n", num_clients, total, failed, elapsed);
+  printf("throughput: %.0f ops/s, %.0f round trips/s\n", total / elapsed, round_trips / elapsed);
+  if (total > 0) {
+    printf("latency: p50 %.1f us, p99 %.1f us, max %.1f us\n", all[total / 2] / 1e3,
+           all[(int)(total * 0.99)] / 1e3, all[total - 1] / 1e3);
+  }
+  printf("JBOD cost: %llu, cache hit rate: %.1f%%, cache memory: %zu KiB%s\n", (unsigned long long)cost,
+         queries ? 100.0 * hits / queries : 0.0, cache_bytes / 1024, shared ? " shared" : "");
+  free(all);
+  munmap(reports, num_clients * report_size);
+  return failed ? 1 : 0;
+}
@@ -9,12 +9,14 @@
 #include "jbod.h"
 #include "mdadm.h"
 #include "net.h"
+#include "stats.h"
 
-int is_mounted = 0;                                                     //mount status 
-int is_written = 0;                                                     //write premission
+#define MDADM_CHUNK_BLOCKS 16                                           //blocks per lane and batch: at most 3 operations each
+#define MDADM_MAX_CHUNK (MDADM_CHUNK_BLOCKS * MDADM_MAX_LANES)          //blocks per chunk over all lanes
+#define MDADM_RA_MIN 4                                                  //smallest readahead window, in blocks
+#define MDADM_RA_MAX 32                                                 //largest one, still a single batch
 
-int diskid;
-int blockid;
+static mdadm_ctx_t default_ctx = { .num_lanes = 1, .lanes = { { NULL, -1, -1 } }, .readahead = true };  //behind the functions without a context
 
 uint32_t newop (uint32_t block, uint32_t disk, uint32_t cmd) {
 
@@ -29,12 +31,243 @@ uint32_t newop (uint32_t block, uint32_t disk, uint32_t cmd) {
 }
 
 
-int mdadm_mount(void) {
-  if (is_mounted == 0) {                                                //check if device is mounted
-    if (jbod_client_operation(newop(0,0,JBOD_MOUNT), NULL) == JBOD_NO_ERROR){  //check if mounting will result to any error  
-      is_mounted = 1;                                                   //if successfully mounted, set is_mounted = 1 
+/* Returns the position in the whole array, disk after disk, of block
+ * |logical| of the address space under the layout of |ctx|. */
+static int physical_block(mdadm_ctx_t *ctx, int logical) {
+  if (ctx->stripe_unit == 0) {                                          //linear: the same thing
+    return logical;
+  }
+  int unit_blocks = ctx->stripe_unit / JBOD_BLOCK_SIZE;
+  int unit = logical / unit_blocks;                                     //stripe unit the block is in
+  int disk = unit % JBOD_NUM_DISKS;                                     //units go round the disks
+  int block = unit / JBOD_NUM_DISKS * unit_blocks + logical % unit_blocks;
+  return disk * JBOD_NUM_BLOCKS_PER_DISK + block;
+}
+
+/* Returns the lane of |ctx| that requests for block |key| of the whole array
+ * go over. */
+static mdadm_lane_t *lane_of(mdadm_ctx_t *ctx, int key) {
+  return &ctx->lanes[key / JBOD_NUM_BLOCKS_PER_DISK % ctx->num_lanes];
+}
+
+static void forget_heads(mdadm_ctx_t *ctx) {
+  for (int i = 0; i < ctx->num_lanes; i++) {
+    ctx->lanes[i].head_disk = ctx->lanes[i].head_block = -1;
+  }
+}
+
+/* Queues on |batch| the seeks that move the JBOD head of |lane| to |disk| and
+ * |block|, skipping those that would not move it. The head is assumed to be
+ * there from now on; a failed submit forgets it. Returns 0 on success and -1
+ * if the batch is full. */
+static int seek_to(mdadm_lane_t *lane, jbod_batch_t *batch, int disk, int block) {
+  int issued = 0;
+
+  if (lane->head_disk != disk) {                                        //a disk seek leaves the block undefined
+    if (!jbod_batch_add(batch, newop(0,disk,JBOD_SEEK_TO_DISK), NULL)) {
+      return -1;
+    }
+    lane->head_disk = disk;
+    lane->head_block = -1;
+    issued++;
+  }
+  if (lane->head_block != block) {
+    if (!jbod_batch_add(batch, newop(block,0,JBOD_SEEK_TO_BLOCK), NULL)) {
+      return -1;
+    }
+    lane->head_block = block;
+    issued++;
+  }
+  stats_add(STATS_SEEKS_ISSUED, issued);
+  stats_add(STATS_SEEKS_ELIDED, 2 - issued);                           //a seek without the head would take both
+  return 0;
+}
+
+/* Queues on |batch| a read or write (|cmd|) of the block under the JBOD head
+ * of |lane|, which then advances to the next block of the same disk. Returns
+ * 0 on success and -1 if the batch is full. */
+static int block_op(mdadm_lane_t *lane, jbod_batch_t *batch, jbod_cmd_t cmd, uint8_t *block) {
+  if (!jbod_batch_add(batch, newop(0,0,cmd), block)) {
+    return -1;
+  }
+  lane->head_block++;
+  return 0;
+}
+
+/* Queues on |batch| the transfer (|cmd| is JBOD_READ_BLOCK or
+ * JBOD_WRITE_BLOCK) of |count| contiguous blocks, starting at |disk| and
+ * |block| and possibly running into the next disks, to or from |buf|. Runs of
+ * several blocks go as one vectored command after the usual seeks when the
+ * server has the protocol extension, otherwise every block gets its own
+ * operation. Returns 0 on success and -1 if the batch is full. */
+static int queue_blocks(mdadm_lane_t *lane, jbod_batch_t *batch, jbod_cmd_t cmd, int disk, int block, int count, uint8_t *buf) {
+  int key = disk * JBOD_NUM_BLOCKS_PER_DISK + block;                    //position of the first block in the whole array
+
+  if (count > 1 && jbod_vectored_supported_r(lane->conn)) {
+    int ext = cmd == JBOD_READ_BLOCK ? JBOD_EXT_READ_BLOCKS : JBOD_EXT_WRITE_BLOCKS;
+    if (seek_to(lane, batch, disk, block) == -1 || !jbod_batch_add(batch, jbod_vectored_op(ext, disk, block, count), buf)) {
+      return -1;
+    }
+    key += count - 1;                                                   //the head ends up just past the last block
+    lane->head_disk = key / JBOD_NUM_BLOCKS_PER_DISK;
+    lane->head_block = key % JBOD_NUM_BLOCKS_PER_DISK + 1;
+    return 0;
+  }
+
+  for (int j = 0; j < count; j++, key++) {
+    if (seek_to(lane, batch, key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK) == -1
+        || block_op(lane, batch, cmd, buf + j * JBOD_BLOCK_SIZE) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Sends the operations queued on |batches|, one per lane of |ctx|, all of
+ * them before waiting for any answer, so the lanes share one round trip.
+ * Returns 0 on success and -1 on failure, after which the head positions are
+ * unknown and the next accesses seek again. */
+static int submit(mdadm_ctx_t *ctx, jbod_batch_t *batches) {
+  int rc = 0;
+  for (int i = 0; i < ctx->num_lanes; i++) {
+    if (jbod_batch_send_r(ctx->lanes[i].conn, &batches[i]) == -1) {
+      rc = -1;
+    }
+  }
+  for (int i = 0; i < ctx->num_lanes; i++) {                           //a failed send left nothing to receive
+    if (jbod_batch_recv_r(ctx->lanes[i].conn, &batches[i]) == -1) {
+      rc = -1;
+    }
+  }
+  if (rc == -1) {
+    forget_heads(ctx);
+  }
+  return rc;
+}
+
+/* Reads or writes (|cmd|) block |keys|[k] of the whole array to or from
+ * |bufs|[k] for every k below |count| whose buffer is not NULL, with one
+ * operation per run of blocks that follow each other on the same lane and in
+ * memory, and waits for all of them. Returns 0 on success and -1 on failure. */
+static int transfer(mdadm_ctx_t *ctx, jbod_cmd_t cmd, const int *keys, int count, uint8_t **bufs) {
+  jbod_batch_t batches[MDADM_MAX_LANES];
+
+  for (int i = 0; i < ctx->num_lanes; i++) {
+    jbod_batch_init(&batches[i]);
+  }
+  for (int k = 0, run; k < count; k += run) {
+    int key = keys[k];
+    mdadm_lane_t *lane = lane_of(ctx, key);
+    jbod_batch_t *batch = &batches[lane - ctx->lanes];
+
+    for (run = 1; k + run < count && bufs[k] != NULL && bufs[k + run] == bufs[k] + run * JBOD_BLOCK_SIZE
+         && keys[k + run] == key + run && lane_of(ctx, key + run) == lane; run++);
+    if (bufs[k] == NULL) {
+      continue;
+    }
+    if (batch->num_ops + run + 2 > JBOD_BATCH_MAX_OPS && submit(ctx, batches) == -1) {  //room for the seeks and every block
+      return -1;
+    }
+    if (queue_blocks(lane, batch, cmd, key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, run, bufs[k]) == -1) {
+      forget_heads(ctx);
+      return -1;
+    }
+  }
+  return submit(ctx, batches);
+}
+
+/* Writes back a dirty block evicted or flushed from the write-back cache of
+ * context |arg|. Returns 0 on success and -1 on failure. */
+static int writeback_block(void *arg, int disk, int block, const uint8_t *buf) {
+  mdadm_ctx_t *ctx = arg;
+  mdadm_lane_t *lane = lane_of(ctx, disk * JBOD_NUM_BLOCKS_PER_DISK + block);
+  uint8_t tempbuf[JBOD_BLOCK_SIZE];
+  jbod_batch_t batch;
+
+  memcpy(tempbuf, buf, JBOD_BLOCK_SIZE);
+  jbod_batch_init(&batch);
+  if (seek_to(lane, &batch, disk, block) == -1 || block_op(lane, &batch, JBOD_WRITE_BLOCK, tempbuf) == -1
+      || jbod_batch_submit_r(lane->conn, &batch) == -1) {
+    lane->head_disk = lane->head_block = -1;
+    return -1;
+  }
+  return 0;
+}
+
+/* Sends |cmd| over the connection of every lane of |ctx| in turn. If one
+ * fails, sends |undo| over the lanes it already succeeded on and returns -1;
+ * returns 0 if it succeeds everywhere. */
+static int lanes_operation(mdadm_ctx_t *ctx, jbod_cmd_t cmd, jbod_cmd_t undo) {
+  for (int i = 0; i < ctx->num_lanes; i++) {
+    if (jbod_client_operation_r(ctx->lanes[i].conn, newop(0,0,cmd), NULL) != JBOD_NO_ERROR) {
+      while (i-- > 0) {
+        jbod_client_operation_r(ctx->lanes[i].conn, newop(0,0,undo), NULL);
+      }
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void mdadm_ctx_init(mdadm_ctx_t *ctx, jbod_conn_t *conn, cache_t *cache) {
+  ctx->conn = conn;
+  ctx->cache = cache;
+  ctx->is_mounted = 0;
+  ctx->is_written = 0;
+  ctx->stripe_unit = 0;
+  ctx->num_lanes = 1;
+  ctx->lanes[0].conn = conn;
+  ctx->lanes[0].head_disk = ctx->lanes[0].head_block = -1;
+  ctx->readahead = true;
+  memset(ctx->streams, 0, sizeof(ctx->streams));
+  ctx->prefetch_hits_seen = ctx->prefetch_unused_seen = 0;
+  ctx->read_bytes = ctx->read_copied_bytes = 0;
+}
+
+int mdadm_add_lane_r(mdadm_ctx_t *ctx, jbod_conn_t *conn) {
+  if (ctx->is_mounted == 1 || ctx->num_lanes == MDADM_MAX_LANES || conn == NULL) {
+    return -1;
+  }
+  ctx->lanes[ctx->num_lanes].conn = conn;
+  ctx->lanes[ctx->num_lanes].head_disk = ctx->lanes[ctx->num_lanes].head_block = -1;
+  ctx->num_lanes++;
+  return 1;
+}
+
+int mdadm_set_stripe_unit_r(mdadm_ctx_t *ctx, uint32_t unit) {
+  if (ctx->is_mounted == 1) {                                           //the layout cannot change under mounted data
+    return -1;
+  }
+  if (unit != 0 && (unit < JBOD_BLOCK_SIZE || unit > JBOD_DISK_SIZE || (unit & (unit - 1)) != 0)) {
+    return -1;                                                          //units must tile the disks exactly
+  }
+  ctx->stripe_unit = unit;
+  return 1;
+}
+
+/* Returns the default context, following the default connection and cache,
+ * which the tester may set up before or after mounting. */
+static mdadm_ctx_t *default_context(void) {
+  default_ctx.conn = default_ctx.lanes[0].conn = jbod_default_conn();
+  default_ctx.cache = cache_default();
+  if (default_ctx.is_mounted == 1 && cache_write_back_r(default_ctx.cache)) {
+    cache_set_writeback_fn_r(default_ctx.cache, writeback_block, &default_ctx);
+  }
+  return &default_ctx;
+}
+
+int mdadm_mount_r(mdadm_ctx_t *ctx) {
+  if (ctx->is_mounted == 0) {                                           //check if device is mounted
+    if (cache_write_back_r(ctx->cache)                                  //dirty blocks of a write-back cache go through us
+        && cache_set_writeback_fn_r(ctx->cache, writeback_block, ctx) == -1) {
+      return -1;                                                        //and no one else
+    }
+    if (lanes_operation(ctx, JBOD_MOUNT, JBOD_UNMOUNT) == 0){           //check if mounting will result to any error  
+      ctx->is_mounted = 1;                                              //if successfully mounted, set is_mounted = 1
+      forget_heads(ctx);                                                //do not rely on where mounting leaves the head
       return 1; 
     }else {
+      cache_set_writeback_fn_r(ctx->cache, NULL, ctx);
       return -1;                                                        //if any error appear, return -1
     }
   }else {
@@ -42,10 +275,15 @@ int mdadm_mount(void) {
   }
 }
 
-int mdadm_unmount(void) {
-   if (is_mounted == 1) {                                                  //check if device is mounted
-    if (jbod_client_operation(newop(0,0,JBOD_UNMOUNT), NULL) == JBOD_NO_ERROR){ //check if unmounting will result to any error
-      is_mounted = 0;                                                    //if successfully unmounted, set is_mounted = 0
+int mdadm_unmount_r(mdadm_ctx_t *ctx) {
+   if (ctx->is_mounted == 1) {                                             //check if device is mounted
+    if (cache_flush_r(ctx->cache) == -1) {                               //dirty blocks must reach the disks first
+      return -1;
+    }
+    if (lanes_operation(ctx, JBOD_UNMOUNT, JBOD_MOUNT) == 0){            //check if unmounting will result to any error
+      ctx->is_mounted = 0;                                               //if successfully unmounted, set is_mounted = 0
+      forget_heads(ctx);
+      cache_set_writeback_fn_r(ctx->cache, NULL, ctx);
       return 1;
     }else {
       return -1;                                                         //if any error appear, return -1
@@ -55,10 +293,10 @@ int mdadm_unmount(void) {
   }
 }
 
-int mdadm_write_permission(void){
-  if (is_mounted == 1) {                                                 //check if devices is mounted
-    if (jbod_client_operation(newop(0,0,JBOD_WRITE_PERMISSION), NULL) == JBOD_NO_ERROR){ //check for any writing permission error  
-      is_written = 1;                                                    //if no writing permission error, set write permission to 1
+int mdadm_write_permission_r(mdadm_ctx_t *ctx){
+  if (ctx->is_mounted == 1) {                                            //check if devices is mounted
+    if (lanes_operation(ctx, JBOD_WRITE_PERMISSION, JBOD_REVOKE_WRITE_PERMISSION) == 0){ //check for any writing permission error  
+      ctx->is_written = 1;                                               //if no writing permission error, set write permission to 1
       return 0;                                                          
     }else {
       return -1;                                                         //if any error, return -1
@@ -69,10 +307,13 @@ int mdadm_write_permission(void){
 }
 
 
-int mdadm_revoke_write_permission(void){
-  if(is_mounted == 1) {                                                 //check if devices is mounted
-    if (jbod_client_operation(newop(0,0,JBOD_REVOKE_WRITE_PERMISSION), NULL) == JBOD_NO_ERROR){ //check for any revoke writing permission error
-      is_written = 0;                                                   //if no error occur, set write permission to 0
+int mdadm_revoke_write_permission_r(mdadm_ctx_t *ctx){
+  if(ctx->is_mounted == 1) {                                            //check if devices is mounted
+    if (cache_flush_r(ctx->cache) == -1) {                              //dirty blocks need the permission to be written
+      return -1;
+    }
+    if (lanes_operation(ctx, JBOD_REVOKE_WRITE_PERMISSION, JBOD_WRITE_PERMISSION) == 0){ //check for any revoke writing permission error
+      ctx->is_written = 0;                                              //if no error occur, set write permission to 0
       return 0;
     }else {
       return -1;                                                        //if any error return -1
@@ -83,174 +324,638 @@ int mdadm_revoke_write_permission(void){
 }
 
 
-int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
-  int length = addr + len;                                              //total amount of address needs to read
-  int boundary = JBOD_NUM_DISKS * JBOD_DISK_SIZE;                       //set boundary size base on amount of disks
-  int current_addr = addr;                                              //set current address to keep track of address location
-  int read_bytes;                                                       //set amount of bytes read
-  int offset;                                                           //set any unread bytes at the beginning of the current block, this will be constant
-  uint8_t *tempbuf = malloc(256);                                       //set temp buffer to keep track of buffer we need, this will be constant
-  jbod_error_t err = JBOD_NO_ERROR;                                     //check if any error comes up
-
-  int blockvalue = 0;                                                   //keep track of how many block passed
-  int original_off = addr % 256;                                        //set any unread bytes at the beginning of the first block, this will NOT be constant
-  int blank = 0;                                                        //amount of unread bytes at the end of the block
-  
-  if (len == 0 && buf == NULL) {                                        //check for condition: length is 0 while buffer is empty
-    return 0;
+/* Sizes the next readahead window of stream |s| from how the blocks prefetched
+ * since the last window fared: halved if any went unused, doubled if some were
+ * read and none wasted, between MDADM_RA_MIN and |max_window|. */
+static void size_window(mdadm_ctx_t *ctx, mdadm_stream_t *s, int max_window) {
+  cache_stats_t stats;
+
+  cache_get_stats_r(ctx->cache, &stats);
+  if (s->window == 0) {
+    s->window = 2 * MDADM_RA_MIN;
+  } else if (stats.prefetch_unused > ctx->prefetch_unused_seen) {
+    s->window /= 2;
+  } else if (stats.prefetch_hits > ctx->prefetch_hits_seen) {
+    s->window *= 2;
   }
+  if (s->window < MDADM_RA_MIN) {
+    s->window = MDADM_RA_MIN;
+  } else if (s->window > max_window) {
+    s->window = max_window;
+  }
+  ctx->prefetch_hits_seen = stats.prefetch_hits;
+  ctx->prefetch_unused_seen = stats.prefetch_unused;
+}
 
-  if (length > boundary) {                                              //check for out of bound
+/* Reads the |count| blocks from |first| on that are not cached yet into the
+ * cache, marked as prefetched. Returns 0 on success and -1 on failure. */
+static int prefetch(mdadm_ctx_t *ctx, int first, int count) {
+  uint8_t blocks[MDADM_RA_MAX][JBOD_BLOCK_SIZE];
+  uint8_t *bufs[MDADM_RA_MAX];                                          //NULL for blocks already cached
+  int keys[MDADM_RA_MAX];
+
+  for (int k = 0; k < count; k++) {
+    keys[k] = physical_block(ctx, first + k);
+    bool cached = cache_contains_r(ctx->cache, keys[k] / JBOD_NUM_BLOCKS_PER_DISK, keys[k] % JBOD_NUM_BLOCKS_PER_DISK);
+    bufs[k] = cached ? NULL : blocks[k];
+  }
+  if (transfer(ctx, JBOD_READ_BLOCK, keys, count, bufs) == -1) {      //a read for each run of missing blocks
     return -1;
   }
+  for (int k = 0; k < count; k++) {
+    if (bufs[k] != NULL) {
+      cache_prefetch_r(ctx->cache, keys[k] / JBOD_NUM_BLOCKS_PER_DISK, keys[k] % JBOD_NUM_BLOCKS_PER_DISK, blocks[k]);
+    }
+  }
+  return 0;
+}
 
-  if(is_mounted != 1) {                                                 //check if device is mounted
+/* Follows the stream of reads on the disk of block |first| through the read
+ * of blocks |first| to |last|. A read that starts where the previous one on
+ * the disk stopped (or in its last block) is sequential; once a sequential
+ * stream has less than half a window of prefetched blocks ahead of it, the
+ * next window is prefetched into the cache. A stream running into the next
+ * disk carries on there. */
+static void readahead(mdadm_ctx_t *ctx, int first, int last) {
+  mdadm_stream_t *s = &ctx->streams[first / JBOD_NUM_BLOCKS_PER_DISK];
+  bool sequential = s->next != 0 && (first == s->next || first == s->next - 1);
+  int max_window = cache_num_entries_r(ctx->cache) / 8;                 //prefetching must not flush the cache
+
+  if (last / JBOD_NUM_BLOCKS_PER_DISK != first / JBOD_NUM_BLOCKS_PER_DISK) {
+    ctx->streams[last / JBOD_NUM_BLOCKS_PER_DISK] = *s;
+    s = &ctx->streams[last / JBOD_NUM_BLOCKS_PER_DISK];
+  }
+  s->next = last + 1;
+  if (!sequential || s->end < last + 1) {                              //nothing useful prefetched ahead
+    s->end = last + 1;
+  }
+  if (!ctx->readahead || !sequential || max_window < MDADM_RA_MIN) {
+    return;
+  }
+  if (max_window > MDADM_RA_MAX) {
+    max_window = MDADM_RA_MAX;
+  }
+  if (s->window != 0 && s->end - s->next > s->window / 2) {            //still far enough ahead
+    return;
+  }
+
+  size_window(ctx, s, max_window);
+  int count = s->window;
+  if (count > JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK - s->end) {    //up to the end of the array
+    count = JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK - s->end;
+  }
+  if (count > 0 && prefetch(ctx, s->end, count) == 0) {
+    s->end += count;
+  }
+}
+
+/* Position in an iovec array, moved forward as bytes are scattered into it
+ * or gathered out of it. */
+typedef struct {
+  const struct iovec *iov;
+  int iovcnt;
+  int index;                                                            //current element
+  size_t offset;                                                        //bytes of it already used
+} iov_cursor_t;
+
+/* Stores the total length of |iov| in |total|. Returns -1 if the array is
+ * malformed or longer than the whole array of disks. */
+static int iov_length(const struct iovec *iov, int iovcnt, uint32_t *total) {
+  uint64_t sum = 0;
+
+  if (iovcnt < 0 || (iovcnt > 0 && iov == NULL)) {
     return -1;
   }
-  
-  if (len > 2048) {                                                     //check if length is more than 2048
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > 0 && iov[i].iov_base == NULL) {                //a non-empty element needs a buffer
+      return -1;
+    }
+    sum += iov[i].iov_len;
+    if (sum > (uint64_t)JBOD_NUM_DISKS * JBOD_DISK_SIZE) {
+      return -1;
+    }
+  }
+  *total = sum;
+  return 0;
+}
+
+/* Moves the cursor |n| bytes forward. */
+static void iov_skip(iov_cursor_t *c, size_t n) {
+  while (n > 0) {
+    size_t chunk = c->iov[c->index].iov_len - c->offset;
+    if (chunk > n) {
+      chunk = n;
+    }
+    n -= chunk;
+    c->offset += chunk;
+    if (c->offset == c->iov[c->index].iov_len) {                        //step over this and any empty elements
+      c->index++;
+      c->offset = 0;
+    }
+  }
+}
+
+/* Returns the next |n| bytes under the cursor if they are contiguous in one
+ * element, moving past them, or NULL without moving if they are not. */
+static uint8_t *iov_take(iov_cursor_t *c, size_t n) {
+  while (c->index < c->iovcnt && c->offset == c->iov[c->index].iov_len) {
+    c->index++;
+    c->offset = 0;
+  }
+  if (c->index == c->iovcnt || c->iov[c->index].iov_len - c->offset < n) {
+    return NULL;
+  }
+  uint8_t *p = (uint8_t *)c->iov[c->index].iov_base + c->offset;
+  iov_skip(c, n);
+  return p;
+}
+
+/* Copies |n| bytes from |src| into the buffers under the cursor. */
+static void iov_scatter(iov_cursor_t *c, const uint8_t *src, size_t n) {
+  while (n > 0) {
+    const struct iovec *v = &c->iov[c->index];
+    size_t chunk = v->iov_len - c->offset;
+    if (chunk > n) {
+      chunk = n;
+    }
+    memcpy((uint8_t *)v->iov_base + c->offset, src, chunk);
+    src += chunk;
+    n -= chunk;
+    c->offset += chunk;
+    if (c->offset == v->iov_len) {                                      //step over this and any empty elements
+      c->index++;
+      c->offset = 0;
+    }
+  }
+}
+
+/* Copies |n| bytes from the buffers under the cursor into |dst|. */
+static void iov_gather(iov_cursor_t *c, uint8_t *dst, size_t n) {
+  while (n > 0) {
+    const struct iovec *v = &c->iov[c->index];
+    size_t chunk = v->iov_len - c->offset;
+    if (chunk > n) {
+      chunk = n;
+    }
+    memcpy(dst, (const uint8_t *)v->iov_base + c->offset, chunk);
+    dst += chunk;
+    n -= chunk;
+    c->offset += chunk;
+    if (c->offset == v->iov_len) {
+      c->index++;
+      c->offset = 0;
+    }
+  }
+}
+
+/* Adds to the chunk starting at logical block |first| with |num_blocks|
+ * blocks so far the key of the next block in |keys|, unless its lane already
+ * has MDADM_CHUNK_BLOCKS blocks in the chunk, counted in |per_lane|. Returns
+ * false if the chunk is full. */
+static bool chunk_add(mdadm_ctx_t *ctx, int first, int num_blocks, int *keys, int *per_lane) {
+  if (num_blocks == MDADM_MAX_CHUNK) {
+    return false;
+  }
+  int key = physical_block(ctx, first + num_blocks);
+  int lane = lane_of(ctx, key) - ctx->lanes;
+  if (per_lane[lane] == MDADM_CHUNK_BLOCKS) {
+    return false;
+  }
+  per_lane[lane]++;
+  keys[num_blocks] = key;
+  return true;
+}
+
+int mdadm_readv_r(mdadm_ctx_t *ctx, uint32_t addr, const struct iovec *iov, int iovcnt) {
+  uint32_t len;                                                         //total bytes to read
+  uint8_t blocks[MDADM_MAX_CHUNK][JBOD_BLOCK_SIZE];                     //bounce buffers for blocks only partly asked for
+  uint8_t *dest[MDADM_MAX_CHUNK];                                       //where the device puts each missing block, NULL on hits
+  iov_cursor_t pending[MDADM_MAX_CHUNK];                                //where the bytes of a bounced block go
+  int keys[MDADM_MAX_CHUNK];                                            //where each block of the chunk is in the array
+  iov_cursor_t cursor = { iov, iovcnt, 0, 0 };                          //where the next bytes read go
+
+  if (iov_length(iov, iovcnt, &len) == -1) {
     return -1;
-  } else if (len > 0 && buf == NULL) {                                  //check for condition: length is not 0 while buffer is not empty
+  }
+
+  uint32_t end = addr + len;                                            //address just past the last byte to read
+  uint32_t current_addr = addr;                                         //set current address to keep track of address location
+
+  if (end > JBOD_NUM_DISKS * JBOD_DISK_SIZE || end < addr) {            //check for out of bound
     return -1;
   }
 
-  diskid = addr/JBOD_DISK_SIZE;                                         //locate the disk
-  blockid = (addr%JBOD_DISK_SIZE)/ JBOD_BLOCK_SIZE;                     //locate the block
-  
-  for(int i = 0 ; i < len ; i+=read_bytes){                             //loopthrough the current disk and block for the given length
-    
-    offset = current_addr % 256;                                        //find offset of the current block
-
-    err = jbod_client_operation(newop(0,diskid, JBOD_SEEK_TO_DISK), NULL);     //seek to current disk  
-    assert (err == JBOD_NO_ERROR);                                      //check for any error
-
-    err = jbod_client_operation(newop(blockid,0, JBOD_SEEK_TO_BLOCK), NULL);   //seek to current block   
-    assert (err == JBOD_NO_ERROR);                                      //check for any error
-
-    if (cache_lookup(diskid,blockid,tempbuf) == -1) {                   //check if item exists in cache
-      err = jbod_client_operation(newop(0,0,JBOD_READ_BLOCK), tempbuf);        //if not read current block  
-      assert (err == JBOD_NO_ERROR);                                    //check for any error
-      cache_insert(diskid,blockid,tempbuf);                             //insert into cache if does not exist
-    }                                                                   //if cache already exists, cache_lookup copies required item is into tempbuf, skipping JBOD
-    
-    if(offset != 0){                                                    //check if there is any extra bytes at the beginnig of the block
-      blockvalue++;                                                     //read through one block
-      if (((blockvalue*256) - offset) > len) {                          //test to see if read_len is within one block
-        blank = ((blockvalue*256) - original_off) - len;                //find extra value at the end of read_len
-	memcpy(buf+i, tempbuf+offset, JBOD_BLOCK_SIZE-offset-blank);    //copy memory from tempbuf to read_buf at size of blocksize-offset-blank
-	read_bytes = 256-offset-blank;                                  //keep track of bytes read
-      }else {                                                           //else when read_len is not within the firt block
-	memcpy(buf+i, tempbuf+offset, JBOD_BLOCK_SIZE-offset);          //copy memory from tempbuf to readbuf at size of blocksize-offset
-	read_bytes = 256-offset;                                        //keep track of bytes read
+  if(ctx->is_mounted != 1) {                                            //check if device is mounted
+    return -1;
+  }
+
+  while (current_addr < end) {                                          //one round trip per chunk of blocks
+    int first = current_addr / JBOD_BLOCK_SIZE;                         //first block of the chunk
+    int num_blocks = 0;
+    int per_lane[MDADM_MAX_LANES] = { 0 };
+
+    for (uint32_t a = current_addr; a < end && chunk_add(ctx, first, num_blocks, keys, per_lane); a = (a / JBOD_BLOCK_SIZE + 1) * JBOD_BLOCK_SIZE) {
+      int diskid = keys[num_blocks] / JBOD_NUM_BLOCKS_PER_DISK;         //locate the disk
+      int blockid = keys[num_blocks] % JBOD_NUM_BLOCKS_PER_DISK;        //locate the block
+      int offset = a % JBOD_BLOCK_SIZE;                                 //bytes skipped at the beginning of the block
+      uint32_t read_bytes = JBOD_BLOCK_SIZE - offset;                   //bytes of the block that were asked for
+      if (read_bytes > end - a) {
+        read_bytes = end - a;
       }
-    }else {
-      blockvalue++;                                                     //read through one block
-      if((blockvalue*256)-original_off <= len) {                        //check if reading full block
-	memcpy(buf + i, tempbuf, JBOD_BLOCK_SIZE);                      //copy memory from tempbuf to readbuf at the size of blocksize
-	read_bytes = JBOD_BLOCK_SIZE;                                   //keep track of bytes read
-      } else if((blockvalue*256)-original_off > len){                   //check if reading partial block
-	blank = ((blockvalue*256)-original_off)-len;                    //find the value of bytes does not need to read at the end of the block
-	memcpy(buf + i, tempbuf, JBOD_BLOCK_SIZE-blank);                //copy memory from tempbuf to readbuf at size of blocksize-blank
-	read_bytes = 256-blank;                                         //keep track of bytes read
-      }	  
-    }
-    
-    current_addr += read_bytes;                                         //update current address location
-    diskid = current_addr/JBOD_DISK_SIZE;                               //update disk location
-    blockid = (current_addr%JBOD_DISK_SIZE)/ JBOD_BLOCK_SIZE;           //update block location
+      const uint8_t *cached = cache_pin_r(ctx->cache, diskid, blockid);  //check if item exists in cache
+      if (cached != NULL) {                                             //copy it out once, straight from the cache
+        iov_scatter(&cursor, cached + offset, read_bytes);
+        cache_unpin_r(ctx->cache, diskid, blockid);
+        ctx->read_copied_bytes += read_bytes;
+        dest[num_blocks] = NULL;
+      } else if (read_bytes < JBOD_BLOCK_SIZE || (dest[num_blocks] = iov_take(&cursor, JBOD_BLOCK_SIZE)) == NULL) {
+        dest[num_blocks] = blocks[num_blocks];                          //read whole, copy out the part asked for
+        pending[num_blocks] = cursor;
+        iov_skip(&cursor, read_bytes);
+      }
+      num_blocks++;
+    }
+
+    if (transfer(ctx, JBOD_READ_BLOCK, keys, num_blocks, dest) == -1) {  //read all the missing blocks at once
+      return -1;
+    }
+
+    for (int k = 0; k < num_blocks; k++) {                              //finish the blocks that came from the device
+      int offset = current_addr % JBOD_BLOCK_SIZE;
+      int read_bytes = JBOD_BLOCK_SIZE - offset;
+      if (read_bytes > end - current_addr) {
+        read_bytes = end - current_addr;
+      }
+      if (dest[k] != NULL) {
+        if (dest[k] == blocks[k]) {
+          iov_scatter(&pending[k], blocks[k] + offset, read_bytes);
+          ctx->read_copied_bytes += read_bytes;
+        }
+        cache_insert_r(ctx->cache, keys[k] / JBOD_NUM_BLOCKS_PER_DISK, keys[k] % JBOD_NUM_BLOCKS_PER_DISK, dest[k]);  //insert into cache if does not exist
+      }
+      current_addr += read_bytes;                                       //update current address location
+    }
+  }
+  ctx->read_bytes += len;
+  if (len > 0) {
+    readahead(ctx, addr / JBOD_BLOCK_SIZE, (end - 1) / JBOD_BLOCK_SIZE);
   }
   return len;
 }
 
-int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
-  int final_bound = addr + len;                                         //find the final address writing to
-  int write_bound = JBOD_NUM_DISKS * JBOD_DISK_SIZE;                    //check boundary of how much can be written
-  int current_addr = addr;                                              //keep track of address location
-  int read_bytes;                                                       //amount of bytes already read/write
-  int offset;                                                           //offset of the block
-  uint8_t *tempbuf = malloc(256);                                       //temp buffer to store bytes upto 256
-  jbod_error_t err = JBOD_NO_ERROR;                                     //checking for error
-
-  int blockvalue = 0;                                                   //keeping track of amount of blocks read through
-  int original_off = addr % 256;                                        //keeping value of the offset in the first block
-  int blank = 0;                                                        //value of extra memory we do not need
+int mdadm_writev_r(mdadm_ctx_t *ctx, uint32_t addr, const struct iovec *iov, int iovcnt) {
+  uint32_t len;                                                         //total bytes to write
+  uint8_t blocks[MDADM_MAX_CHUNK][JBOD_BLOCK_SIZE];                     //merged blocks of the current chunk
+  uint8_t *bufs[MDADM_MAX_CHUNK];                                       //blocks to transfer now, NULL for the others
+  int keys[MDADM_MAX_CHUNK];                                            //where each block of the chunk is in the array
+  iov_cursor_t cursor = { iov, iovcnt, 0, 0 };                          //where the next bytes written come from
 
-  if (len == 0 && buf == NULL) {                                        //check for condition: write_len = 0, write_buff == NULL
-    return 0;
-  }
-  
-  if (final_bound > write_bound) {                                      //check if value to be written is out of bound
+  if (iov_length(iov, iovcnt, &len) == -1) {
     return -1;
   }
-  
-  if (is_mounted != 1) {                                                //check if device is mounted
+
+  uint32_t end = addr + len;                                            //address just past the last byte to write
+  uint32_t current_addr = addr;                                         //keep track of address location
+
+  if (end > JBOD_NUM_DISKS * JBOD_DISK_SIZE || end < addr) {            //check if value to be written is out of bound
     return -1;
   }
   
-  if(len > 2048) {                                                      //check if length we need to write is over 2048
-    return -1;
-  } else if (len > 0 && buf == NULL) {                                  //check for condition: write_len > 0, write_buff == NULL
+  if (ctx->is_mounted != 1) {                                           //check if device is mounted
     return -1;
   }
 
-  diskid = addr/JBOD_DISK_SIZE;                                         //find the start address disk location
-  blockid = (addr%JBOD_DISK_SIZE)/ JBOD_BLOCK_SIZE;                     //find the start address block location
-  
-  for(int i = 0; i < len; i += read_bytes) {                            //loop through the given disk and block with given length
-    
-    offset = current_addr % 256;                                        //find offset of the current block
-
-    err = jbod_client_operation(newop(0,diskid, JBOD_SEEK_TO_DISK), NULL);     //seek to the current disk 
-    assert (err == JBOD_NO_ERROR);
-
-    err = jbod_client_operation(newop(blockid,0, JBOD_SEEK_TO_BLOCK), NULL);   //seek to the current block  
-    assert (err == JBOD_NO_ERROR);
-
-    if (cache_lookup(diskid,blockid,tempbuf) == -1) {                   //determine if cache exists
-      cache_insert(diskid,blockid,buf);                                 //if cache does not exist, insert cache
-      err = jbod_client_operation(newop(0,0,JBOD_READ_BLOCK), tempbuf);        //read the current block into the tempbuf   
-      assert (err == JBOD_NO_ERROR);                                    //check for any error
-    } else {
-      cache_update(diskid,blockid,buf);                                 //if cache exist, update cache
-      err = jbod_client_operation(newop(0,0,JBOD_READ_BLOCK), tempbuf);        //read the current block into the tempbuf  
-      assert (err == JBOD_NO_ERROR);                                    //check for any error
-    }
-    
-    if(offset != 0){                                                    //check of offset
-      blockvalue++;                                                     //read through one block
-      if (((blockvalue*256) - offset) > len) {                          //check for if write_len is within one block
-        blank = ((blockvalue*256) - original_off) - len;                //find extra value at the end of write_len
-	memcpy(tempbuf+offset, buf, JBOD_BLOCK_SIZE-offset-blank);      //copy memory from write_buff into tempbuf with the size of blocksize-offset-blank
-	read_bytes = 256-offset-blank;                                  //keep track of bytes read
-      }else {                                                           //else when read_len is not within the first block
-	memcpy(tempbuf+offset, buf, JBOD_BLOCK_SIZE-offset);            //copy memory from write_buff into tempbuf with the size of blocksize-offset
-	read_bytes = 256-offset;                                        //keep track of bytes read
+  while (current_addr < end) {                                          //at most two round trips per chunk of blocks
+    int first = current_addr / JBOD_BLOCK_SIZE;
+    int num_blocks = 0;
+    int per_lane[MDADM_MAX_LANES] = { 0 };
+    uint32_t a;
+
+    for (a = current_addr; a < end && chunk_add(ctx, first, num_blocks, keys, per_lane); a = (a / JBOD_BLOCK_SIZE + 1) * JBOD_BLOCK_SIZE) {
+      int diskid = keys[num_blocks] / JBOD_NUM_BLOCKS_PER_DISK;
+      int blockid = keys[num_blocks] % JBOD_NUM_BLOCKS_PER_DISK;
+      bool partial = a % JBOD_BLOCK_SIZE != 0 || end - a < JBOD_BLOCK_SIZE;  //full blocks are simply overwritten
+      bufs[num_blocks] = NULL;
+      if (partial && cache_lookup_r(ctx->cache, diskid, blockid, blocks[num_blocks]) == -1) {  //take the current contents from cache if there
+        bufs[num_blocks] = blocks[num_blocks];
       }
-    } else {
-      blockvalue++;                                                     //read through one block
-      if((blockvalue*256)-original_off <= len) {                        //check if reading full block
-	memcpy(tempbuf, buf+i, JBOD_BLOCK_SIZE);                        //copy memory from write_buff into tempbuf with the size of blocksize
-	read_bytes = JBOD_BLOCK_SIZE;                                   //keep track of bytes read
-      }else if ((blockvalue*256) -original_off > len) {                 //check if reading partial block
-	blank = ((blockvalue*256) - original_off) - len;                //find extra value at the end of write_len
-	memcpy(tempbuf, buf+i, JBOD_BLOCK_SIZE-blank);                  //copy memory from write_buff into tempbuf with the size of blocksize-blank
-	read_bytes = 256-blank;                                         //keep track of bytes read
+      num_blocks++;
+    }
+    if (transfer(ctx, JBOD_READ_BLOCK, keys, num_blocks, bufs) == -1) {  //first the old contents of partial blocks
+      return -1;
+    }
+
+    a = current_addr;                                                   //gather the written bytes into the blocks
+    for (int k = 0; k < num_blocks; k++) {
+      int offset = a % JBOD_BLOCK_SIZE;
+      int write_bytes = JBOD_BLOCK_SIZE - offset;
+      if (write_bytes > end - a) {
+        write_bytes = end - a;
       }
+      iov_gather(&cursor, blocks[k] + offset, write_bytes);
+      int diskid = keys[k] / JBOD_NUM_BLOCKS_PER_DISK;
+      int blockid = keys[k] % JBOD_NUM_BLOCKS_PER_DISK;
+      bool through = !cache_write_back_r(ctx->cache) || cache_write_r(ctx->cache, diskid, blockid, blocks[k]) == -1;  //a write-back cache absorbs the write
+      bufs[k] = through ? blocks[k] : NULL;
+      a += write_bytes;
     }
 
-    err = jbod_client_operation(newop(0,diskid, JBOD_SEEK_TO_DISK), NULL);     //seek to current disk   
-    assert (err == JBOD_NO_ERROR);
+    if (transfer(ctx, JBOD_WRITE_BLOCK, keys, num_blocks, bufs) == -1) {  //then overwrite whatever was not absorbed
+      return -1;
+    }
 
-    err = jbod_client_operation(newop(blockid,0, JBOD_SEEK_TO_BLOCK), NULL);   //seek to current block 
-    assert (err == JBOD_NO_ERROR);
+    for (int k = 0; k < num_blocks; k++) {                              //keep the cache coherent with the merged blocks
+      int diskid = keys[k] / JBOD_NUM_BLOCKS_PER_DISK;
+      int blockid = keys[k] % JBOD_NUM_BLOCKS_PER_DISK;
+      if (bufs[k] != NULL && cache_insert_r(ctx->cache, diskid, blockid, blocks[k]) == -1) {
+        cache_update_r(ctx->cache, diskid, blockid, blocks[k]);
+      }
+      current_addr = (current_addr / JBOD_BLOCK_SIZE + 1) * JBOD_BLOCK_SIZE;
+    }
+    if (current_addr > end) {
+      current_addr = end;
+    }
+  }
+  return len;
+}
 
-    err = jbod_client_operation(newop(0,0,JBOD_WRITE_BLOCK), tempbuf);         //overwrite value in the tempbuf  
-    assert (err == JBOD_NO_ERROR);
+/* Requests of a batch carried out together: the blocks they touch, each
+ * block once per request touching it, at most MDADM_CHUNK_BLOCKS per lane.
+ * No block written by one of them is touched by another, so they can be
+ * carried out in any order. */
+typedef struct {
+  int num_ios;
+  mdadm_io_t *ios[MDADM_MAX_CHUNK];
+  int num_blocks;
+  int per_lane[MDADM_MAX_LANES];
+  int keys[MDADM_MAX_CHUNK];                                            //where each block is in the array
+  mdadm_io_t *owner[MDADM_MAX_CHUNK];                                   //the request each block belongs to
+  uint32_t addrs[MDADM_MAX_CHUNK];                                      //first byte of the block the request asked for
+  uint8_t touched[JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK / 8];       //bitmaps of the blocks read or written
+  uint8_t written[JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK / 8];       //and of those written
+} group_t;
+
+static void group_init(group_t *g) {
+  g->num_ios = g->num_blocks = 0;
+  memset(g->per_lane, 0, sizeof(g->per_lane));
+  memset(g->touched, 0, sizeof(g->touched));
+  memset(g->written, 0, sizeof(g->written));
+}
 
-    current_addr += read_bytes;                                         //update current address locaation
-    diskid = current_addr/JBOD_DISK_SIZE;                               //update disk location
-    blockid = (current_addr%JBOD_DISK_SIZE)/ JBOD_BLOCK_SIZE;           //update block location
+static bool bit_test(const uint8_t *bitmap, int key) {
+  return bitmap[key / 8] & (1 << key % 8);
+}
 
+/* Adds request |io| to group |g|, unless it does not fit in what is left of
+ * the group or conflicts with a request already in it: a write with any
+ * request touching one of its blocks, a read with a write. Returns false,
+ * leaving the group as it was, if it was not added. */
+static bool group_add(mdadm_ctx_t *ctx, group_t *g, mdadm_io_t *io) {
+  int first = io->addr / JBOD_BLOCK_SIZE;
+  int last = (io->addr + io->len - 1) / JBOD_BLOCK_SIZE;
+  int per_lane[MDADM_MAX_LANES];
+
+  if (g->num_blocks + last - first + 1 > MDADM_MAX_CHUNK) {
+    return false;
   }
-  return len;
+  memcpy(per_lane, g->per_lane, sizeof(per_lane));
+  for (int b = first; b <= last; b++) {                                 //check everything before changing anything
+    int key = physical_block(ctx, b);
+    int lane = lane_of(ctx, key) - ctx->lanes;
+    if (++per_lane[lane] > MDADM_CHUNK_BLOCKS || bit_test(io->write ? g->touched : g->written, key)) {
+      return false;
+    }
+  }
+
+  memcpy(g->per_lane, per_lane, sizeof(per_lane));
+  g->ios[g->num_ios++] = io;
+  for (int b = first; b <= last; b++) {
+    int key = physical_block(ctx, b);
+    g->keys[g->num_blocks] = key;
+    g->owner[g->num_blocks] = io;
+    g->addrs[g->num_blocks] = b == first ? io->addr : (uint32_t)b * JBOD_BLOCK_SIZE;
+    g->num_blocks++;
+    g->touched[key / 8] |= 1 << key % 8;
+    if (io->write) {
+      g->written[key / 8] |= 1 << key % 8;
+    }
+  }
+  return true;
+}
+
+/* Puts the blocks of group |g| in the order of the array, keeping the order
+ * of blocks of the same request, so each disk is swept once. */
+static void group_sort(group_t *g) {
+  for (int k = 1; k < g->num_blocks; k++) {
+    int key = g->keys[k];
+    mdadm_io_t *owner = g->owner[k];
+    uint32_t addr = g->addrs[k];
+    int j;
+    for (j = k; j > 0 && g->keys[j - 1] > key; j--) {
+      g->keys[j] = g->keys[j - 1];
+      g->owner[j] = g->owner[j - 1];
+      g->addrs[j] = g->addrs[j - 1];
+    }
+    g->keys[j] = key;
+    g->owner[j] = owner;
+    g->addrs[j] = addr;
+  }
+}
+
+/* Carries out the requests of group |g| with one round trip for everything
+ * read from the device, then one for everything written, and sets their
+ * results. Reads use the cache like mdadm_readv_r, writes like
+ * mdadm_writev_r; full blocks go between the device and the caller's buffers
+ * directly. */
+static void group_run(mdadm_ctx_t *ctx, group_t *g) {
+  uint8_t blocks[MDADM_MAX_CHUNK][JBOD_BLOCK_SIZE];                     //partial blocks, read whole or merged
+  uint8_t *bufs[MDADM_MAX_CHUNK];                                       //blocks to transfer, NULL for the others
+  int rc = 0;
+
+  group_sort(g);
+  for (int k = 0; k < g->num_blocks; k++) {
+    mdadm_io_t *io = g->owner[k];
+    int diskid = g->keys[k] / JBOD_NUM_BLOCKS_PER_DISK;
+    int blockid = g->keys[k] % JBOD_NUM_BLOCKS_PER_DISK;
+    int offset = g->addrs[k] % JBOD_BLOCK_SIZE;
+    uint32_t bytes = JBOD_BLOCK_SIZE - offset;                          //bytes of the block the request covers
+    if (bytes > io->addr + io->len - g->addrs[k]) {
+      bytes = io->addr + io->len - g->addrs[k];
+    }
+    uint8_t *user = io->buf + (g->addrs[k] - io->addr);
+    bufs[k] = NULL;
+    if (!io->write) {
+      const uint8_t *cached = cache_pin_r(ctx->cache, diskid, blockid);
+      if (cached != NULL) {
+        memcpy(user, cached + offset, bytes);
+        cache_unpin_r(ctx->cache, diskid, blockid);
+        ctx->read_copied_bytes += bytes;
+      } else {
+        bufs[k] = bytes < JBOD_BLOCK_SIZE ? blocks[k] : user;
+      }
+    } else if (bytes < JBOD_BLOCK_SIZE && cache_lookup_r(ctx->cache, diskid, blockid, blocks[k]) == -1) {
+      bufs[k] = blocks[k];                                              //old contents of a partial block
+    }
+  }
+  if (transfer(ctx, JBOD_READ_BLOCK, g->keys, g->num_blocks, bufs) == -1) {
+    rc = -1;
+  }
+
+  for (int k = 0; k < g->num_blocks && rc == 0; k++) {                 //finish reads, merge writes
+    mdadm_io_t *io = g->owner[k];
+    int diskid = g->keys[k] / JBOD_NUM_BLOCKS_PER_DISK;
+    int blockid = g->keys[k] % JBOD_NUM_BLOCKS_PER_DISK;
+    int offset = g->addrs[k] % JBOD_BLOCK_SIZE;
+    uint32_t bytes = JBOD_BLOCK_SIZE - offset;
+    if (bytes > io->addr + io->len - g->addrs[k]) {
+      bytes = io->addr + io->len - g->addrs[k];
+    }
+    uint8_t *user = io->buf + (g->addrs[k] - io->addr);
+    if (!io->write) {
+      if (bufs[k] == blocks[k]) {
+        memcpy(user, blocks[k] + offset, bytes);
+        ctx->read_copied_bytes += bytes;
+      }
+      if (bufs[k] != NULL) {
+        cache_insert_r(ctx->cache, diskid, blockid, bufs[k]);
+      }
+      bufs[k] = NULL;
+      continue;
+    }
+    uint8_t *src = user;
+    if (bytes < JBOD_BLOCK_SIZE) {
+      memcpy(blocks[k] + offset, user, bytes);
+      src = blocks[k];
+    }
+    bool through = !cache_write_back_r(ctx->cache) || cache_write_r(ctx->cache, diskid, blockid, src) == -1;
+    bufs[k] = through ? src : NULL;
+  }
+  if (rc == 0 && transfer(ctx, JBOD_WRITE_BLOCK, g->keys, g->num_blocks, bufs) == -1) {
+    rc = -1;
+  }
+
+  for (int k = 0; k < g->num_blocks && rc == 0; k++) {                 //keep the cache coherent with the writes
+    int diskid = g->keys[k] / JBOD_NUM_BLOCKS_PER_DISK;
+    int blockid = g->keys[k] % JBOD_NUM_BLOCKS_PER_DISK;
+    if (bufs[k] != NULL && cache_insert_r(ctx->cache, diskid, blockid, bufs[k]) == -1) {
+      cache_update_r(ctx->cache, diskid, blockid, bufs[k]);
+    }
+  }
+  for (int i = 0; i < g->num_ios; i++) {
+    mdadm_io_t *io = g->ios[i];
+    io->result = rc == -1 ? -1 : (int)io->len;
+    if (rc == 0 && !io->write) {
+      ctx->read_bytes += io->len;
+      readahead(ctx, io->addr / JBOD_BLOCK_SIZE, (io->addr + io->len - 1) / JBOD_BLOCK_SIZE);
+    }
+  }
+  group_init(g);
+}
+
+int mdadm_batch_r(mdadm_ctx_t *ctx, mdadm_io_t *ios, int n) {
+  group_t g;
+  int rc = 1;
+
+  group_init(&g);
+  for (int i = 0; i < n; i++) {
+    mdadm_io_t *io = &ios[i];
+    uint32_t end = io->addr + io->len;
+    if (ctx->is_mounted != 1 || end > JBOD_NUM_DISKS * JBOD_DISK_SIZE || end < io->addr
+        || (io->len > 0 && io->buf == NULL)) {
+      io->result = -1;
+    } else if (io->len == 0) {
+      io->result = 0;
+    } else if (!group_add(ctx, &g, io)) {                               //wait for the requests before it
+      group_run(ctx, &g);
+      if (!group_add(ctx, &g, io)) {                                    //too large to share a chunk
+        struct iovec iov = { io->buf, io->len };
+        io->result = io->write ? mdadm_writev_r(ctx, io->addr, &iov, 1) : mdadm_readv_r(ctx, io->addr, &iov, 1);
+      }
+    }
+  }
+  group_run(ctx, &g);
+  for (int i = 0; i < n; i++) {
+    if (ios[i].result == -1) {
+      rc = -1;
+    }
+  }
+  return rc;
+}
+
+int mdadm_read_r(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf) {
+  struct iovec iov = { buf, len };
+
+  if (len == 0 && buf == NULL) {                                        //check for condition: length is 0 while buffer is empty
+    return 0;
+  }
+  if (len > 2048) {                                                     //single buffer calls keep their length limit
+    return -1;
+  }
+  return mdadm_readv_r(ctx, addr, &iov, 1);
+}
+
+int mdadm_write_r(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf) {
+  struct iovec iov = { (void *)buf, len };
+
+  if (len == 0 && buf == NULL) {                                        //check for condition: write_len = 0, write_buff == NULL
+    return 0;
+  }
+  if (len > 2048) {                                                     //single buffer calls keep their length limit
+    return -1;
+  }
+  return mdadm_writev_r(ctx, addr, &iov, 1);
+}
+
+void mdadm_set_readahead(bool enabled) {
+  default_ctx.readahead = enabled;
+}
+
+int mdadm_set_stripe_unit(uint32_t unit) {
+  return mdadm_set_stripe_unit_r(&default_ctx, unit);
+}
+
+void mdadm_locate(uint32_t addr, int *disk_num, int *block_num) {
+  int key = physical_block(&default_ctx, addr / JBOD_BLOCK_SIZE);
+  *disk_num = key / JBOD_NUM_BLOCKS_PER_DISK;
+  *block_num = key % JBOD_NUM_BLOCKS_PER_DISK;
+}
+
+int mdadm_add_lane(jbod_conn_t *conn) {
+  return mdadm_add_lane_r(&default_ctx, conn);
+}
+
+int mdadm_mount(void) {
+  return mdadm_mount_r(default_context());
+}
+
+int mdadm_unmount(void) {
+  return mdadm_unmount_r(default_context());
+}
+
+int mdadm_write_permission(void) {
+  return mdadm_write_permission_r(default_context());
+}
+
+int mdadm_revoke_write_permission(void) {
+  return mdadm_revoke_write_permission_r(default_context());
+}
+
+int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
+  return mdadm_read_r(default_context(), addr, len, buf);
+}
+
+int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
+  return mdadm_write_r(default_context(), addr, len, buf);
+}
+
+mdadm_ctx_t *mdadm_default_ctx(void) {
+  return default_context();
+}
+
+int mdadm_readv(uint32_t addr, const struct iovec *iov, int iovcnt) {
+  return mdadm_readv_r(default_context(), addr, iov, iovcnt);
+}
+
+int mdadm_writev(uint32_t addr, const struct iovec *iov, int iovcnt) {
+  return mdadm_writev_r(default_context(), addr, iov, iovcnt);
 }
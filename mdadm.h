@@ -2,8 +2,119 @@
 #define MDADM_H_
 
 #include <stdint.h>
+#include <sys/uio.h>
 #include "jbod.h"
 #include "cache.h"
+#include "net.h"
+
+/* Most connections one context can spread its requests over. */
+#define MDADM_MAX_LANES 8
+
+/* A stream of reads on one disk, followed for readahead. Blocks are numbered
+ * across the whole array, disk after disk, in the order of addresses. */
+typedef struct {
+  int next;             /* block just past the last one read, 0 if no reads yet */
+  int end;              /* block just past the last one read or prefetched */
+  int window;           /* blocks to prefetch at a time, 0 until the first prefetch */
+} mdadm_stream_t;
+
+/* A connection requests for some of the disks go over, and where it left
+ * the JBOD head. */
+typedef struct {
+  jbod_conn_t *conn;
+  int head_disk;        /* where the JBOD head is, -1 if unknown */
+  int head_block;
+} mdadm_lane_t;
+
+/* State of one user of the array: the connections its requests go over, the
+ * cache it reads and writes through, its mount and write permission, and how
+ * addresses map to disks. Contexts on different connections can be used from
+ * different threads at once, each context by one thread at a time. They may
+ * share a write-through cache; a write-back cache can only be mounted through
+ * one context at a time, as its dirty blocks go back over that context's
+ * connection.
+ *
+ * With several lanes, disk d belongs to lane d % num_lanes, and the requests
+ * of one chunk for different lanes are all sent before any answer is awaited,
+ * so a server serving clients in parallel works on them at the same time. */
+typedef struct {
+  jbod_conn_t *conn;    /* also the connection of lane 0 */
+  cache_t *cache;       /* NULL for no cache */
+  int is_mounted;
+  int is_written;
+  uint32_t stripe_unit; /* bytes put on one disk before moving to the next, 0 for linear */
+  int num_lanes;
+  mdadm_lane_t lanes[MDADM_MAX_LANES];
+  bool readahead;       /* prefetch ahead of sequential reads into the cache */
+  mdadm_stream_t streams[JBOD_NUM_DISKS];
+  unsigned long prefetch_hits_seen;     /* cache counters when the last window was sized */
+  unsigned long prefetch_unused_seen;
+  unsigned long read_bytes;             /* bytes returned by reads */
+  unsigned long read_copied_bytes;      /* of those, bytes copied into the caller's buffers; the
+                                           others were put there by the device itself */
+} mdadm_ctx_t;
+
+/* A read or write of |len| bytes at |addr| into or out of |buf|, one of the
+ * requests handed to mdadm_batch_r. */
+typedef struct {
+  bool write;
+  uint32_t addr;
+  uint32_t len;
+  uint8_t *buf;         /* only read from by writes */
+  int result;           /* set by mdadm_batch_r: bytes read or written, -1 on failure */
+} mdadm_io_t;
+
+/* Sets up |ctx| to use |conn| and |cache|, unmounted, with the linear layout
+ * and readahead on. */
+void mdadm_ctx_init(mdadm_ctx_t *ctx, jbod_conn_t *conn, cache_t *cache);
+
+/* Returns 1 on success and -1 on failure. Adds |conn|, connected to the same
+ * server as the context's own connection, as another lane of |ctx|. The
+ * server must take several clients. Fails while mounted or once there are
+ * MDADM_MAX_LANES lanes. */
+int mdadm_add_lane_r(mdadm_ctx_t *ctx, jbod_conn_t *conn);
+
+/* The functions ending in _r work like the ones of the same name without the
+ * suffix, on context |ctx| instead of the default context, which uses the
+ * default connection and the default cache. */
+int mdadm_mount_r(mdadm_ctx_t *ctx);
+int mdadm_unmount_r(mdadm_ctx_t *ctx);
+int mdadm_write_permission_r(mdadm_ctx_t *ctx);
+int mdadm_revoke_write_permission_r(mdadm_ctx_t *ctx);
+int mdadm_set_stripe_unit_r(mdadm_ctx_t *ctx, uint32_t unit);
+int mdadm_read_r(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf);
+int mdadm_write_r(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf);
+int mdadm_readv_r(mdadm_ctx_t *ctx, uint32_t addr, const struct iovec *iov, int iovcnt);
+int mdadm_writev_r(mdadm_ctx_t *ctx, uint32_t addr, const struct iovec *iov, int iovcnt);
+
+/* Returns 1 if all of them succeed and -1 otherwise. Carries out the |n|
+ * requests of |ios| on |ctx| with the same results as one after the other,
+ * setting the result of each. Requests that do not touch blocks written by
+ * one another share their round trips, a chunk of blocks at a time: one for
+ * what they read from the device, one for what they write. */
+int mdadm_batch_r(mdadm_ctx_t *ctx, mdadm_io_t *ios, int n);
+
+/* Returns 1 on success and -1 on failure. Selects how addresses map to disks
+ * from the next mount on: linear, disk after disk, if |unit| is 0 (the
+ * default), otherwise striped (RAID-0) in units of |unit| bytes, which must
+ * be a power of two from JBOD_BLOCK_SIZE to JBOD_DISK_SIZE: unit i of the
+ * address space goes to disk i % JBOD_NUM_DISKS. Fails while mounted. Data
+ * only reads back as written under the layout it was written with. */
+int mdadm_set_stripe_unit(uint32_t unit);
+
+/* Stores in |disk_num| and |block_num| where the block holding the byte at
+ * |addr| lives under the layout of the default context. */
+void mdadm_locate(uint32_t addr, int *disk_num, int *block_num);
+
+/* Returns 1 on success and -1 on failure. mdadm_add_lane_r on the default
+ * context. */
+int mdadm_add_lane(jbod_conn_t *conn);
+
+/* Returns the default context. */
+mdadm_ctx_t *mdadm_default_ctx(void);
+
+/* Turns readahead of the default context on (the default) or off. */
+void mdadm_set_readahead(bool enabled);
 
 /* Return 1 on success and -1 on failure */
 int mdadm_mount(void);
@@ -23,4 +134,11 @@ int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf);
 /* Return the number of bytes written on success, -1 on failure. */
 int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf);
 
+/* Read into, or write from, the |iovcnt| buffers of |iov| in turn, starting at
+ * |addr|. Unlike the two functions above, the total length is only limited by
+ * the size of the array. Return the number of bytes read or written on
+ * success, -1 on failure. */
+int mdadm_readv(uint32_t addr, const struct iovec *iov, int iovcnt);
+int mdadm_writev(uint32_t addr, const struct iovec *iov, int iovcnt);
+
 #endif
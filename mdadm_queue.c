@@ -0,0 +1,194 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdadm.h"
+#include "mdadm_queue.h"
+
+/* A queue holds the requests submitted and not taken by the I/O thread yet in
+ * an array, taken all at once into another one to be carried out, and the
+ * completions not reaped yet in a ring. Each fits in |depth| entries, since
+ * every request in flight is in exactly one of them. */
+
+struct mdadm_queue {
+  mdadm_ctx_t *ctx;
+  pthread_t thread;
+  pthread_mutex_t lock;                                   //guards everything below
+  pthread_cond_t submitted;                               //signalled on submissions and when stopping
+  pthread_cond_t completed;                               //signalled when completions are posted
+  bool stopping;
+  int depth;
+  int in_flight;                                          //submitted and not reaped
+  int next_tag;
+  mdadm_io_t *sq;                                         //submitted requests, in order
+  int *sq_tags;
+  int sq_count;
+  mdadm_io_t *running;                                    //the requests taken by the I/O thread
+  int *running_tags;
+  mdadm_completion_t *cq;                                 //ring of posted completions
+  int cq_head;
+  int cq_count;
+};
+
+/* Body of the I/O thread: takes whatever was submitted, carries it out as one
+ * batch and posts the completions, until the queue stops and nothing is left. */
+static void *io_thread(void *arg) {
+  mdadm_queue_t *q = arg;
+  mdadm_io_t *ios = q->running;
+  int *tags = q->running_tags;
+
+  pthread_mutex_lock(&q->lock);
+  for (;;) {
+    while (q->sq_count == 0 && !q->stopping) {
+      pthread_cond_wait(&q->submitted, &q->lock);
+    }
+    if (q->sq_count == 0) {
+      break;
+    }
+    int n = q->sq_count;
+    memcpy(ios, q->sq, n * sizeof(mdadm_io_t));
+    memcpy(tags, q->sq_tags, n * sizeof(int));
+    q->sq_count = 0;
+    pthread_mutex_unlock(&q->lock);
+
+    mdadm_batch_r(q->ctx, ios, n);
+
+    pthread_mutex_lock(&q->lock);
+    for (int i = 0; i < n; i++) {
+      mdadm_completion_t *cqe = &q->cq[(q->cq_head + q->cq_count++) % q->depth];
+      cqe->tag = tags[i];
+      cqe->result = ios[i].result;
+    }
+    pthread_cond_broadcast(&q->completed);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+mdadm_queue_t *mdadm_queue_create(mdadm_ctx_t *ctx, int depth) {
+  if (ctx == NULL || depth < 1) {
+    return NULL;
+  }
+  mdadm_queue_t *q = calloc(1, sizeof(mdadm_queue_t));
+  if (q == NULL) {
+    return NULL;
+  }
+  q->ctx = ctx;
+  q->depth = depth;
+  q->sq = malloc(depth * sizeof(mdadm_io_t));
+  q->sq_tags = malloc(depth * sizeof(int));
+  q->running = malloc(depth * sizeof(mdadm_io_t));
+  q->running_tags = malloc(depth * sizeof(int));
+  q->cq = malloc(depth * sizeof(mdadm_completion_t));
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->submitted, NULL);
+  pthread_cond_init(&q->completed, NULL);
+  if (q->sq == NULL || q->sq_tags == NULL || q->running == NULL || q->running_tags == NULL || q->cq == NULL
+      || pthread_create(&q->thread, NULL, io_thread, q) != 0) {
+    pthread_cond_destroy(&q->completed);
+    pthread_cond_destroy(&q->submitted);
+    pthread_mutex_destroy(&q->lock);
+    free(q->cq);
+    free(q->running_tags);
+    free(q->running);
+    free(q->sq_tags);
+    free(q->sq);
+    free(q);
+    return NULL;
+  }
+  return q;
+}
+
+void mdadm_queue_destroy(mdadm_queue_t *q) {
+  if (q == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&q->lock);
+  q->stopping = true;
+  pthread_cond_signal(&q->submitted);
+  pthread_mutex_unlock(&q->lock);
+  pthread_join(q->thread, NULL);                          //it finishes what was submitted first
+
+  pthread_cond_destroy(&q->completed);
+  pthread_cond_destroy(&q->submitted);
+  pthread_mutex_destroy(&q->lock);
+  free(q->cq);
+  free(q->running_tags);
+  free(q->running);
+  free(q->sq_tags);
+  free(q->sq);
+  free(q);
+}
+
+/* Queues request |io| for the I/O thread. Returns its tag or -1 if the queue
+ * is full. */
+static int submit(mdadm_queue_t *q, const mdadm_io_t *io) {
+  int tag = -1;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->in_flight < q->depth) {
+    tag = q->next_tag;
+    q->next_tag = q->next_tag == INT_MAX ? 0 : q->next_tag + 1;
+    q->sq[q->sq_count] = *io;
+    q->sq_tags[q->sq_count] = tag;
+    q->sq_count++;
+    q->in_flight++;
+    pthread_cond_signal(&q->submitted);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return tag;
+}
+
+int mdadm_submit_read(mdadm_queue_t *q, uint32_t addr, uint32_t len, uint8_t *buf) {
+  mdadm_io_t io = { false, addr, len, buf, 0 };
+  return submit(q, &io);
+}
+
+int mdadm_submit_write(mdadm_queue_t *q, uint32_t addr, uint32_t len, const uint8_t *buf) {
+  mdadm_io_t io = { true, addr, len, (uint8_t *)buf, 0 };
+  return submit(q, &io);
+}
+
+int mdadm_in_flight(mdadm_queue_t *q) {
+  pthread_mutex_lock(&q->lock);
+  int n = q->in_flight;
+  pthread_mutex_unlock(&q->lock);
+  return n;
+}
+
+/* Moves up to |max| posted completions of |q| to |cqes|, with the lock held.
+ * Returns how many. */
+static int reap(mdadm_queue_t *q, mdadm_completion_t *cqes, int max) {
+  int n = q->cq_count < max ? q->cq_count : max;
+
+  for (int i = 0; i < n; i++) {
+    cqes[i] = q->cq[q->cq_head];
+    q->cq_head = (q->cq_head + 1) % q->depth;
+  }
+  q->cq_count -= n;
+  q->in_flight -= n;
+  return n;
+}
+
+int mdadm_poll(mdadm_queue_t *q, mdadm_completion_t *cqes, int max) {
+  pthread_mutex_lock(&q->lock);
+  int n = reap(q, cqes, max);
+  pthread_mutex_unlock(&q->lock);
+  return n;
+}
+
+int mdadm_wait(mdadm_queue_t *q, mdadm_completion_t *cqes, int min, int max) {
+  pthread_mutex_lock(&q->lock);
+  if (min > q->in_flight) {                               //no more will ever come
+    min = q->in_flight;
+  }
+  while (q->cq_count < min) {
+    pthread_cond_wait(&q->completed, &q->lock);
+  }
+  int n = reap(q, cqes, max);
+  pthread_mutex_unlock(&q->lock);
+  return n;
+}
@@ -0,0 +1,55 @@
+#ifndef MDADM_QUEUE_H_
+#define MDADM_QUEUE_H_
+
+#include <stdint.h>
+#include "mdadm.h"
+
+/* Asynchronous reads and writes on a context. Requests submitted to a queue
+ * return at once with a tag; an I/O thread of the queue carries them out in
+ * the order they were submitted and posts a completion for each, which the
+ * submitter reaps with mdadm_poll or mdadm_wait. Whatever was submitted while
+ * the I/O thread was busy is handed to mdadm_batch_r in one go when it comes
+ * back, so the more requests are kept in flight, the more of them share each
+ * round trip.
+ *
+ * The context is the I/O thread's while requests are in flight: it may only
+ * be used directly (to mount it, for instance) when every request submitted
+ * has completed. A queue is used by one submitting thread at a time. */
+typedef struct mdadm_queue mdadm_queue_t;
+
+/* The outcome of one request. */
+typedef struct {
+  int tag;              /* returned when the request was submitted */
+  int result;           /* bytes read or written, -1 on failure */
+} mdadm_completion_t;
+
+/* Returns a new queue on |ctx| keeping up to |depth| requests in flight, that
+ * is submitted and not reaped yet, or NULL on failure. */
+mdadm_queue_t *mdadm_queue_create(mdadm_ctx_t *ctx, int depth);
+
+/* Waits for every request submitted to |q| to complete, then frees it along
+ * with any completions not reaped. */
+void mdadm_queue_destroy(mdadm_queue_t *q);
+
+/* Return the tag of the request, from 0 up, on success and -1 on failure,
+ * which includes |q| already having |depth| requests in flight. Submit a read
+ * of |len| bytes at |addr| into |buf|, or a write of them from |buf|. |buf|
+ * must stay valid, and untouched for a read, until the request completes.
+ * Arguments are checked when the request is carried out, so a bad one is
+ * only seen as a failed completion. */
+int mdadm_submit_read(mdadm_queue_t *q, uint32_t addr, uint32_t len, uint8_t *buf);
+int mdadm_submit_write(mdadm_queue_t *q, uint32_t addr, uint32_t len, const uint8_t *buf);
+
+/* Returns the number of requests in flight on |q|. */
+int mdadm_in_flight(mdadm_queue_t *q);
+
+/* Returns the number of completions stored in |cqes|, which has room for
+ * |max|, in the order the requests were submitted. Takes the completions
+ * already posted, without waiting. */
+int mdadm_poll(mdadm_queue_t *q, mdadm_completion_t *cqes, int max);
+
+/* Like mdadm_poll, but first waits until at least |min| completions are
+ * posted, or all the requests in flight have completed if there are fewer. */
+int mdadm_wait(mdadm_queue_t *q, mdadm_completion_t *cqes, int min, int max);
+
+#endif
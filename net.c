@@ -6,13 +6,86 @@
 #include <errno.h>
 #include <err.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <time.h>
 #include "net.h"
 #include "jbod.h"
+#include "stats.h"
+
+/* the connection used by the functions without a connection argument */
+static jbod_conn_t default_conn = { .sd = -1, .vectored = -1 };
+
+/* cost the server's jbod_operation charges for each command, used to account
+   on the client side for the operations sent over the connection */
+static const uint64_t jbod_cmd_cost[JBOD_NUM_CMDS] = {
+  [JBOD_MOUNT] = 1000,
+  [JBOD_UNMOUNT] = 1000,
+  [JBOD_SEEK_TO_DISK] = 500,
+  [JBOD_SEEK_TO_BLOCK] = 50,
+  [JBOD_READ_BLOCK] = 100,
+  [JBOD_WRITE_BLOCK] = 200,
+};
+
+/* returns the number of blocks following the header of request op */
+static int request_blocks(uint32_t op) {
+  if (JBOD_OP_CMD(op) == JBOD_WRITE_BLOCK) {
+    return 1;
+  } else if (JBOD_OP_CMD(op) == JBOD_EXT_WRITE_BLOCKS) {
+    return JBOD_OP_COUNT(op);
+  }
+  return 0;
+}
+
+/* returns the number of blocks following the header of the response with
+   infocode to request op */
+static int response_blocks(uint32_t op, uint8_t infocode) {
+  if (infocode & 2) {
+    return 1;
+  } else if (infocode & 4) {
+    return JBOD_OP_COUNT(op);
+  }
+  return 0;
+}
 
-/* the client socket descriptor for the connection to the server */
-int cli_sd = -1;
+/* returns the time in nanoseconds on a clock that only goes forward */
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* counts the bytes of a response in conn and the stats */
+static void account_response(jbod_conn_t *conn, uint32_t op, uint8_t infocode) {
+  conn->bytes_received += HEADER_LEN + response_blocks(op, infocode) * JBOD_BLOCK_SIZE;
+  stats_add(STATS_BYTES_RECEIVED, HEADER_LEN + response_blocks(op, infocode) * JBOD_BLOCK_SIZE);
+}
+
+/* charges an operation sent over conn like the server does, and counts the
+   bytes of its request; a vectored command costs the seeks and block
+   operations it is carried out with */
+static void account_op(jbod_conn_t *conn, uint32_t op) {
+  int cmd = JBOD_OP_CMD(op);
+  conn->bytes_sent += HEADER_LEN + request_blocks(op) * JBOD_BLOCK_SIZE;
+  stats_add(STATS_BYTES_SENT, HEADER_LEN + request_blocks(op) * JBOD_BLOCK_SIZE);
+  if (cmd < JBOD_NUM_CMDS) {
+    conn->cost += jbod_cmd_cost[cmd];
+    conn->op_count[cmd]++;
+  } else if (cmd == JBOD_EXT_READ_BLOCKS || cmd == JBOD_EXT_WRITE_BLOCKS) {
+    jbod_cmd_t block_cmd = cmd == JBOD_EXT_READ_BLOCKS ? JBOD_READ_BLOCK : JBOD_WRITE_BLOCK;
+    int first_disk = (op >> 8) & 0xf;
+    int last_disk = (first_disk * JBOD_NUM_BLOCKS_PER_DISK + (op & 0xff) + JBOD_OP_COUNT(op) - 1) / JBOD_NUM_BLOCKS_PER_DISK;
+    int crossings = last_disk - first_disk;           //the server seeks at the start of every further disk;
+    conn->cost += crossings * (jbod_cmd_cost[JBOD_SEEK_TO_DISK] + jbod_cmd_cost[JBOD_SEEK_TO_BLOCK]);
+    conn->cost += JBOD_OP_COUNT(op) * jbod_cmd_cost[block_cmd];  //the seek to the first block is sent by the client
+    conn->op_count[JBOD_SEEK_TO_DISK] += crossings;
+    conn->op_count[JBOD_SEEK_TO_BLOCK] += crossings;
+    conn->op_count[block_cmd] += JBOD_OP_COUNT(op);
+  }
+}
 
 /* attempts to read n (len) bytes from fd; returns true on success and false on failure. 
 It may need to call the system call "read" multiple times to reach the given size len. 
@@ -22,6 +95,7 @@ static bool nread(int fd, int len, uint8_t *buf) {
   int value = 0;
   while (i < len){
     value = read(fd,&buf[i],len-i);     //checking the amount read
+    stats_add(STATS_READ_CALLS, 1);
     if (value <= 0) {                   //if fail to read return false
       return false;
     }
@@ -38,6 +112,7 @@ static bool nwrite(int fd, int len, uint8_t *buf) {
   int value = 0;
   while (i < len){
     value = write(fd,&buf[i],len-i);    //checking the amount written
+    stats_add(STATS_WRITE_CALLS, 1);
     if (value <= 0) {                   //if fail to write return false
       return false;
     }
@@ -46,6 +121,30 @@ static bool nwrite(int fd, int len, uint8_t *buf) {
   return true;
 }
 
+/* attempts to write all the bytes described by the iovcnt entries of iov to
+fd; returns true on success and false on failure. It may need to call the
+system call "writev" multiple times, iov is consumed along the way.
+*/
+static bool nwritev(int fd, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t value = writev(fd, iov, iovcnt);   //checking the amount written
+    stats_add(STATS_WRITE_CALLS, 1);
+    if (value <= 0) {                          //if fail to write return false
+      return false;
+    }
+    while (iovcnt > 0 && (size_t)value >= iov->iov_len) {  //skip the entries written completely
+      value -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {                          //and resume inside a partially written one
+      iov->iov_base = (uint8_t *)iov->iov_base + value;
+      iov->iov_len -= value;
+    }
+  }
+  return true;
+}
+
 /* Through this function call the client attempts to receive a packet from sd 
 (i.e., receiving a response from the server.). It happens after the client previously 
 forwarded a jbod operation call via a request message to the server.  
@@ -55,12 +154,14 @@ The values of the parameters (including op, ret, block) will be returned to the
 op - the address to store the jbod "opcode"  
 ret - the address to store the info code (lowest bit represents the return value of the server side calling the corresponding jbod_operation function. 2nd lowest bit represent whether data block exists after HEADER_LEN.)
 block - holds the received block content if existing (e.g., when the op command is JBOD_READ_BLOCK)
+sent - the opcode of the request, which sized block: a response echoing any other opcode is a failure,
+as a vectored response carries as many blocks as its own opcode says
 
 In your implementation, you can read the packet header first (i.e., read HEADER_LEN bytes first), 
 and then use the length field in the header to determine whether it is needed to read 
 a block of data from the server. You may use the above nread function here.  
 */
-static bool recv_packet(int sd, uint32_t *op, uint8_t *ret, uint8_t *block) {
+static bool recv_packet(int sd, uint32_t sent, uint32_t *op, uint8_t *ret, uint8_t *block) {
   uint8_t header[HEADER_LEN];                           //create header with 5 byte in size
   int offset = 0;                                       //calculate offset
   if (nread(sd,HEADER_LEN,header) == false) {           //reading the 5 bytes
@@ -74,10 +175,18 @@ static bool recv_packet(int sd, uint32_t *op, uint8_t *ret, uint8_t *block) {
   memcpy(ret, header+offset, sizeof(*ret));             //copying header+offset into ret with size of ret
   offset += sizeof(*ret);                               //increasing offset by size of ret
 
+  if (*op != sent || ((*ret & 6) && block == NULL)) {   //blocks the caller has no room for
+    return false;
+  }
+
   if (*ret & 2) {                                       //check if a block needs to be read
     if (nread(sd,JBOD_BLOCK_SIZE,block) == false) {     //read block if block exist
       return false;
     } 
+  } else if (*ret & 4) {                                //vectored read: the op gives the number of blocks
+    if (nread(sd,JBOD_OP_COUNT(*op) * JBOD_BLOCK_SIZE,block) == false) {
+      return false;
+    }
   }
   
   return true;
@@ -133,63 +242,90 @@ static bool send_packet(int sd, uint32_t op, uint8_t *block) {
 
 
 
-/* attempts to connect to server and set the global cli_sd variable to the
- * socket; returns true if successful and false if not. 
- * this function will be invoked by tester to connect to the server at given ip and port.
- * you will not call it in mdadm.c
+/* attempts to connect conn to the server at ip and port; returns true if
+ * successful and false if not. conn starts with all its counters at zero.
 */
-bool jbod_connect(const char *ip, uint16_t port) {
+bool jbod_connect_r(jbod_conn_t *conn, const char *ip, uint16_t port) {
   struct sockaddr_in serveraddr;                         //create socket structure
 
-  cli_sd = socket(AF_INET, SOCK_STREAM, 0);              //establish a socket
-  if (cli_sd == -1) {                                    //check if socket is created
+  memset(conn, 0, sizeof(*conn));
+  conn->vectored = -1;                                   //a new server may or may not have the extension
+  conn->sd = socket(AF_INET, SOCK_STREAM, 0);            //establish a socket
+  if (conn->sd == -1) {                                  //check if socket is created
     return false;
   }
 
   serveraddr.sin_family = AF_INET;                       //set network
   serveraddr.sin_port = htons(port);                     //set port
   if(inet_aton(ip, &serveraddr.sin_addr) == 0) {         //establish network
+    jbod_disconnect_r(conn);
     return false;
   }
 
-  if (connect(cli_sd, (const struct sockaddr *)&serveraddr, sizeof(serveraddr)) != 0) {  //connect to server
+  if (connect(conn->sd, (const struct sockaddr *)&serveraddr, sizeof(serveraddr)) != 0) {  //connect to server
+    jbod_disconnect_r(conn);
     return false;
   }
 
+  int nodelay = 1;                                       //requests are complete when written, do not hold them back
+  setsockopt(conn->sd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
   return true;
 }
 
+/* attempts to connect the default connection to server; returns true if
+ * successful and false if not. 
+ * this function will be invoked by tester to connect to the server at given ip and port.
+ * you will not call it in mdadm.c
+*/
+bool jbod_connect(const char *ip, uint16_t port) {
+  return jbod_connect_r(&default_conn, ip, port);
+}
+
 
 
-/* disconnects from the server and resets cli_sd */
+/* disconnects conn from the server and resets its socket */
+void jbod_disconnect_r(jbod_conn_t *conn) {
+  close(conn->sd);                                      //close socket
+  conn->sd = -1;                                        //set socket to -1
+}
+
+/* disconnects the default connection from the server */
 void jbod_disconnect(void) {
-  close(cli_sd);                                        //close socket
-  cli_sd = -1;                                          //set socket to -1
+  jbod_disconnect_r(&default_conn);
 }
 
 
 
-/* sends the JBOD operation to the server (use the send_packet function) and receives 
-(use the recv_packet function) and processes the response. 
+/* sends the JBOD operation to the server over conn (use the send_packet
+function) and receives (use the recv_packet function) and processes the
+response. 
 
 The meaning of each parameter is the same as in the original jbod_operation function. 
 return: 0 means success, -1 means failure.
 */
-int jbod_client_operation(uint32_t op, uint8_t *block) {
+int jbod_client_operation_r(jbod_conn_t *conn, uint32_t op, uint8_t *block) {
   uint8_t infocode;                                     //create blank infocode
   
-  if (cli_sd == -1){                                    //check connection
+  if (conn->sd == -1){                                  //check connection
     return -1;
   }
   
-  if (send_packet(cli_sd,op,block) == false) {          //check send packet
+  conn->sent_ns = now_ns();
+  if (send_packet(conn->sd,op,block) == false) {        //check send packet
     return -1;
   }
 
+  account_op(conn, op);                                 //charge the operation like the server does
+  conn->round_trips++;
+  stats_add(STATS_ROUND_TRIPS, 1);
 
-  if (recv_packet(cli_sd,&op,&infocode,block) == false) {  //check recieve packet
+
+  if (recv_packet(conn->sd,op,&op,&infocode,block) == false) {  //check recieve packet
       return -1;
   }
+  account_response(conn, op, infocode);
+  stats_record(STATS_ROUND_TRIP_NS, now_ns() - conn->sent_ns);
   
   if (infocode % 2 != 0) {                              //check updated infocode
     return -1;
@@ -197,3 +333,206 @@ int jbod_client_operation(uint32_t op, uint8_t *block) {
 
   return 0;
 }
+
+/* jbod_client_operation_r on the default connection */
+int jbod_client_operation(uint32_t op, uint8_t *block) {
+  return jbod_client_operation_r(&default_conn, op, block);
+}
+
+
+
+/* returns the connection used by the functions without a connection argument */
+jbod_conn_t *jbod_default_conn(void) {
+  return &default_conn;
+}
+
+
+
+/* returns the JBOD cost the server charges for one operation with command cmd */
+uint64_t jbod_op_cost(jbod_cmd_t cmd) {
+  return jbod_cmd_cost[cmd];
+}
+
+
+
+/* returns the total JBOD cost of the operations sent to the server so far */
+uint64_t jbod_client_cost(void) {
+  return default_conn.cost;
+}
+
+
+
+/* returns the number of operations with command cmd sent to the server so far */
+uint64_t jbod_client_op_count(jbod_cmd_t cmd) {
+  return default_conn.op_count[cmd];
+}
+
+
+
+/* empties batch so that it can be filled again */
+void jbod_batch_init(jbod_batch_t *batch) {
+  batch->num_ops = 0;
+  batch->failed = -1;
+}
+
+/* appends op to batch; block is the buffer the operation reads into or
+writes from, NULL if it has none. returns false if the batch is full. */
+bool jbod_batch_add(jbod_batch_t *batch, uint32_t op, uint8_t *block) {
+  if (batch->num_ops == JBOD_BATCH_MAX_OPS) {
+    return false;
+  }
+  batch->ops[batch->num_ops] = op;
+  batch->blocks[batch->num_ops] = block;
+  batch->num_ops++;
+  return true;
+}
+
+/* sends every operation of batch over conn with a single writev, without
+waiting for the responses, so that batches on several connections can be in
+flight at once. Every batch sent must be followed by jbod_batch_recv_r on the
+same connection before anything else is sent over it.
+return: 0 on success, -1 if the connection failed, in which case batch->failed
+is num_ops and there is nothing to receive.
+*/
+int jbod_batch_send_r(jbod_conn_t *conn, jbod_batch_t *batch) {
+  struct iovec iov[2 * JBOD_BATCH_MAX_OPS];
+  uint8_t headers[JBOD_BATCH_MAX_OPS][HEADER_LEN];
+  int iovcnt = 0;
+  int n = batch->num_ops;
+
+  batch->failed = -1;
+  if (n == 0) {                                         //nothing to send, nothing to wait for
+    return 0;
+  }
+  if (conn->sd == -1){                                  //check connection
+    batch->failed = n;
+    batch->num_ops = 0;
+    return -1;
+  }
+
+  for (int i = 0; i < n; i++) {                         //a header per operation, followed by its block if written
+    uint32_t newopcode = htonl(batch->ops[i]);
+    int num_blocks = request_blocks(batch->ops[i]);
+    memcpy(headers[i], &newopcode, sizeof(newopcode));
+    headers[i][sizeof(newopcode)] = num_blocks == 0 ? 0 : JBOD_OP_CMD(batch->ops[i]) == JBOD_WRITE_BLOCK ? 2 : 4;
+    iov[iovcnt].iov_base = headers[i];
+    iov[iovcnt++].iov_len = HEADER_LEN;
+    if (num_blocks > 0) {
+      iov[iovcnt].iov_base = batch->blocks[i];
+      iov[iovcnt++].iov_len = num_blocks * JBOD_BLOCK_SIZE;
+    }
+    account_op(conn, batch->ops[i]);
+  }
+  conn->round_trips++;
+  stats_add(STATS_ROUND_TRIPS, 1);
+  conn->sent_ns = now_ns();
+
+  if (nwritev(conn->sd, iov, iovcnt) == false) {          //check send packets
+    batch->failed = n;
+    batch->num_ops = 0;
+    return -1;
+  }
+  return 0;
+}
+
+/* receives the responses to a batch sent with jbod_batch_send_r, in order.
+The server executes all the operations even if one of them fails.
+return: 0 means every operation succeeded, -1 means failure, in which case
+batch->failed is the index of the first failed operation (num_ops if the
+connection itself failed). The batch is emptied either way.
+*/
+int jbod_batch_recv_r(jbod_conn_t *conn, jbod_batch_t *batch) {
+  int n = batch->num_ops;
+
+  batch->num_ops = 0;
+  for (int i = 0; i < n; i++) {                         //responses come back in request order
+    uint32_t op;
+    uint8_t infocode;
+    uint8_t discard[JBOD_BLOCK_SIZE];
+    uint8_t *block = batch->blocks[i] != NULL ? batch->blocks[i] : discard;
+    if (recv_packet(conn->sd, batch->ops[i], &op, &infocode, block) == false) {
+      batch->failed = n;
+      return -1;
+    }
+    account_response(conn, op, infocode);
+    if (infocode % 2 != 0 && batch->failed == -1) {     //remember the first failure, keep draining
+      batch->failed = i;
+    }
+  }
+
+  if (n > 0) {
+    stats_record(STATS_ROUND_TRIP_NS, now_ns() - conn->sent_ns);
+  }
+  return batch->failed == -1 ? 0 : -1;
+}
+
+/* sends every operation of batch over conn, then receives the responses, so
+the whole batch costs one round trip. Returns like jbod_batch_recv_r. */
+int jbod_batch_submit_r(jbod_conn_t *conn, jbod_batch_t *batch) {
+  if (jbod_batch_send_r(conn, batch) == -1) {
+    return -1;
+  }
+  return jbod_batch_recv_r(conn, batch);
+}
+
+/* jbod_batch_submit_r on the default connection */
+int jbod_batch_submit(jbod_batch_t *batch) {
+  return jbod_batch_submit_r(&default_conn, batch);
+}
+
+/* returns the number of round trips to the server made so far */
+uint64_t jbod_client_round_trips(void) {
+  return default_conn.round_trips;
+}
+
+/* returns the number of bytes sent to the server so far */
+uint64_t jbod_client_bytes_sent(void) {
+  return default_conn.bytes_sent;
+}
+
+/* returns the number of bytes received from the server so far */
+uint64_t jbod_client_bytes_received(void) {
+  return default_conn.bytes_received;
+}
+
+
+/* returns whether the server at the other end of conn understands the
+vectored commands, asking it with JBOD_EXT_PROBE the first time; a server
+without the extension answers the probe as an illegal command and keeps
+serving the connection */
+bool jbod_vectored_supported_r(jbod_conn_t *conn) {
+  if (conn->vectored == -1 && conn->sd != -1) {
+    conn->vectored = jbod_client_operation_r(conn, jbod_vectored_op(JBOD_EXT_PROBE, 0, 0, 0), NULL) == 0;
+  }
+  return conn->vectored == 1;
+}
+
+/* jbod_vectored_supported_r on the default connection */
+bool jbod_vectored_supported(void) {
+  return jbod_vectored_supported_r(&default_conn);
+}
+
+/* asks the server at the other end of conn for its mount epoch with
+JBOD_EXT_EPOCH and stores it in epoch; returns 0 on success and -1 on
+failure, which is what servers without the command give */
+int jbod_epoch_r(jbod_conn_t *conn, uint64_t *epoch) {
+  uint8_t block[JBOD_BLOCK_SIZE];
+  if (conn->sd == -1 || jbod_client_operation_r(conn, jbod_vectored_op(JBOD_EXT_EPOCH, 0, 0, 0), block) != 0) {
+    return -1;
+  }
+  *epoch = 0;
+  for (int i = 0; i < 8; i++) {                         //network byte order
+    *epoch = *epoch << 8 | block[i];
+  }
+  return 0;
+}
+
+/* jbod_epoch_r on the default connection */
+int jbod_epoch(uint64_t *epoch) {
+  return jbod_epoch_r(&default_conn, epoch);
+}
+
+/* packs a vectored command on count blocks starting at disk and block */
+uint32_t jbod_vectored_op(int cmd, int disk, int block, int count) {
+  return (uint32_t)count << 18 | (cmd & 0x3f) << 12 | (disk & 0xf) << 8 | (block & 0xff);
+}
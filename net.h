@@ -3,13 +3,85 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "jbod.h"
 
 #define HEADER_LEN (sizeof(uint32_t) + sizeof(uint8_t))
 #define JBOD_SERVER "127.0.0.1"
 #define JBOD_PORT 3333
 
+/* Vectored protocol extension. These commands sit above jbod_cmd_t in the
+   6-bit command field, so a server built only on jbod_operation rejects them
+   as illegal commands. For the vectored commands, the disk and block fields
+   give the first block, the top 14 bits of the op give the number of
+   contiguous blocks (continuing at block 0 of the next disk past the last
+   block of a disk), and infocode bit 2 (value 4) means that many blocks
+   follow the header. The server only seeks to the first block if its head is
+   not already there, and leaves the head just past the last block.
+   JBOD_EXT_EPOCH works mounted or not and answers with a block starting with
+   the mount epoch, 8 bytes in network byte order: a number that changes
+   whenever the device is mounted anew, which wipes it, and whenever a block
+   is written, so a client can tell whether blocks it read earlier are still
+   what the device holds. */
+#define JBOD_EXT_PROBE 32                  /* succeeds only on servers with the extension */
+#define JBOD_EXT_READ_BLOCKS 33
+#define JBOD_EXT_WRITE_BLOCKS 34
+#define JBOD_EXT_EPOCH 35
+#define JBOD_EXT_MAX_BLOCKS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+#define JBOD_OP_CMD(op) ((op) >> 12 & 0x3f)
+#define JBOD_OP_COUNT(op) ((op) >> 18)
+
+/* maximum number of operations in one batch; a full batch of block writes
+   and its responses stay well within the default socket buffers */
+#define JBOD_BATCH_MAX_OPS 64
+
+/* a sequence of JBOD operations sent to the server back to back; a batch
+   should not mix operations carrying blocks in both directions, or a long
+   enough one could fill both socket buffers */
+typedef struct {
+  int num_ops;
+  int failed;                           /* index of the first failed operation after submit, -1 if none */
+  uint32_t ops[JBOD_BATCH_MAX_OPS];
+  uint8_t *blocks[JBOD_BATCH_MAX_OPS];
+} jbod_batch_t;
+
+/* a connection to a JBOD server and the accounting of what was sent over it;
+   each connection must only be used by one thread at a time. The functions
+   without a connection argument use a default connection. */
+typedef struct {
+  int sd;                               /* socket, -1 when not connected */
+  int vectored;                         /* whether the server has the vectored commands, -1 not asked yet */
+  uint64_t cost;                        /* JBOD cost of the operations sent so far */
+  uint64_t op_count[JBOD_NUM_CMDS];     /* number of operations sent so far per command */
+  uint64_t round_trips;                 /* times the client waited for the server to answer */
+  uint64_t bytes_sent;                  /* headers and blocks written to the socket */
+  uint64_t bytes_received;              /* headers and blocks read from it */
+  uint64_t sent_ns;                     /* when the requests awaiting responses went, to time round trips */
+} jbod_conn_t;
+
+bool jbod_connect_r(jbod_conn_t *conn, const char *ip, uint16_t port);
+void jbod_disconnect_r(jbod_conn_t *conn);
+int jbod_client_operation_r(jbod_conn_t *conn, uint32_t op, uint8_t *block);
+int jbod_batch_submit_r(jbod_conn_t *conn, jbod_batch_t *batch);
+int jbod_batch_send_r(jbod_conn_t *conn, jbod_batch_t *batch);
+int jbod_batch_recv_r(jbod_conn_t *conn, jbod_batch_t *batch);
+bool jbod_vectored_supported_r(jbod_conn_t *conn);
+int jbod_epoch_r(jbod_conn_t *conn, uint64_t *epoch);
+jbod_conn_t *jbod_default_conn(void);
+
 int jbod_client_operation(uint32_t op, uint8_t *block);
+void jbod_batch_init(jbod_batch_t *batch);
+bool jbod_batch_add(jbod_batch_t *batch, uint32_t op, uint8_t *block);
+int jbod_batch_submit(jbod_batch_t *batch);
 bool jbod_connect(const char *ip, uint16_t port);
 void jbod_disconnect(void);
+uint64_t jbod_op_cost(jbod_cmd_t cmd);
+uint64_t jbod_client_cost(void);
+uint64_t jbod_client_op_count(jbod_cmd_t cmd);
+uint64_t jbod_client_round_trips(void);
+uint64_t jbod_client_bytes_sent(void);
+uint64_t jbod_client_bytes_received(void);
+bool jbod_vectored_supported(void);
+int jbod_epoch(uint64_t *epoch);
+uint32_t jbod_vectored_op(int cmd, int disk, int block, int count);
 
 #endif
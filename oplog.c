@@ -0,0 +1,309 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jbod.h"
+#include "oplog.h"
+
+/* The ring is the bounded queue of Vyukov: a slot holding the record of
+ * position |pos| has |seq| pos + 1 once it is filled in, and gets pos +
+ * capacity back once the writer is done with it, which is what the producer
+ * |capacity| positions later waits for. */
+typedef struct {
+  uint64_t seq;
+  oplog_record_t rec;
+} slot_t;
+
+#define OPLOG_BATCH 256                                   //records the writer formats or copies per write
+#define OPLOG_PERIOD_NS 1000000                           //how long the writer sleeps when the ring is empty
+
+static slot_t *ring;
+static uint64_t mask;
+static uint64_t head;                                     //next position to claim, shared by the producers
+static uint64_t tail;                                     //next position to write, only the writer's
+static uint64_t dropped;
+static uint64_t dropped_logged;                           //part of |dropped| already noted in the log
+static uint64_t start_mono;
+static int running;
+static int stopping;
+static int out_fd;
+static bool out_text;
+static pthread_t writer;
+
+static const char *cmd_names[JBOD_NUM_CMDS] = {
+  [JBOD_MOUNT] = "MOUNT",
+  [JBOD_UNMOUNT] = "UNMOUNT",
+  [JBOD_SEEK_TO_DISK] = "SEEK_TO_DISK",
+  [JBOD_SEEK_TO_BLOCK] = "SEEK_TO_BLOCK",
+  [JBOD_READ_BLOCK] = "READ_BLOCK",
+  [JBOD_WRITE_PERMISSION] = "WRITE_PERMISSION",
+  [JBOD_REVOKE_WRITE_PERMISSION] = "REVOKE_WRITE_PERMISSION",
+  [JBOD_WRITE_BLOCK] = "WRITE_BLOCK",
+  [JBOD_SIGN_BLOCK] = "SIGN_BLOCK",
+};
+
+static uint64_t clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Writes the |len| bytes at |buf| to the log file, giving up on errors: the
+ * log must never stop the server. */
+static void write_all(const void *buf, size_t len) {
+  const char *p = buf;
+
+  while (len > 0) {
+    ssize_t n = write(out_fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    p += n;
+    len -= n;
+  }
+}
+
+/* Writes |n| records, formatted if the log is text. */
+static void write_records(const oplog_record_t *recs, int n) {
+  char text[OPLOG_BATCH * 96];
+  size_t len = 0;
+
+  if (!out_text) {
+    write_all(recs, n * sizeof(*recs));
+    return;
+  }
+  for (int i = 0; i < n; i += oplog_span(&recs[i])) {
+    oplog_format(&recs[i], text + len, sizeof(text) - len - 1);
+    len += strlen(text + len);
+    text[len++] = '\n';
+  }
+  write_all(text, len);
+}
+
+/* Moves what the producers have recorded so far to the log file. Returns
+ * the number of records written. */
+static int drain(void) {
+  oplog_record_t batch[OPLOG_BATCH];
+  int n = 0, total = 0;
+
+  for (;;) {
+    uint64_t lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (lost != dropped_logged && n < OPLOG_BATCH) {      //say how many went missing about where they did
+      memset(&batch[n], 0, sizeof(batch[n]));
+      batch[n].cmd = OPLOG_DROPPED;
+      batch[n++].ns = lost - dropped_logged;
+      dropped_logged = lost;
+    }
+    while (n < OPLOG_BATCH) {
+      slot_t *s = &ring[tail & mask];
+      if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+        break;                                            //not filled in yet
+      }
+      int span = oplog_span(&s->rec);                     //the rest of it was filled in first
+      if (n + span > OPLOG_BATCH) {
+        break;                                            //left for the next batch, whole
+      }
+      for (int i = 0; i < span; i++) {
+        s = &ring[tail & mask];
+        batch[n++] = s->rec;
+        __atomic_store_n(&s->seq, tail + mask + 1, __ATOMIC_RELEASE);  //free for the next round
+        tail++;
+      }
+    }
+    if (n == 0) {
+      return total;
+    }
+    write_records(batch, n);
+    total += n;
+    n = 0;
+  }
+}
+
+static void *writer_thread(void *arg) {
+  struct timespec period = { 0, OPLOG_PERIOD_NS };
+
+  (void)arg;
+  while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+    if (drain() == 0) {
+      nanosleep(&period, NULL);
+    }
+  }
+  drain();                                                //what came in before stopping
+  return NULL;
+}
+
+int oplog_start(int fd, bool text, size_t capacity) {
+  size_t size = 1;
+
+  if (ring != NULL) {
+    return -1;
+  }
+  while (size < capacity) {
+    size <<= 1;
+  }
+  ring = calloc(size, sizeof(*ring));
+  if (ring == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < size; i++) {
+    ring[i].seq = i;                                      //free for the producer of position i
+  }
+  mask = size - 1;
+  head = tail = dropped = dropped_logged = 0;
+  out_fd = fd;
+  out_text = text;
+  stopping = 0;
+  start_mono = clock_ns(CLOCK_MONOTONIC);
+
+  if (!text) {
+    oplog_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, OPLOG_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(oplog_record_t);
+    header.start_ns = clock_ns(CLOCK_REALTIME);
+    write_all(&header, sizeof(header));
+  }
+  if (pthread_create(&writer, NULL, writer_thread, NULL) != 0) {
+    free(ring);
+    ring = NULL;
+    return -1;
+  }
+  __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void oplog_stop(void) {
+  if (ring == NULL) {
+    return;
+  }
+  __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(writer, NULL);
+  free(ring);
+  ring = NULL;
+}
+
+/* Claims |n| slots in a row. Returns the position of the first, or -1 if
+ * the ring has no room for them, which counts as one record dropped. The
+ * writer frees slots in order, so once the last of them is free, so are the
+ * others. */
+static int64_t claim(int n) {
+  uint64_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+
+  if ((uint64_t)n > mask + 1) {
+    __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+  for (;;) {
+    slot_t *s = &ring[(pos + n - 1) & mask];
+    int64_t diff = (int64_t)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - (pos + n - 1));
+    if (diff == 0) {                                      //free: try to claim them
+      if (__atomic_compare_exchange_n(&head, &pos, pos + n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return pos;
+      }
+    } else if (diff < 0) {                                //still a round behind: full
+      __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+      return -1;
+    } else {                                              //another producer got them first
+      pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+void oplog_record(int client, int cmd, int disk, int block, int result) {
+  int64_t pos;
+  slot_t *s;
+
+  if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE) || (pos = claim(1)) == -1) {
+    return;
+  }
+  s = &ring[pos & mask];
+  s->rec.ns = clock_ns(CLOCK_MONOTONIC) - start_mono;
+  s->rec.client = client;
+  s->rec.cmd = cmd;
+  s->rec.disk = disk < 0 ? OPLOG_UNKNOWN_DISK : disk;
+  s->rec.block = block < 0 ? OPLOG_UNKNOWN_BLOCK : block;
+  s->rec.result = result;
+  s->rec.reserved = 0;
+  __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);  //hand it to the writer
+}
+
+bool oplog_vmessage(const char *fmt, va_list args) {
+  char text[OPLOG_MESSAGE_MAX + 1];
+  int64_t pos;
+  slot_t *s;
+
+  if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  int len = vsnprintf(text, sizeof(text), fmt, args);
+  if (len < 0) {
+    return true;
+  }
+  len = len < OPLOG_MESSAGE_MAX ? len : OPLOG_MESSAGE_MAX;
+  int span = 1 + (len + sizeof(oplog_record_t) - 1) / sizeof(oplog_record_t);
+  if ((pos = claim(span)) == -1) {
+    return true;
+  }
+  for (int i = 1; i < span; i++) {                        //the text, ahead of the record that leads to it
+    s = &ring[(pos + i) & mask];
+    int off = (i - 1) * sizeof(oplog_record_t);
+    memset(&s->rec, 0, sizeof(s->rec));
+    memcpy(&s->rec, text + off, len - off < (int)sizeof(s->rec) ? len - off : (int)sizeof(s->rec));
+    __atomic_store_n(&s->seq, pos + i + 1, __ATOMIC_RELEASE);
+  }
+  s = &ring[pos & mask];
+  memset(&s->rec, 0, sizeof(s->rec));
+  s->rec.ns = clock_ns(CLOCK_MONOTONIC) - start_mono;
+  s->rec.cmd = OPLOG_MESSAGE;
+  s->rec.block = len;
+  __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);  //hand all of it to the writer
+  return true;
+}
+
+int oplog_span(const oplog_record_t *rec) {
+  return rec->cmd == OPLOG_MESSAGE ? 1 + (rec->block + sizeof(*rec) - 1) / sizeof(*rec) : 1;
+}
+
+uint64_t oplog_dropped(void) {
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+void oplog_format(const oplog_record_t *rec, char *buf, size_t size) {
+  char where[32] = "";
+
+  if (rec->cmd == OPLOG_DROPPED) {
+    snprintf(buf, size, "%llu records dropped", (unsigned long long)rec->ns);
+    return;
+  }
+  if (rec->cmd == OPLOG_MESSAGE) {
+    snprintf(buf, size, "%llu.%09llu %.*s",
+             (unsigned long long)(rec->ns / 1000000000), (unsigned long long)(rec->ns % 1000000000),
+             rec->block, (const char *)(rec + 1));
+    return;
+  }
+  if (rec->cmd == JBOD_SEEK_TO_DISK) {
+    snprintf(where, sizeof(where), " disk %d", rec->disk);
+  } else if (rec->cmd == JBOD_SEEK_TO_BLOCK || rec->cmd == JBOD_READ_BLOCK
+             || rec->cmd == JBOD_WRITE_BLOCK || rec->cmd == JBOD_SIGN_BLOCK) {
+    if (rec->disk == OPLOG_UNKNOWN_DISK) {
+      snprintf(where, sizeof(where), " disk ? block ?");
+    } else if (rec->block == OPLOG_UNKNOWN_BLOCK) {
+      snprintf(where, sizeof(where), " disk %d block ?", rec->disk);
+    } else {
+      snprintf(where, sizeof(where), " disk %d block %d", rec->disk, rec->block);
+    }
+  }
+  bool known = rec->result > 0 && rec->result < JBOD_NUM_ERRNOS;
+  snprintf(buf, size, "%llu.%09llu client %d: %s%s %s%s%s",
+           (unsigned long long)(rec->ns / 1000000000), (unsigned long long)(rec->ns % 1000000000),
+           rec->client, rec->cmd < JBOD_NUM_CMDS ? cmd_names[rec->cmd] : "ILLEGAL", where,
+           rec->result == 0 ? "ok" : "failed", known ? ": " : "", known ? jbod_error_string(rec->result) : "");
+}
@@ -0,0 +1,76 @@
+#ifndef OPLOG_H_
+#define OPLOG_H_
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Log of the JBOD operations a server carries out, cheap enough to leave on.
+ * Recording an operation only claims a slot of a lock-free ring and fills in
+ * a fixed-size record; a background thread drains the ring to a file, either
+ * as the records themselves, for oplog_decode to turn into text later, or
+ * formatted as text. Memory stays bounded: when the writer falls behind and
+ * the ring fills up, new records are dropped and counted, and the log notes
+ * how many went missing where. */
+
+#define OPLOG_MAGIC "JBODLOG2"
+#define OPLOG_DEFAULT_CAPACITY 65536    /* records the ring holds, a power of two */
+#define OPLOG_DROPPED 0xff              /* cmd of the record that stands for dropped ones */
+#define OPLOG_MESSAGE 0xfe              /* cmd of a record followed by the text of a message */
+#define OPLOG_MESSAGE_MAX 128           /* longest text of a message, longer ones are cut */
+#define OPLOG_UNKNOWN_DISK 0xff         /* disk of a head position not known */
+#define OPLOG_UNKNOWN_BLOCK 0xffff      /* block of a head position not known, past any real one */
+
+/* One operation. For OPLOG_DROPPED, |ns| is the number of records dropped
+ * since the previous such record instead. For OPLOG_MESSAGE, |block| is the
+ * length of the text, which fills the records that follow it, 16 bytes to
+ * each, without a terminating NUL. */
+typedef struct {
+  uint64_t ns;          /* nanoseconds since oplog_start */
+  uint16_t client;      /* socket of the client the operation came from */
+  uint8_t cmd;          /* a jbod_cmd_t, or OPLOG_DROPPED */
+  uint8_t disk;         /* the disk and block it applied to */
+  uint16_t block;       /* wider than a block number, so that every one of them is told from unknown */
+  int8_t result;        /* 0 on success, else the jbod_error_t it failed with, or -1 if not known */
+  uint8_t reserved;
+} oplog_record_t;
+
+/* Start of a binary log, followed by records up to the end of the file. */
+typedef struct {
+  char magic[8];        /* OPLOG_MAGIC, without its terminating NUL */
+  uint32_t record_size; /* sizeof(oplog_record_t), also tells the byte order apart */
+  uint32_t reserved;
+  uint64_t start_ns;    /* wall clock time of oplog_start, in nanoseconds since the epoch */
+} oplog_header_t;
+
+/* Returns 0 on success and -1 on failure. Starts logging to |fd|, in binary
+ * or as text if |text|, through a ring of |capacity| records, which is
+ * rounded up to a power of two. Only one log can be running. */
+int oplog_start(int fd, bool text, size_t capacity);
+
+/* Drains the ring and stops the log. |fd| stays open. */
+void oplog_stop(void);
+
+/* Records operation |cmd| from |client| on |disk| and |block| (-1 for a
+ * head position not known), which ended with |result| as described in
+ * oplog_record_t. Does nothing unless the log is running. Safe to call
+ * from any number of threads. */
+void oplog_record(int client, int cmd, int disk, int block, int result);
+
+/* Records the message |fmt| formats with |args|, as one line of the log.
+ * Returns false, doing nothing, unless the log is running. Safe to call from
+ * any number of threads. */
+bool oplog_vmessage(const char *fmt, va_list args);
+
+/* Returns the number of records dropped so far because the ring was full. */
+uint64_t oplog_dropped(void);
+
+/* Returns the number of records |rec| takes up, itself included. */
+int oplog_span(const oplog_record_t *rec);
+
+/* Formats |rec|, followed by the rest of its span, into |buf| of |size|
+ * bytes as a line of text, without the newline. */
+void oplog_format(const oplog_record_t *rec, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "oplog.h"
+
+/* Turns a binary operation log written by server -l into text, a line per
+ * operation, the way server -v prints them as they happen. Times are in
+ * seconds since the log started, which the first line gives. */
+
+#define OPLOG_DECODE_ARGUMENTS "h"
+#define USAGE                                                           \
+  "USAGE: oplog_decode [-h] log-file\n"                                 \
+  "\n"                                                                  \
+  "where:\n"                                                            \
+  "    -h - help mode (display this message)\n"                         \
+  "\n"
+
+int main(int argc, char *argv[]) {
+  int ch;
+  unsigned long long num_records = 0, num_messages = 0, num_dropped = 0;
+  oplog_header_t header;
+  oplog_record_t rec[1 + OPLOG_MESSAGE_MAX / sizeof(oplog_record_t)];
+  char line[256], when[64];
+  FILE *in;
+
+  while ((ch = getopt(argc, argv, OPLOG_DECODE_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+  if (argc - optind != 1) {
+    fprintf(stderr, USAGE);
+    return -1;
+  }
+
+  in = fopen(argv[optind], "r");
+  if (!in)
+    err(1, "Cannot open %s", argv[optind]);
+  if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, OPLOG_MAGIC, sizeof(header.magic) - 1) != 0)
+    errx(1, "%s is not an operation log", argv[optind]);
+  if (header.magic[sizeof(header.magic) - 1] != OPLOG_MAGIC[sizeof(header.magic) - 1])
+    errx(1, "%s is a log of version %c, expected %c", argv[optind],
+         header.magic[sizeof(header.magic) - 1], OPLOG_MAGIC[sizeof(header.magic) - 1]);
+  if (header.record_size != sizeof(oplog_record_t))
+    errx(1, "%s has records of %u bytes, expected %zu", argv[optind], header.record_size, sizeof(oplog_record_t));
+
+  time_t start = header.start_ns / 1000000000;
+  strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S %z", localtime(&start));
+  printf("log started %s\n", when);
+  while (fread(&rec[0], sizeof(rec[0]), 1, in) == 1) {
+    int span = oplog_span(&rec[0]);
+    if (span > (int)(sizeof(rec) / sizeof(rec[0])) || fread(&rec[1], sizeof(rec[0]), span - 1, in) != (size_t)span - 1)
+      errx(1, "%s has a broken message", argv[optind]);
+    oplog_format(&rec[0], line, sizeof(line));
+    printf("%s\n", line);
+    if (rec[0].cmd == OPLOG_DROPPED)
+      num_dropped += rec[0].ns;
+    else if (rec[0].cmd == OPLOG_MESSAGE)
+      num_messages++;
+    else
+      num_records++;
+  }
+  if (ferror(in))
+    err(1, "Cannot read %s", argv[optind]);
+  fclose(in);
+
+  fprintf(stderr, "%llu operations, %llu messages, %llu dropped\n", num_records, num_messages, num_dropped);
+  return 0;
+}
@@ -0,0 +1,482 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <err.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/random.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "jbod.h"
+#include "net.h"
+#include "oplog.h"
+#include "server.h"
+#include "tester.h"
+#include "util.h"
+
+#define SERVER_ARGUMENTS "hp:vl:dk"
+#define USAGE                                                   \
+  "USAGE: server [-h] [-p port] [-v] [-l log-file] [-d] [-k]\n" \
+  "\n"                                                          \
+  "where:\n"                                                    \
+  "    -h - help mode (display this message)\n"                 \
+  "    -p - port to listen on (default 3333)\n"                 \
+  "    -v - log every JBOD operation to stderr\n"               \
+  "    -l - log every JBOD operation to this file in binary, for\n" \
+  "         oplog_decode to read\n"                             \
+  "    -d - also log the messages of the JBOD device itself, to\n" \
+  "         the -v or -l log; alone, it works as -v with them\n" \
+  "    -k - keep the device mounted, so the disks keep what was\n" \
+  "         written to them between clients\n"                    \
+  "\n"
+
+/* In-tree JBOD server on top of jbod.o. It speaks the same protocol as the
+ * prebuilt jbod_server, plus the vectored commands of net.h, which it carries
+ * out as seeks and single-block operations on jbod_operation.
+ *
+ * Every client gets its own thread. jbod.o is one device with one head, so
+ * the operations themselves run one at a time under jbod_lock, while reading
+ * requests and writing responses runs in parallel. Each connection remembers
+ * where its own seeks left the head and the server seeks back there before
+ * a read or write if another client moved it in between. Mounting and write
+ * permission are shared: the device is only mounted by the first client to
+ * ask and only unmounted once the last one lets go, or never with -k.
+ *
+ * Mounting wipes the device. The mount epoch of JBOD_EXT_EPOCH starts at a
+ * random number, so epochs of different runs of the server do not repeat,
+ * and goes up with every mount and write.
+ *
+ * SIGINT and SIGTERM stop the server once the operation under way is done,
+ * after the operation log has written out all it holds. */
+
+typedef struct {
+  int sd;
+  int head_disk;                                        //where this client's seeks put the head, -1 if unknown
+  int head_block;
+  bool mounted;                                         //this client holds a mount reference
+  bool writable;                                        //this client holds a write permission reference
+  uint8_t payload[JBOD_EXT_MAX_BLOCKS * JBOD_BLOCK_SIZE];  //room for the largest vectored transfer
+} connection_t;
+
+static pthread_mutex_t jbod_lock = PTHREAD_MUTEX_INITIALIZER;
+static int num_connections = 0;
+static int mount_refs = 0;
+static int write_refs = 0;
+static uint64_t epoch;                                  //the mount epoch, see net.h
+
+/* where the operations run so far left the JBOD head, -1 if unknown */
+static int head_disk = -1;
+static int head_block = -1;
+
+static volatile sig_atomic_t stop_signal = 0;          //set by SIGINT and SIGTERM
+
+static __thread int client_sd = -1;                     //of the connection the thread serves, for the log
+
+/* reads exactly len bytes from fd; returns false on error or end of file */
+static bool read_full(int fd, uint8_t *buf, int len) {
+  for (int i = 0, n; i < len; i += n) {
+    n = read(fd, buf + i, len - i);
+    if (n <= 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* writes the response header and len bytes of payload with as few system
+   calls as possible; returns false on error */
+static bool send_response(int sd, uint32_t op, uint8_t infocode, uint8_t *buf, int len) {
+  uint8_t header[HEADER_LEN];
+  uint32_t netop = htonl(op);
+  struct iovec iov[2] = {{header, HEADER_LEN}, {buf, len}};
+  struct iovec *v = iov;
+  int iovcnt = len > 0 ? 2 : 1;
+
+  memcpy(header, &netop, sizeof(netop));
+  header[sizeof(netop)] = infocode;
+  while (iovcnt > 0) {
+    ssize_t n = writev(sd, v, iovcnt);
+    if (n <= 0) {
+      return false;
+    }
+    while (iovcnt > 0 && (size_t)n >= v->iov_len) {     //drop what was fully written
+      n -= v->iov_len;
+      v++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {                                   //and resume inside the rest
+      v->iov_base = (uint8_t *)v->iov_base + n;
+      v->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+static uint32_t encode_op(jbod_cmd_t cmd, int disk_num, int block_num) {
+  return cmd << 12 | disk_num << 8 | block_num;
+}
+
+/* Runs the standard JBOD operation |op| and follows the head through it.
+ * Called with jbod_lock held. */
+static int tracked_operation(uint32_t op, uint8_t *block) {
+  int cmd = JBOD_OP_CMD(op);
+  int disk = cmd == JBOD_READ_BLOCK || cmd == JBOD_WRITE_BLOCK ? head_disk : (int)(op >> 8 & 0xf);
+  int where = cmd == JBOD_READ_BLOCK || cmd == JBOD_WRITE_BLOCK ? head_block : (int)(op & 0xff);
+  if (cmd == JBOD_MOUNT || cmd == JBOD_WRITE_BLOCK) {
+    epoch++;                                            //even if it fails, what the device holds is in doubt
+  }
+  int rc = jbod_operation(op, block);
+  oplog_record(client_sd, cmd, disk, where, rc == 0 ? 0 : jbod_error > 0 ? (int)jbod_error : -1);
+  if (rc != 0) {                                        //a failure may leave the head anywhere
+    head_disk = head_block = -1;
+    return rc;
+  }
+  switch (JBOD_OP_CMD(op)) {
+    case JBOD_SEEK_TO_DISK:
+      head_disk = (op >> 8) & 0xf;
+      head_block = 0;                                   //changing disks rewinds the head
+      break;
+    case JBOD_SEEK_TO_BLOCK:
+      head_block = op & 0xff;
+      break;
+    case JBOD_READ_BLOCK:
+    case JBOD_WRITE_BLOCK:
+      head_block++;
+      break;
+    case JBOD_MOUNT:
+    case JBOD_UNMOUNT:
+    case JBOD_SIGN_BLOCK:
+      head_disk = head_block = -1;
+      break;
+  }
+  return rc;
+}
+
+/* Moves the head back to where |conn| left it, or only to its disk unless
+ * |block_too|, if another client moved it. Called with jbod_lock held.
+ * Returns 0 on success and -1 on failure. */
+static int restore_head(connection_t *conn, bool block_too) {
+  if (conn->head_disk != -1 && head_disk != conn->head_disk
+      && tracked_operation(encode_op(JBOD_SEEK_TO_DISK, conn->head_disk, 0), NULL) != 0) {
+    return -1;
+  }
+  if (block_too && conn->head_block != -1 && head_block != conn->head_block
+      && tracked_operation(encode_op(JBOD_SEEK_TO_BLOCK, 0, conn->head_block), NULL) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/* Runs the head-relative operation |op| (a seek, read or write) for |conn|
+ * and moves the client's head along. Called with jbod_lock held. */
+static int client_operation(connection_t *conn, uint32_t op, uint8_t *block) {
+  jbod_cmd_t cmd = JBOD_OP_CMD(op);
+  int rc;
+
+  if (cmd == JBOD_SEEK_TO_DISK) {
+    rc = tracked_operation(op, block);
+  } else {                                              //a block seek stays on the disk this client chose
+    rc = restore_head(conn, cmd != JBOD_SEEK_TO_BLOCK) == 0 ? tracked_operation(op, block) : -1;
+  }
+  conn->head_disk = head_disk;                          //both -1 after a failure
+  conn->head_block = head_block;
+  return rc;
+}
+
+/* Takes or drops one of the shared |refs| for |conn|, only passing |cmd| on to
+ * the device for the first taker or the last dropper. Mirrors the errors the
+ * device gives for a client mounting twice and the like. Called with
+ * jbod_lock held. */
+static int shared_operation(bool *held, int *refs, bool take, uint32_t op) {
+  if (*held == take) {
+    return -1;
+  }
+  if (*refs == (take ? 0 : 1) && tracked_operation(op, NULL) != 0) {
+    return -1;
+  }
+  *refs += take ? 1 : -1;
+  *held = take;
+  return 0;
+}
+
+/* Carries out the vectored read or write |op| for |conn| on |buf|, seeking to
+ * the first block unless the head is already there and to the start of every
+ * further disk. Called with jbod_lock held. Returns 0 on success and -1 on
+ * failure. */
+static int vectored_operation(connection_t *conn, uint32_t op, uint8_t *buf) {
+  jbod_cmd_t cmd = JBOD_OP_CMD(op) == JBOD_EXT_READ_BLOCKS ? JBOD_READ_BLOCK : JBOD_WRITE_BLOCK;
+  int key = ((op >> 8) & 0xf) * JBOD_NUM_BLOCKS_PER_DISK + (op & 0xff);
+  int count = JBOD_OP_COUNT(op);
+
+  if (count == 0 || key + count > JBOD_EXT_MAX_BLOCKS) {
+    return -1;
+  }
+  for (int i = 0; i < count; i++, key++) {
+    conn->head_disk = key / JBOD_NUM_BLOCKS_PER_DISK;
+    conn->head_block = key % JBOD_NUM_BLOCKS_PER_DISK;
+    if (client_operation(conn, encode_op(cmd, 0, 0), buf + i * JBOD_BLOCK_SIZE) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Runs the request |op| for |conn| on its payload buffer. */
+static int serve_request(connection_t *conn, uint32_t op) {
+  int cmd = JBOD_OP_CMD(op);
+  int rc;
+
+  if (!conn->mounted && cmd != JBOD_MOUNT && cmd != JBOD_EXT_PROBE && cmd != JBOD_EXT_EPOCH) {
+    return -1;                                          //as if the device were unmounted for this client
+  }
+  if (!conn->writable && (cmd == JBOD_WRITE_BLOCK || cmd == JBOD_EXT_WRITE_BLOCKS)) {
+    return -1;                                          //another client's permission does not count
+  }
+
+  pthread_mutex_lock(&jbod_lock);
+  switch (cmd) {
+    case JBOD_EXT_PROBE:
+      rc = 0;
+      break;
+    case JBOD_EXT_EPOCH:
+      memset(conn->payload, 0, JBOD_BLOCK_SIZE);
+      for (int i = 0; i < 8; i++) {                     //network byte order
+        conn->payload[i] = epoch >> (56 - 8 * i);
+      }
+      rc = 0;
+      break;
+    case JBOD_EXT_READ_BLOCKS:
+    case JBOD_EXT_WRITE_BLOCKS:
+      rc = vectored_operation(conn, op, conn->payload);
+      break;
+    case JBOD_MOUNT:
+      rc = shared_operation(&conn->mounted, &mount_refs, true, op);
+      break;
+    case JBOD_UNMOUNT:
+      rc = shared_operation(&conn->mounted, &mount_refs, false, op);
+      break;
+    case JBOD_WRITE_PERMISSION:
+      rc = shared_operation(&conn->writable, &write_refs, true, op);
+      break;
+    case JBOD_REVOKE_WRITE_PERMISSION:
+      rc = shared_operation(&conn->writable, &write_refs, false, op);
+      break;
+    case JBOD_SEEK_TO_DISK:
+    case JBOD_SEEK_TO_BLOCK:
+    case JBOD_READ_BLOCK:
+    case JBOD_WRITE_BLOCK:
+      rc = client_operation(conn, op, conn->payload);
+      break;
+    default:                                            //signing and bad commands do not involve the head
+      rc = tracked_operation(op, conn->payload);
+      break;
+  }
+  pthread_mutex_unlock(&jbod_lock);
+  return rc;
+}
+
+/* Gives up whatever mount and write permission |conn| still holds, so a
+ * client that goes away does not keep the device mounted for good. */
+static void release_connection(connection_t *conn) {
+  pthread_mutex_lock(&jbod_lock);
+  if (conn->writable) {
+    shared_operation(&conn->writable, &write_refs, false, encode_op(JBOD_REVOKE_WRITE_PERMISSION, 0, 0));
+  }
+  if (conn->mounted) {
+    shared_operation(&conn->mounted, &mount_refs, false, encode_op(JBOD_UNMOUNT, 0, 0));
+  }
+  if (--num_connections == 0) {                         //report once the device goes idle
+    jbod_print_cost();
+  }
+  pthread_mutex_unlock(&jbod_lock);
+}
+
+static bool serve_requests(connection_t *conn) {
+  uint8_t header[HEADER_LEN];
+  uint32_t op;
+
+  while (read_full(conn->sd, header, HEADER_LEN)) {
+    int cmd, in_len = 0, out_len = 0;
+    uint8_t infocode = 0;
+
+    memcpy(&op, header, sizeof(op));
+    op = ntohl(op);
+    cmd = JBOD_OP_CMD(op);
+    if (header[sizeof(op)] & 2) {                       //a single block follows
+      in_len = JBOD_BLOCK_SIZE;
+    } else if (header[sizeof(op)] & 4) {                //a vectored write's blocks follow
+      if (JBOD_OP_COUNT(op) > JBOD_EXT_MAX_BLOCKS) {
+        return false;
+      }
+      in_len = JBOD_OP_COUNT(op) * JBOD_BLOCK_SIZE;
+    }
+    if (in_len > 0 && !read_full(conn->sd, conn->payload, in_len)) {
+      return false;
+    }
+
+    if (serve_request(conn, op) != 0) {
+      infocode = 1;
+    } else if (cmd == JBOD_READ_BLOCK || cmd == JBOD_SIGN_BLOCK || cmd == JBOD_EXT_EPOCH) {
+      infocode = 2;
+      out_len = JBOD_BLOCK_SIZE;
+    } else if (cmd == JBOD_EXT_READ_BLOCKS) {
+      infocode = 4;
+      out_len = JBOD_OP_COUNT(op) * JBOD_BLOCK_SIZE;
+    }
+
+    if (!send_response(conn->sd, op, infocode, conn->payload, out_len)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool serve_connection(int sd) {
+  connection_t *conn = malloc(sizeof(connection_t));
+  bool ok;
+
+  if (conn == NULL) {
+    return false;
+  }
+  conn->sd = sd;
+  client_sd = sd;
+  conn->head_disk = conn->head_block = -1;
+  conn->mounted = conn->writable = false;
+  pthread_mutex_lock(&jbod_lock);
+  num_connections++;
+  pthread_mutex_unlock(&jbod_lock);
+
+  ok = serve_requests(conn);
+  release_connection(conn);
+  free(conn);
+  return ok;
+}
+
+int server_listen(uint16_t port) {
+  struct sockaddr_in addr;
+  int one = 1;
+  int sd = socket(AF_INET, SOCK_STREAM, 0);
+
+  if (sd == -1) {
+    return -1;
+  }
+  setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(sd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sd, SOMAXCONN) != 0) {
+    close(sd);
+    return -1;
+  }
+  return sd;
+}
+
+static void *client_thread(void *arg) {
+  int sd = (intptr_t)arg;
+  serve_connection(sd);
+  close(sd);
+  return NULL;
+}
+
+static void stop_handler(int signo) {
+  stop_signal = signo;
+}
+
+int main(int argc, char *argv[]) {
+  int ch, port = JBOD_PORT, log_fd;
+  bool keep_mounted = false, device_messages = false;
+  sigset_t stop_signals, waiting_mask;
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));                           //only seen while waiting for clients, which
+  sa.sa_handler = stop_handler;                         //every other thread inherits blocked
+  sigemptyset(&sa.sa_mask);
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, &waiting_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  while ((ch = getopt(argc, argv, SERVER_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'v':
+        if (oplog_start(STDERR_FILENO, true, OPLOG_DEFAULT_CAPACITY) == -1)
+          errx(1, "Cannot start the operation log");
+        break;
+      case 'l':
+        log_fd = open(optarg, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (log_fd == -1)
+          err(1, "Cannot create log file %s", optarg);
+        if (oplog_start(log_fd, false, OPLOG_DEFAULT_CAPACITY) == -1)
+          errx(1, "Cannot start the operation log");
+        break;
+      case 'd':
+        device_messages = true;
+        break;
+      case 'k':
+        keep_mounted = true;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+
+  if (device_messages)                                  //after -v and -l, whichever log they started
+    enable_debug_log();
+  if (getrandom(&epoch, sizeof(epoch), 0) != sizeof(epoch))
+    epoch = (uint64_t)time(NULL) << 32 ^ getpid();
+  if (keep_mounted) {                                   //a reference no client can drop
+    if (tracked_operation(encode_op(JBOD_MOUNT, 0, 0), NULL) != 0)
+      errx(1, "Cannot mount the device");
+    mount_refs = 1;
+  }
+
+  int sd = server_listen(port);
+  if (sd == -1)
+    err(1, "Cannot listen on port %d", port);
+
+  while (!stop_signal) {
+    int one = 1;
+    pthread_t thread;
+    fd_set listening;
+    FD_ZERO(&listening);
+    FD_SET(sd, &listening);
+    if (pselect(sd + 1, &listening, NULL, NULL, NULL, &waiting_mask) != 1)  //a stop signal can only land in here
+      continue;
+    intptr_t cli = accept(sd, NULL, NULL);
+    if (cli == -1)
+      continue;
+    setsockopt(cli, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (pthread_create(&thread, NULL, client_thread, (void *)cli) != 0) {
+      close(cli);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  close(sd);
+  pthread_mutex_lock(&jbod_lock);                       //held to the end, so no operation is left to log
+  oplog_stop();
+  return 0;
+}
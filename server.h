@@ -0,0 +1,17 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Returns a socket listening on |port| on all interfaces, or -1 on failure. */
+int server_listen(uint16_t port);
+
+/* Serves JBOD requests, including the vectored extension described in net.h,
+ * on the connected socket |sd| until the client disconnects, then gives up the
+ * client's mount and write permission. Safe to call from several threads at
+ * once, one per client. Returns true if the client closed the connection
+ * cleanly and false on a protocol or socket error. Does not close |sd|. */
+bool serve_connection(int sd);
+
+#endif
@@ -0,0 +1,238 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+__thread stats_block_t *stats_local;
+
+static stats_block_t *blocks;                             //pushed onto, never removed from
+static stats_block_t spare;                               //shared by threads when memory runs out
+static pthread_key_t release_key;
+static pthread_once_t release_once = PTHREAD_ONCE_INIT;
+static volatile int signal_fd = -1;
+
+static const struct {
+  const char *name;
+  const char *help;
+} counter_info[STATS_NUM_COUNTERS] = {
+  [STATS_CACHE_HITS] = { "jbod_cache_hits_total", "Cache lookups that found the block." },
+  [STATS_CACHE_MISSES] = { "jbod_cache_misses_total", "Cache lookups that did not find the block." },
+  [STATS_CACHE_EVICTIONS] = { "jbod_cache_evictions_total", "Blocks evicted from the cache to make room." },
+  [STATS_SECOND_TIER_HITS] = { "jbod_cache_second_tier_hits_total", "Memory misses found in the second tier of the cache." },
+  [STATS_SECOND_TIER_MISSES] = { "jbod_cache_second_tier_misses_total", "Memory misses not found in the second tier either." },
+  [STATS_SECOND_TIER_ADMITTED] = { "jbod_cache_second_tier_admitted_total", "Evicted blocks the second tier took in." },
+  [STATS_SEEKS_ISSUED] = { "jbod_seeks_issued_total", "Disk and block seeks sent to the server." },
+  [STATS_SEEKS_ELIDED] = { "jbod_seeks_elided_total", "Seeks left out because the head was already in place." },
+  [STATS_ROUND_TRIPS] = { "jbod_round_trips_total", "Times the client waited for the server to answer." },
+  [STATS_BYTES_SENT] = { "jbod_bytes_sent_total", "Headers and blocks written to the server." },
+  [STATS_BYTES_RECEIVED] = { "jbod_bytes_received_total", "Headers and blocks read from the server." },
+  [STATS_READ_CALLS] = { "jbod_read_syscalls_total", "read system calls made on server connections." },
+  [STATS_WRITE_CALLS] = { "jbod_write_syscalls_total", "write and writev system calls made on server connections." },
+};
+
+static const struct {
+  const char *name;
+  const char *help;
+} histogram_info[STATS_NUM_HISTOGRAMS] = {
+  [STATS_ROUND_TRIP_NS] = { "jbod_round_trip_nanoseconds", "Time from sending requests to having all the responses." },
+  [STATS_CACHE_HIT_NS] = { "jbod_cache_hit_nanoseconds", "Time to serve a lookup from memory, in caches with a second tier." },
+  [STATS_SECOND_TIER_HIT_NS] = { "jbod_cache_second_tier_hit_nanoseconds", "Time to serve a lookup from the second tier." },
+};
+
+/* Gives the block of an exiting thread back. */
+static void release(void *block) {
+  __atomic_store_n(&((stats_block_t *)block)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void make_release_key(void) {
+  pthread_key_create(&release_key, release);
+}
+
+stats_block_t *stats_attach(void) {
+  stats_block_t *b;
+
+  pthread_once(&release_once, make_release_key);
+  for (b = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {  //reuse the block of a thread gone
+    int free = 0;
+    if (__atomic_compare_exchange_n(&b->in_use, &free, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  if (b == NULL) {
+    b = calloc(1, sizeof(*b));
+    if (b == NULL) {                                      //counts get racy rather than lost
+      stats_local = &spare;
+      return &spare;
+    }
+    b->in_use = 1;
+    b->next = __atomic_load_n(&blocks, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&blocks, &b->next, b, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+  pthread_setspecific(release_key, b);
+  stats_local = b;
+  return b;
+}
+
+/* Loops |b| over every block, the spare one included. */
+#define FOR_EACH_BLOCK(b) \
+  for (const stats_block_t *b = &spare; b != NULL; b = b == &spare ? __atomic_load_n(&blocks, __ATOMIC_ACQUIRE) : b->next)
+
+uint64_t stats_total(stats_counter_t c) {
+  uint64_t total = 0;
+
+  FOR_EACH_BLOCK(b) {
+    total += __atomic_load_n(&b->counters[c], __ATOMIC_RELAXED);
+  }
+  return total;
+}
+
+void stats_histogram_total(stats_histogram_t which, histogram_t *h) {
+  histogram_init(h);
+  FOR_EACH_BLOCK(b) {
+    histogram_merge(h, &b->histograms[which]);
+  }
+}
+
+/* Output of stats_dump, built without stdio so it works in signal handlers. */
+typedef struct {
+  int fd;
+  int failed;
+  size_t len;
+  char buf[4096];
+} dump_t;
+
+static void flush(dump_t *d) {
+  size_t done = 0;
+
+  while (done < d->len && !d->failed) {
+    ssize_t n = write(d->fd, d->buf + done, d->len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      d->failed = 1;
+    } else {
+      done += n;
+    }
+  }
+  d->len = 0;
+}
+
+static void put(dump_t *d, const char *s) {
+  for (; *s != '\0'; s++) {
+    if (d->len == sizeof(d->buf)) {
+      flush(d);
+    }
+    d->buf[d->len++] = *s;
+  }
+}
+
+static void put_u64(dump_t *d, uint64_t v) {
+  char digits[21];
+  int i = sizeof(digits) - 1;
+
+  digits[i] = '\0';
+  do {
+    digits[--i] = '0' + v % 10;
+    v /= 10;
+  } while (v != 0);
+  put(d, digits + i);
+}
+
+static void put_header(dump_t *d, const char *name, const char *help, const char *type) {
+  put(d, "# HELP ");
+  put(d, name);
+  put(d, " ");
+  put(d, help);
+  put(d, "\n# TYPE ");
+  put(d, name);
+  put(d, " ");
+  put(d, type);
+  put(d, "\n");
+}
+
+/* Writes histogram |h| of all threads as cumulative buckets, only those
+ * where the count goes up. */
+static void put_histogram(dump_t *d, stats_histogram_t h) {
+  const char *name = histogram_info[h].name;
+  uint64_t seen = 0, sum = 0;
+
+  put_header(d, name, histogram_info[h].help, "histogram");
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    uint64_t n = 0;
+    FOR_EACH_BLOCK(b) {
+      n += b->histograms[h].buckets[i];
+    }
+    if (n == 0) {
+      continue;
+    }
+    seen += n;
+    put(d, name);
+    put(d, "_bucket{le=\"");
+    put_u64(d, histogram_bucket_high(i));
+    put(d, "\"} ");
+    put_u64(d, seen);
+    put(d, "\n");
+  }
+  FOR_EACH_BLOCK(b) {
+    sum += b->histograms[h].sum;
+  }
+  put(d, name);
+  put(d, "_bucket{le=\"+Inf\"} ");
+  put_u64(d, seen);
+  put(d, "\n");
+  put(d, name);
+  put(d, "_sum ");
+  put_u64(d, sum);
+  put(d, "\n");
+  put(d, name);
+  put(d, "_count ");
+  put_u64(d, seen);
+  put(d, "\n");
+}
+
+int stats_dump(int fd) {
+  dump_t d;
+
+  d.fd = fd;
+  d.failed = 0;
+  d.len = 0;
+  for (int c = 0; c < STATS_NUM_COUNTERS; c++) {
+    put_header(&d, counter_info[c].name, counter_info[c].help, "counter");
+    put(&d, counter_info[c].name);
+    put(&d, " ");
+    put_u64(&d, stats_total(c));
+    put(&d, "\n");
+  }
+  for (int h = 0; h < STATS_NUM_HISTOGRAMS; h++) {
+    put_histogram(&d, h);
+  }
+  flush(&d);
+  return d.failed ? -1 : 0;
+}
+
+static void dump_handler(int signo) {
+  int saved = errno;                                      //the interrupted code may be about to look at it
+
+  (void)signo;
+  stats_dump(signal_fd);
+  errno = saved;
+}
+
+int stats_dump_on_signal(int signo, int fd) {
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = dump_handler;
+  sa.sa_flags = SA_RESTART;                               //so socket reads and writes carry on
+  sigemptyset(&sa.sa_mask);
+  signal_fd = fd;
+  return sigaction(signo, &sa, NULL) == -1 ? -1 : 0;
+}
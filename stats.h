@@ -0,0 +1,80 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+/* Counters and histograms of what the client does, cheap enough for the hot
+ * paths. Every thread updates a block of its own, so an update is a plain
+ * add with no lock and no shared cache line; readers sum the blocks of all
+ * threads, and a total may miss updates made while it is computed. Blocks
+ * outlive their threads and are handed to new ones, so totals never go down.
+ * The totals can be dumped at any time in the Prometheus text format, from
+ * code or from a signal handler. */
+
+typedef enum {
+  STATS_CACHE_HITS,
+  STATS_CACHE_MISSES,
+  STATS_CACHE_EVICTIONS,
+  STATS_SECOND_TIER_HITS,   /* memory misses the second tier of a cache had */
+  STATS_SECOND_TIER_MISSES,
+  STATS_SECOND_TIER_ADMITTED,  /* evicted blocks the second tier took in */
+  STATS_SEEKS_ISSUED,
+  STATS_SEEKS_ELIDED,   /* seeks left out because the head was already there */
+  STATS_ROUND_TRIPS,
+  STATS_BYTES_SENT,
+  STATS_BYTES_RECEIVED,
+  STATS_READ_CALLS,     /* read system calls made by nread */
+  STATS_WRITE_CALLS,    /* write and writev system calls made by nwrite and nwritev */
+  STATS_NUM_COUNTERS,
+} stats_counter_t;
+
+typedef enum {
+  STATS_ROUND_TRIP_NS,  /* from sending requests to having all the responses */
+  STATS_CACHE_HIT_NS,   /* lookups served from memory, timed if the cache has a second tier */
+  STATS_SECOND_TIER_HIT_NS,  /* lookups served from the second tier, bringing the block to memory */
+  STATS_NUM_HISTOGRAMS,
+} stats_histogram_t;
+
+/* The counters and histograms of one thread. */
+typedef struct stats_block {
+  uint64_t counters[STATS_NUM_COUNTERS];
+  histogram_t histograms[STATS_NUM_HISTOGRAMS];
+  struct stats_block *next;             /* all blocks ever made, newest first */
+  int in_use;                           /* whether a thread owns it */
+} stats_block_t;
+
+extern __thread stats_block_t *stats_local;
+
+/* Returns the block of the calling thread, giving it one on first use. */
+stats_block_t *stats_attach(void);
+
+/* Adds |n| to counter |c|. Inline, as it sits in the hot paths. */
+static inline void stats_add(stats_counter_t c, uint64_t n) {
+  stats_block_t *b = stats_local != NULL ? stats_local : stats_attach();
+  __atomic_store_n(&b->counters[c], b->counters[c] + n, __ATOMIC_RELAXED);  /* only this thread writes it */
+}
+
+/* Counts |value| in histogram |h|. */
+static inline void stats_record(stats_histogram_t h, uint64_t value) {
+  stats_block_t *b = stats_local != NULL ? stats_local : stats_attach();
+  histogram_record(&b->histograms[h], value);
+}
+
+/* Returns the total of counter |c| over all threads. */
+uint64_t stats_total(stats_counter_t c);
+
+/* Fills |h| with the total of histogram |which| over all threads. */
+void stats_histogram_total(stats_histogram_t which, histogram_t *h);
+
+/* Returns 0 on success and -1 on failure. Writes every counter and histogram
+ * to |fd| in the Prometheus text format. Safe to call from a signal
+ * handler. */
+int stats_dump(int fd);
+
+/* Returns 0 on success and -1 on failure. Makes signal |signo| dump the
+ * stats to |fd|. */
+int stats_dump_on_signal(int signo, int fd);
+
+#endif
@@ -10,28 +10,76 @@
 #include <fcntl.h>
 #include <err.h>
 #include <assert.h>
+#include <time.h>
+#include <signal.h>
 
 #include "cache.h"
+#include "histogram.h"
 #include "jbod.h"
 #include "mdadm.h"
+#include "mdadm_queue.h"
 #include "util.h"
 #include "tester.h"
+#include "trace.h"
 #include "net.h"
+#include "stats.h"
 
-#define TESTER_ARGUMENTS "hw:s:"
-#define USAGE                                               \
-  "USAGE: test [-h] [-w workload-file] [-s cache_size] \n"  \
-  "\n"                                                      \
-  "where:\n"                                                \
-  "    -h - help mode (display this message)\n"             \
-  "\n"                                                      \
+#define TESTER_ARGUMENTS "hw:s:p:WRu:c:q:b:M:S:m:T:a:z:"
+#define USAGE                                                               \
+  "USAGE: test [-h] [-w workload-file] [-s cache_size] [-p cache_policy] [-W] [-R]\n" \
+  "            [-u stripe_unit] [-c connections] [-q queue_depth] [-b report-file]\n" \
+  "            [-M metrics-file] [-S snapshot-file] [-m shared-cache]\n"  \
+  "            [-T second-tier-file] [-a admission] [-z slots]\n"      \
+  "\n"                                                                      \
+  "where:\n"                                                                \
+  "    -h - help mode (display this message)\n"                             \
+  "    -p - cache replacement policy: lru (default), clock, 2q or arc\n"     \
+  "    -W - write-back cache (default is write-through)\n"                  \
+  "    -R - no readahead of sequential reads into the cache\n"             \
+  "    -u - stripe the disks in units of this many bytes (default linear)\n" \
+  "    -c - spread requests over this many connections (default 1), which\n" \
+  "         needs a server taking several clients, such as ./server\n"     \
+  "    -q - keep up to this many reads and writes in flight (default 1)\n"  \
+  "    -b - benchmark mode: time every command and write a JSON report of\n" \
+  "         latencies per command, JBOD cost, round trips and bytes to this file\n" \
+  "    -M - write the client stats to this file at the end, in the Prometheus\n" \
+  "         text format; SIGUSR1 writes them to standard error at any time\n" \
+  "    -S - warm restart: once mounted, fill the cache from this snapshot file\n" \
+  "         if the disks have not changed since it was saved, which needs\n" \
+  "         ./server, and save the cache to it at the end\n"                \
+  "    -m - share the cache with the other clients on this host naming the same\n" \
+  "         shared memory segment, such as /jbod; always CLOCK, so not with -p,\n" \
+  "         and write-through\n"                                       \
+  "    -T - keep blocks evicted from the cache in this file, which lookups try\n" \
+  "         before the server; it is removed right away\n"                \
+  "    -a - which evicted blocks -T takes: all (default), or reused, those\n" \
+  "         hit or evicted before\n"                                      \
+  "    -z - compact cache: keep blocks made of a few runs of one byte as the\n" \
+  "         runs, with this many (2 to 4) entries for the memory of each one\n" \
+  "\n"                                                                      \
 
 int run_workload(char *workload, int cache_size);
 
+#define TESTER_MAX_DEPTH 256
+
+static jbod_conn_t lanes[MDADM_MAX_LANES];                  /* connections besides the default one */
+static int num_conns = 1;
+static int queue_depth = 1;                                 /* 1 for synchronous calls */
+static const char *policy_name = "lru";
+static bool write_back = false;
+static const char *report_file = NULL;                      /* benchmark mode if set */
+static const char *metrics_file = NULL;
+static const char *snapshot_file = NULL;
+static const char *second_tier_file = NULL;
+static const char *admission = NULL;
+
+static histogram_t latencies[TRACE_NUM_CMDS];               /* in nanoseconds, per command */
+
 int main(int argc, char *argv[])
 {
   int ch, cache_size = 0;
   char *workload = NULL;
+  bool shared = false, policy_given = false;
 
   while ((ch = getopt(argc, argv, TESTER_ARGUMENTS)) != -1) {
     switch (ch) {
@@ -44,6 +92,73 @@ int main(int argc, char *argv[])
       case 'w':
         workload = optarg;
         break;
+      case 'p':
+        if (cache_set_policy(optarg) != 1) {
+          fprintf(stderr, "Unknown cache policy (%s), aborting.\n", optarg);
+          return -1;
+        }
+        policy_name = optarg;
+        policy_given = true;
+        break;
+      case 'W':
+        cache_set_write_back(true);
+        write_back = true;
+        break;
+      case 'R':
+        mdadm_set_readahead(false);
+        break;
+      case 'u':
+        if (mdadm_set_stripe_unit(atoi(optarg)) != 1) {
+          fprintf(stderr, "Bad stripe unit (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
+      case 'c':
+        num_conns = atoi(optarg);
+        if (num_conns < 1 || num_conns > MDADM_MAX_LANES) {
+          fprintf(stderr, "Connections must be 1 to %d, aborting.\n", MDADM_MAX_LANES);
+          return -1;
+        }
+        break;
+      case 'q':
+        queue_depth = atoi(optarg);
+        if (queue_depth < 1 || queue_depth > TESTER_MAX_DEPTH) {
+          fprintf(stderr, "Queue depth must be 1 to %d, aborting.\n", TESTER_MAX_DEPTH);
+          return -1;
+        }
+        break;
+      case 'b':
+        report_file = optarg;
+        break;
+      case 'M':
+        metrics_file = optarg;
+        break;
+      case 'S':
+        snapshot_file = optarg;
+        break;
+      case 'm':
+        if (cache_set_shared(optarg) != 1) {
+          fprintf(stderr, "Bad shared cache name (%s), aborting.\n", optarg);
+          return -1;
+        }
+        shared = true;
+        break;
+      case 'T':
+        second_tier_file = optarg;
+        break;
+      case 'a':
+        if (strcmp(optarg, "reused") != 0 && strcmp(optarg, "all") != 0) {
+          fprintf(stderr, "Unknown admission policy (%s), aborting.\n", optarg);
+          return -1;
+        }
+        admission = optarg;
+        break;
+      case 'z':
+        if (cache_set_compact(atoi(optarg)) != 1) {
+          fprintf(stderr, "Bad number of compact slots (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
       default:
         fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
         return -1;
@@ -54,20 +169,32 @@ int main(int argc, char *argv[])
     fprintf(stderr, USAGE);
     return -1;
   }
+  if (shared && policy_given) {
+    fprintf(stderr, "A shared cache is always CLOCK, -m cannot go with -p, aborting.\n");
+    return -1;
+  }
+  if (shared)
+    policy_name = "clock";
+  if (second_tier_file)
+    cache_set_second_tier(second_tier_file, admission);
 
+  if (stats_dump_on_signal(SIGUSR1, STDERR_FILENO) == -1)
+    err(1, "Cannot handle SIGUSR1");
   if (!jbod_connect(JBOD_SERVER, JBOD_PORT))
     return -1;
+  for (int i = 1; i < num_conns; i++) {
+    if (!jbod_connect_r(&lanes[i], JBOD_SERVER, JBOD_PORT) || mdadm_add_lane(&lanes[i]) != 1)
+      errx(1, "Cannot open connection %d.", i + 1);
+  }
   
   run_workload(workload, cache_size);
+  for (int i = 1; i < num_conns; i++)
+    jbod_disconnect_r(&lanes[i]);
   jbod_disconnect();
 
   return 0;
 }
 
-int equals(const char *s1, const char *s2) {
-  return strncmp(s1, s2, strlen(s2)) == 0;
-}
-
 static uint32_t encode_op(jbod_cmd_t cmd, int disk_num, int block_num) {
   assert(cmd >= 0 && cmd < JBOD_NUM_CMDS);
   assert(block_num >= 0 && block_num < JBOD_NUM_BLOCKS_PER_DISK);
@@ -80,16 +207,154 @@ static uint32_t encode_op(jbod_cmd_t cmd, int disk_num, int block_num) {
   return op;
 }
 
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t submitted_ns[TESTER_MAX_DEPTH];             /* when each request in flight was submitted */
+static int submitted_cmd[TESTER_MAX_DEPTH];
+static int submitted_tag[TESTER_MAX_DEPTH];                 /* its tag, -1 if the buffer is free */
+
+/* Returns the buffer slot of the request in flight tagged |tag|. */
+static int slot_of(int tag) {
+  int slot = 0;
+
+  while (submitted_tag[slot] != tag)
+    slot++;
+  return slot;
+}
+
+/* Waits for at least |min| requests in flight on |q| to complete, or all of
+ * them if there are fewer, and times them from their submission. Returns how
+ * many completed. */
+static int complete(mdadm_queue_t *q, int min) {
+  mdadm_completion_t cqes[TESTER_MAX_DEPTH];
+  uint64_t now;
+  int n = mdadm_wait(q, cqes, min, TESTER_MAX_DEPTH);
+
+  now = now_ns();
+  for (int i = 0; i < n; i++) {
+    int slot = slot_of(cqes[i].tag);
+    histogram_record(&latencies[submitted_cmd[slot]], now - submitted_ns[slot]);
+    submitted_tag[slot] = -1;
+  }
+  return n;
+}
+
+/* Waits for every read and write in flight on |q|, if any. */
+static void drain(mdadm_queue_t *q) {
+  while (q && complete(q, TESTER_MAX_DEPTH) > 0)
+    ;
+}
+
+/* Writes |h| to |f| as a JSON object: count, mean and percentiles, then the
+ * non-empty buckets as [lowest value, count] pairs. */
+static void write_histogram(FILE *f, const histogram_t *h) {
+  const char *sep = "";
+
+  fprintf(f, "{\"count\": %llu, \"min\": %llu, \"mean\": %.0f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+          "\"p999\": %llu, \"max\": %llu, \"buckets\": [", (unsigned long long)h->count, (unsigned long long)h->min,
+          h->count ? (double)h->sum / h->count : 0.0, (unsigned long long)histogram_percentile(h, 50),
+          (unsigned long long)histogram_percentile(h, 90), (unsigned long long)histogram_percentile(h, 99),
+          (unsigned long long)histogram_percentile(h, 99.9), (unsigned long long)h->max);
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    if (h->buckets[i]) {
+      fprintf(f, "%s[%llu, %llu]", sep, (unsigned long long)histogram_bucket_low(i), (unsigned long long)h->buckets[i]);
+      sep = ", ";
+    }
+  }
+  fprintf(f, "]}");
+}
+
+/* Writes the benchmark report of a run of |workload| that carried out
+ * |num_cmds| commands in |wall_ns| nanoseconds. */
+static void write_report(const char *workload, int cache_size, unsigned long num_cmds, uint64_t wall_ns) {
+  uint64_t cost = jbod_client_cost(), round_trips = jbod_client_round_trips();
+  uint64_t sent = jbod_client_bytes_sent(), received = jbod_client_bytes_received();
+  mdadm_ctx_t *ctx = mdadm_default_ctx();
+  cache_stats_t stats;
+  FILE *f = fopen(report_file, "w");
+
+  if (!f)
+    err(1, "Cannot open report file %s", report_file);
+  for (int i = 1; i < num_conns; i++) {
+    cost += lanes[i].cost;
+    round_trips += lanes[i].round_trips;
+    sent += lanes[i].bytes_sent;
+    received += lanes[i].bytes_received;
+  }
+  cache_get_stats(&stats);
+
+  fprintf(f, "{\n");
+  fprintf(f, "  \"workload\": \"%s\",\n", workload);
+  fprintf(f, "  \"config\": {\"cache_size\": %d, \"policy\": \"%s\", \"write_back\": %s, \"readahead\": %s, "
+          "\"stripe_unit\": %u, \"connections\": %d, \"queue_depth\": %d},\n", cache_size, policy_name,
+          write_back ? "true" : "false",
+          ctx->readahead ? "true" : "false", ctx->stripe_unit, num_conns, queue_depth);
+  fprintf(f, "  \"commands\": %lu,\n", num_cmds);
+  fprintf(f, "  \"wall_ns\": %llu,\n", (unsigned long long)wall_ns);
+  fprintf(f, "  \"commands_per_sec\": %.1f,\n", wall_ns ? num_cmds * 1e9 / wall_ns : 0.0);
+  fprintf(f, "  \"jbod_cost\": %llu,\n", (unsigned long long)cost);
+  fprintf(f, "  \"round_trips\": %llu,\n", (unsigned long long)round_trips);
+  fprintf(f, "  \"bytes_sent\": %llu,\n", (unsigned long long)sent);
+  fprintf(f, "  \"bytes_received\": %llu,\n", (unsigned long long)received);
+  fprintf(f, "  \"cache\": {\"queries\": %lu, \"hits\": %lu, \"evictions\": %lu, \"writebacks\": %lu, "
+          "\"prefetched\": %lu, \"prefetch_hits\": %lu, \"second_queries\": %lu, \"second_hits\": %lu, "
+          "\"second_admitted\": %lu, \"blocks\": %lu, \"run_blocks\": %lu},\n", stats.queries, stats.hits,
+          stats.evictions, stats.writebacks, stats.prefetched, stats.prefetch_hits, stats.second_queries,
+          stats.second_hits, stats.second_admitted, stats.blocks, stats.run_blocks);
+  fprintf(f, "  \"latency_ns\": {");
+  for (int i = 0; i < TRACE_NUM_CMDS; i++) {
+    fprintf(f, "%s\n    \"%s\": ", i ? "," : "", trace_cmd_name(i));
+    write_histogram(f, &latencies[i]);
+  }
+  fprintf(f, "\n  }\n}\n");
+  if (fclose(f) != 0)
+    err(1, "Cannot write report file %s", report_file);
+}
+
+/* Writes the stats to metrics_file. */
+static void write_metrics(void) {
+  int fd = open(metrics_file, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1 || stats_dump(fd) == -1 || close(fd) == -1)
+    err(1, "Cannot write metrics file %s", metrics_file);
+}
+
+/* Fills the empty cache from snapshot_file if the disks still hold what it
+ * was saved from, which only the device can tell once mounted. */
+static void attach_snapshot(void) {
+  uint64_t epoch;
+  int n = jbod_epoch(&epoch) == 0 ? cache_attach(snapshot_file, epoch) : -1;
+
+  if (n >= 0)
+    fprintf(stderr, "Snapshot: %d blocks attached\n", n);
+  else
+    fprintf(stderr, "Snapshot: none for the disks as they are, starting cold\n");
+}
+
+/* Saves the cache to snapshot_file with the epoch of the disks it mirrors. */
+static void save_snapshot(void) {
+  uint64_t epoch;
+
+  cache_flush();                      /* writing back would move the epoch on */
+  if (jbod_epoch(&epoch) != 0 || cache_checkpoint(snapshot_file, epoch) != 1)
+    fprintf(stderr, "Snapshot: cannot save to %s\n", snapshot_file);
+}
+
 int run_workload(char *workload, int cache_size) {
-  char line[256], cmd[32];
-  uint8_t buf[MAX_IO_SIZE];
-  uint32_t addr, len, ch;
-  int rc;
+  static uint8_t bufs[TESTER_MAX_DEPTH][MAX_IO_SIZE];   /* one per request in flight */
+  uint8_t *buf = bufs[0];
+  mdadm_queue_t *q = NULL;
+  const trace_record_t *rec;
+  trace_t trace;
+  int rc, more, slot = 0;
+  bool attach = snapshot_file && cache_size;
 
   memset(buf, 0, MAX_IO_SIZE);
 
-  FILE *f = fopen(workload, "r");
-  if (!f)
+  if (trace_open(&trace, workload) == -1)
     err(1, "Cannot open workload file %s", workload);
 
   if (cache_size) {
@@ -98,44 +363,93 @@ int run_workload(char *workload, int cache_size) {
       errx(1, "Failed to create cache.");
   }
 
-  int line_num = 0;
-  while (fgets(line, 256, f)) {
-    ++line_num;
-    line[strlen(line)-1] = '\0';
-    if (equals(line, "MOUNT")) {
-      rc = mdadm_mount();
-    } else if (equals(line, "UNMOUNT")) {
-      rc = mdadm_unmount();
-    } else if (equals(line, "WRITE_PERMIT")) {
-      rc = mdadm_write_permission();
-    } else if (equals(line, "WRITE_PERMIT_REVOKE")) {
-      rc = mdadm_revoke_write_permission();
-    } else if (equals(line, "SIGNALL")) {
-      for (int i = 0; i < JBOD_NUM_DISKS; ++i)
-        for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j) {
-          uint8_t b[JBOD_BLOCK_SIZE];
+  if (queue_depth > 1) {
+    q = mdadm_queue_create(mdadm_default_ctx(), queue_depth);
+    if (!q)
+      errx(1, "Failed to create queue.");
+    for (int i = 0; i < queue_depth; i++)
+      submitted_tag[i] = -1;
+  }
+
+  for (int i = 0; i < TRACE_NUM_CMDS; i++)
+    histogram_init(&latencies[i]);
+
+  uint64_t run_start = now_ns();
+  while ((more = trace_next(&trace, &rec)) == 1) {
+    uint64_t start;
+
+    if (rec->cmd != TRACE_READ && rec->cmd != TRACE_WRITE)
+      drain(q);                       /* the rest waits for the reads and writes before it */
+    else if (q) {                     /* a request completing frees its buffer */
+      if (mdadm_in_flight(q) == queue_depth)
+        complete(q, 1);
+      slot = slot_of(-1);
+      buf = bufs[slot];
+    }
+    start = now_ns();
+    switch (rec->cmd) {
+      case TRACE_MOUNT:
+        rc = mdadm_mount();
+        if (rc == 1 && attach) {
+          attach_snapshot();
+          attach = false;
+        }
+        break;
+      case TRACE_UNMOUNT:
+        rc = mdadm_unmount();
+        break;
+      case TRACE_WRITE_PERMIT:
+        rc = mdadm_write_permission();
+        break;
+      case TRACE_WRITE_PERMIT_REVOKE:
+        rc = mdadm_revoke_write_permission();
+        break;
+      case TRACE_SIGNALL:
+        cache_flush();                /* signatures are computed by the server */
+        for (uint32_t a = 0; a < JBOD_NUM_DISKS * JBOD_DISK_SIZE; a += JBOD_BLOCK_SIZE) {
+          uint8_t b[JBOD_BLOCK_SIZE];   /* in address order, whatever the layout */
+          int i, j;
+          mdadm_locate(a, &i, &j);
           jbod_client_operation(encode_op(JBOD_SIGN_BLOCK, i, j), b);
           fprintf(stdout, "%s", b);
         }
+        break;
+      case TRACE_READ:
+        rc = q ? mdadm_submit_read(q, rec->addr, rec->len, buf) : mdadm_read(rec->addr, rec->len, buf);
+        break;
+      case TRACE_WRITE:
+        memset(buf, rec->ch, rec->len);
+        rc = q ? mdadm_submit_write(q, rec->addr, rec->len, buf) : mdadm_write(rec->addr, rec->len, buf);
+        break;
+      default:
+        errx(1, "Unknown command %d in record %llu, aborting.", rec->cmd, (unsigned long long)trace.position);
+    }
+    if (q && (rec->cmd == TRACE_READ || rec->cmd == TRACE_WRITE)) {
+      submitted_ns[slot] = start;     /* timed when it completes */
+      submitted_cmd[slot] = rec->cmd;
+      submitted_tag[slot] = rc;       /* the buffer stays free if it failed */
     } else {
-      if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
-        errx(1, "Failed to parse command: [%s\n], aborting.", line);
-      if (equals(cmd, "READ")) {
-        rc = mdadm_read(addr, len, buf);
-      } else if (equals(cmd, "WRITE")) {
-        memset(buf, ch, len);
-        rc = mdadm_write(addr, len, buf);
-      } else {
-        errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
-      }
+      histogram_record(&latencies[rec->cmd], now_ns() - start);
     }
   }
-  fclose(f);
+  if (more == -1)
+    errx(1, "Failed to parse command: [%s] on line %llu, aborting.", trace.line, (unsigned long long)trace.position);
+  unsigned long num_cmds = trace.position;
+  trace_close(&trace);
+  drain(q);
+  mdadm_queue_destroy(q);
 
+  if (cache_size && snapshot_file)
+    save_snapshot();
   if (cache_size)
     cache_destroy();
+  uint64_t run_ns = now_ns() - run_start;
 
   cache_print_hit_rate();
+  if (report_file)
+    write_report(workload, cache_size, num_cmds, run_ns);
+  if (metrics_file)
+    write_metrics();
 
   return 0;
 }
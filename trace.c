@@ -0,0 +1,179 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+static const char *cmd_names[TRACE_NUM_CMDS] = {
+  [TRACE_MOUNT] = "MOUNT",
+  [TRACE_UNMOUNT] = "UNMOUNT",
+  [TRACE_WRITE_PERMIT] = "WRITE_PERMIT",
+  [TRACE_WRITE_PERMIT_REVOKE] = "WRITE_PERMIT_REVOKE",
+  [TRACE_READ] = "READ",
+  [TRACE_WRITE] = "WRITE",
+  [TRACE_SIGNALL] = "SIGNALL",
+};
+
+/* Commands without arguments, in the order lines are matched against them:
+ * a line only has to start with the name, so WRITE_PERMIT_REVOKE goes before
+ * WRITE_PERMIT. */
+static const trace_cmd_t plain_cmds[] = {
+  TRACE_MOUNT, TRACE_UNMOUNT, TRACE_WRITE_PERMIT_REVOKE, TRACE_WRITE_PERMIT, TRACE_SIGNALL,
+};
+
+static int starts_with(const char *s, const char *prefix) {
+  return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+const char *trace_cmd_name(int cmd) {
+  return cmd >= 0 && cmd < TRACE_NUM_CMDS ? cmd_names[cmd] : "?";
+}
+
+int trace_parse_line(const char *line, trace_record_t *rec) {
+  char cmd[32];
+  uint32_t addr, len, ch;
+
+  memset(rec, 0, sizeof(*rec));
+  for (size_t i = 0; i < sizeof(plain_cmds) / sizeof(plain_cmds[0]); i++) {
+    if (starts_with(line, cmd_names[plain_cmds[i]])) {
+      rec->cmd = plain_cmds[i];
+      return 0;
+    }
+  }
+  if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4) {
+    return -1;
+  }
+  if (starts_with(cmd, "READ")) {
+    rec->cmd = TRACE_READ;
+  } else if (starts_with(cmd, "WRITE")) {
+    rec->cmd = TRACE_WRITE;
+  } else {
+    return -1;
+  }
+  rec->addr = addr;
+  rec->len = len;                                         //at most 4 digits
+  rec->ch = ch;                                           //only the low byte is ever written
+  return 0;
+}
+
+/* Fills in the header of a binary trace of |num_records| records. */
+static void make_header(trace_header_t *header, uint64_t num_records) {
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+  header->record_size = sizeof(trace_record_t);
+  header->num_records = num_records;
+}
+
+int trace_write_begin(FILE *f, int binary) {
+  trace_header_t header;
+
+  make_header(&header, 0);                                //the count is filled in at the end
+  if (binary && fwrite(&header, sizeof(header), 1, f) != 1) {
+    return -1;
+  }
+  return 0;
+}
+
+int trace_write(FILE *f, int binary, const trace_record_t *rec) {
+  if (binary) {
+    return fwrite(rec, sizeof(*rec), 1, f) == 1 ? 0 : -1;
+  }
+  if (rec->cmd == TRACE_READ || rec->cmd == TRACE_WRITE) {
+    return fprintf(f, "%s %u %u %u\n", trace_cmd_name(rec->cmd), rec->addr, rec->len, rec->ch) < 0 ? -1 : 0;
+  }
+  return fprintf(f, "%s\n", trace_cmd_name(rec->cmd)) < 0 ? -1 : 0;
+}
+
+int trace_write_end(FILE *f, int binary, uint64_t num_records) {
+  trace_header_t header;
+
+  make_header(&header, num_records);
+  if (binary && (fseek(f, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, f) != 1)) {
+    return -1;
+  }
+  return fflush(f) == 0 ? 0 : -1;
+}
+
+/* Maps the binary trace open as |fd| into |t|. Returns 0 on success and -1 if
+ * the file is not a whole binary trace. */
+static int map_binary(trace_t *t, int fd) {
+  struct stat st;
+  const trace_header_t *header;
+
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(trace_header_t)) {
+    return -1;
+  }
+  t->map_len = st.st_size;
+  t->map = mmap(NULL, t->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (t->map == MAP_FAILED) {
+    t->map = NULL;
+    return -1;
+  }
+  header = t->map;
+  if (header->record_size != sizeof(trace_record_t)                //also catches the other byte order
+      || header->num_records != (t->map_len - sizeof(trace_header_t)) / sizeof(trace_record_t)) {
+    munmap(t->map, t->map_len);
+    t->map = NULL;
+    return -1;
+  }
+  madvise(t->map, t->map_len, MADV_SEQUENTIAL);
+  t->records = (const trace_record_t *)(header + 1);
+  t->num_records = header->num_records;
+  return 0;
+}
+
+int trace_open(trace_t *t, const char *path) {
+  char magic[sizeof(((trace_header_t *)0)->magic)];
+  int fd;
+
+  memset(t, 0, sizeof(*t));
+  fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  if (read(fd, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+    int rc = map_binary(t, fd);
+    close(fd);                                            //the mapping stays
+    return rc;
+  }
+  if (lseek(fd, 0, SEEK_SET) == -1 || (t->text = fdopen(fd, "r")) == NULL) {
+    close(fd);
+    return -1;
+  }
+  return 0;
+}
+
+int trace_next(trace_t *t, const trace_record_t **rec) {
+  if (t->text == NULL) {                                  //binary: nothing to parse
+    if (t->position == t->num_records) {
+      return 0;
+    }
+    *rec = &t->records[t->position++];
+    return 1;
+  }
+
+  if (fgets(t->line, sizeof(t->line), t->text) == NULL) {
+    return 0;
+  }
+  t->position++;
+  t->line[strcspn(t->line, "\n")] = '\0';
+  if (trace_parse_line(t->line, &t->current) == -1) {
+    return -1;
+  }
+  *rec = &t->current;
+  return 1;
+}
+
+void trace_close(trace_t *t) {
+  if (t->text != NULL) {
+    fclose(t->text);
+  }
+  if (t->map != NULL) {
+    munmap(t->map, t->map_len);
+  }
+  memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,83 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Workloads come in two formats. Text traces have a command per line:
+ * MOUNT, UNMOUNT, WRITE_PERMIT, WRITE_PERMIT_REVOKE, SIGNALL, or
+ * "READ addr len ch" and "WRITE addr len ch", where a write fills the |len|
+ * bytes at |addr| with byte |ch|. Binary traces hold the same commands as
+ * fixed-size records after a header, in the byte order of the machine that
+ * wrote them, and are replayed straight from a mapping of the file. */
+
+/* The commands of a trace. */
+typedef enum {
+  TRACE_MOUNT,
+  TRACE_UNMOUNT,
+  TRACE_WRITE_PERMIT,
+  TRACE_WRITE_PERMIT_REVOKE,
+  TRACE_READ,
+  TRACE_WRITE,
+  TRACE_SIGNALL,
+  TRACE_NUM_CMDS,
+} trace_cmd_t;
+
+/* One command. |addr|, |len| and |ch| only mean something for reads and
+ * writes. */
+typedef struct {
+  uint32_t addr;
+  uint16_t len;
+  uint8_t cmd;          /* a trace_cmd_t */
+  uint8_t ch;
+} trace_record_t;
+
+#define TRACE_MAGIC "JBODTRC1"
+
+/* Start of a binary trace, followed by |num_records| records. */
+typedef struct {
+  char magic[8];        /* TRACE_MAGIC, without its terminating NUL */
+  uint32_t record_size; /* sizeof(trace_record_t), also tells the byte order apart */
+  uint32_t reserved;
+  uint64_t num_records;
+} trace_header_t;
+
+/* A trace being read, in either format. */
+typedef struct {
+  FILE *text;                           /* NULL for a binary trace */
+  char line[256];
+  trace_record_t current;               /* last record parsed from the text */
+  const trace_record_t *records;        /* binary: the mapped records */
+  uint64_t num_records;
+  void *map;
+  size_t map_len;
+  uint64_t position;                    /* records read so far, which is the line number for text */
+} trace_t;
+
+/* Returns 0 on success and -1 on failure. Opens the trace at |path|, binary
+ * if it starts with TRACE_MAGIC and text otherwise. */
+int trace_open(trace_t *t, const char *path);
+
+/* Returns 1 and points |rec| at the next record of |t|, 0 at the end of the
+ * trace, or -1 if the next line of a text trace is not a command. The record
+ * stays valid until the next call. */
+int trace_next(trace_t *t, const trace_record_t **rec);
+
+void trace_close(trace_t *t);
+
+/* The three functions below return 0 on success and -1 on failure. They
+ * write a trace to |f|, binary if |binary| is nonzero, in three steps: the
+ * start of the trace, its records one by one, then the end, which fills in
+ * the number of records of a binary trace and so needs |f| to be seekable. */
+int trace_write_begin(FILE *f, int binary);
+int trace_write(FILE *f, int binary, const trace_record_t *rec);
+int trace_write_end(FILE *f, int binary, uint64_t num_records);
+
+/* Returns 0 on success and -1 on failure. Parses text command |line|, without
+ * its newline, into |rec|. */
+int trace_parse_line(const char *line, trace_record_t *rec);
+
+/* Returns the name of command |cmd| as it appears in text traces. */
+const char *trace_cmd_name(int cmd);
+
+#endif
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "trace.h"
+
+/* Converts a workload between the text format tester has always read and the
+ * binary format it replays without parsing (see trace.h). The input may be in
+ * either format; the output is binary unless -t is given. */
+
+#define TRACE_CONVERT_ARGUMENTS "ht"
+#define USAGE                                                           \
+  "USAGE: trace_convert [-h] [-t] input-trace output-trace\n"           \
+  "\n"                                                                  \
+  "where:\n"                                                            \
+  "    -h - help mode (display this message)\n"                         \
+  "    -t - write a text trace (default binary)\n"                      \
+  "\n"
+
+int main(int argc, char *argv[]) {
+  int ch, text = 0, more;
+  uint64_t num_records = 0;
+  const trace_record_t *rec;
+  trace_t in;
+  FILE *out;
+
+  while ((ch = getopt(argc, argv, TRACE_CONVERT_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 't':
+        text = 1;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr, USAGE);
+    return -1;
+  }
+
+  if (trace_open(&in, argv[optind]) == -1)
+    err(1, "Cannot open trace %s", argv[optind]);
+  out = fopen(argv[optind + 1], "w");
+  if (!out)
+    err(1, "Cannot create %s", argv[optind + 1]);
+
+  if (trace_write_begin(out, !text) == -1)
+    err(1, "Cannot write %s", argv[optind + 1]);
+  while ((more = trace_next(&in, &rec)) == 1) {
+    if (trace_write(out, !text, rec) == -1)
+      err(1, "Cannot write %s", argv[optind + 1]);
+    num_records++;
+  }
+  if (more == -1)
+    errx(1, "Failed to parse command: [%s] on line %llu, aborting.", in.line, (unsigned long long)in.position);
+  if (trace_write_end(out, !text, num_records) == -1)
+    err(1, "Cannot write %s", argv[optind + 1]);
+  if (fclose(out) != 0)
+    err(1, "Cannot write %s", argv[optind + 1]);
+  trace_close(&in);
+
+  fprintf(stderr, "%llu commands\n", (unsigned long long)num_records);
+  return 0;
+}
@@ -1,19 +1,25 @@
 #include <err.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <fcntl.h>
 #include <stdint.h>
 #include <assert.h>
 #include <openssl/sha.h>
 #include <openssl/rand.h>
 
+#include "oplog.h"
 #include "util.h"
 
 static int debug_log_enabled = 0;
 static int debug_log_fd = 2;  /* by default write log to stderr */
 
+/* Messages go through the ring of the operation log, so logging them costs
+ * the caller no write: into the log already running, if there is one, or
+ * else into a text log started here on the log file, so set that first. */
 void enable_debug_log(void) {
   debug_log_enabled = 1;
+  oplog_start(debug_log_fd, true, OPLOG_DEFAULT_CAPACITY);
 }
 
 void set_debug_logfile(const char *filename) {
@@ -28,6 +34,11 @@ void debug_log(const char *fmt, ...) {
 
   va_list args;
   va_start(args, fmt);
+  bool logged = oplog_vmessage(fmt, args);
+  va_end(args);
+  if (logged)
+    return;
+  va_start(args, fmt);                    /* the log could not be started */
   vdprintf(debug_log_fd, fmt, args);
   va_end(args);
   dprintf(debug_log_fd, "\n");
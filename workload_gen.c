@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "jbod.h"
+#include "tester.h"
+#include "trace.h"
+#include "util.h"
+
+/* Generator of synthetic workloads for tester. A workload mounts the array,
+ * gets write permission, issues reads and writes whose addresses follow one
+ * of several distributions, then signs every block and unmounts. Everything
+ * comes from a seeded generator, so a seed always gives the same trace.
+ *
+ * With -e, it also writes the output tester must produce for the trace,
+ * found by carrying the writes out on an in-memory copy of the array, so any
+ * generated trace is also a correctness test. -x does the same for an
+ * existing trace instead of generating one. */
+
+#define WORKLOAD_GEN_ARGUMENTS "hn:d:z:H:r:l:D:S:u:o:be:x:"
+#define USAGE                                                           \
+  "USAGE: workload_gen [-h] [-n commands] [-d distribution] [-z skew] [-H hot:share]\n" \
+  "                    [-r read_percent] [-l min:max] [-D straddle_percent] [-S seed]\n" \
+  "                    [-u stripe_unit] [-o trace-file] [-b] [-e expected-output-file]\n" \
+  "       workload_gen [-u stripe_unit] [-e expected-output-file] -x trace-file\n" \
+  "\n"                                                                  \
+  "where:\n"                                                            \
+  "    -h - help mode (display this message)\n"                         \
+  "    -n - reads and writes to generate (default 10000)\n"             \
+  "    -d - where they go: uniform (default), zipf over blocks, seq for a\n" \
+  "         sequential scan wrapping around, or hotcold\n"              \
+  "    -z - skew of zipf (default 0.99)\n"                              \
+  "    -H - for hotcold, percent of the array that is hot and percent of the\n" \
+  "         requests that go there (default 10:90)\n"                   \
+  "    -r - percent of requests that are reads (default 50)\n"          \
+  "    -l - smallest and largest request in bytes (default 1:1024)\n"   \
+  "    -D - percent of requests moved to straddle two disks (default 1)\n" \
+  "    -S - seed (default 1)\n"                                         \
+  "    -u - stripe unit tester runs with, for the expected output (default linear)\n" \
+  "    -o - trace file to write (default standard output)\n"           \
+  "    -b - write a binary trace, which needs -o\n"                     \
+  "    -e - also write the expected output of the trace to this file\n" \
+  "    -x - write the expected output of this trace (to -e, or standard output)\n" \
+  "\n"
+
+#define ARRAY_SIZE (JBOD_NUM_DISKS * JBOD_DISK_SIZE)
+#define NUM_BLOCKS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+
+typedef enum { DIST_UNIFORM, DIST_ZIPF, DIST_SEQ, DIST_HOTCOLD } distribution_t;
+
+static uint64_t rng_state;
+
+/* splitmix64: small, fast and the same everywhere, unlike get_rand, which
+ * cannot be seeded. */
+static uint64_t rng_next(void) {
+  uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* Returns a number from |min| to |max| included. */
+static uint32_t rng_range(uint32_t min, uint32_t max) {
+  return min + rng_next() % ((uint64_t)max - min + 1);
+}
+
+/* Returns a number in [0, 1). */
+static double rng_unit(void) {
+  return (rng_next() >> 11) * (1.0 / (1ULL << 53));
+}
+
+static double zipf_cdf[NUM_BLOCKS];                     //of the ranks, most popular first
+static int zipf_block[NUM_BLOCKS];                      //block of each rank, shuffled over the array
+
+static void zipf_init(double skew) {
+  double sum = 0;
+
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    sum += 1 / pow(i + 1, skew);
+    zipf_cdf[i] = sum;
+    zipf_block[i] = i;
+  }
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    zipf_cdf[i] /= sum;
+  }
+  for (int i = NUM_BLOCKS - 1; i > 0; i--) {            //hot blocks anywhere, not just at the start
+    int j = rng_range(0, i);
+    int t = zipf_block[i];
+    zipf_block[i] = zipf_block[j];
+    zipf_block[j] = t;
+  }
+}
+
+static int zipf_next(void) {
+  double u = rng_unit();
+  int lo = 0, hi = NUM_BLOCKS - 1;
+
+  while (lo < hi) {                                     //first rank whose cdf reaches u
+    int mid = (lo + hi) / 2;
+    if (zipf_cdf[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return zipf_block[lo];
+}
+
+/* Returns the address of the next request, of |len| bytes. */
+static uint32_t next_addr(distribution_t dist, uint32_t len, int hot_pct, int hot_share) {
+  static uint32_t cursor = 0;                           //of the sequential scan
+  uint32_t addr;
+
+  switch (dist) {
+    case DIST_ZIPF:
+      addr = zipf_next() * JBOD_BLOCK_SIZE + rng_range(0, JBOD_BLOCK_SIZE - 1);
+      break;
+    case DIST_SEQ:
+      if (cursor + len > ARRAY_SIZE)
+        cursor = 0;
+      addr = cursor;
+      cursor += len;
+      return addr;
+    case DIST_HOTCOLD: {
+      uint32_t hot_size = (uint64_t)ARRAY_SIZE * hot_pct / 100;
+      if (hot_size > 0 && (hot_size == ARRAY_SIZE || (int)rng_range(0, 99) < hot_share))
+        addr = rng_range(0, hot_size - 1);
+      else
+        addr = rng_range(hot_size, ARRAY_SIZE - 1);
+      break;
+    }
+    default:
+      addr = rng_range(0, ARRAY_SIZE - 1);
+      break;
+  }
+  return addr + len > ARRAY_SIZE ? ARRAY_SIZE - len : addr;
+}
+
+/* The array as tester leaves it, and whether writes would reach it. */
+static uint8_t array[ARRAY_SIZE];
+static int mounted, writable;
+static uint32_t stripe_unit;
+
+/* Where the block holding address |addr| lives, the way mdadm lays it out. */
+static void locate(uint32_t addr, int *disk, int *block) {
+  int logical = addr / JBOD_BLOCK_SIZE, key = logical;
+
+  if (stripe_unit != 0) {
+    int unit_blocks = stripe_unit / JBOD_BLOCK_SIZE;
+    int unit = logical / unit_blocks;
+    key = unit % JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK + unit / JBOD_NUM_DISKS * unit_blocks + logical % unit_blocks;
+  }
+  *disk = key / JBOD_NUM_BLOCKS_PER_DISK;
+  *block = key % JBOD_NUM_BLOCKS_PER_DISK;
+}
+
+/* Carries |rec| out on the in-memory array, writing what SIGNALL prints to
+ * |expected|. Commands that mdadm would refuse leave the array alone. */
+static void simulate(const trace_record_t *rec, FILE *expected) {
+  switch (rec->cmd) {
+    case TRACE_MOUNT:
+      mounted = 1;
+      break;
+    case TRACE_UNMOUNT:
+      mounted = writable = 0;
+      break;
+    case TRACE_WRITE_PERMIT:
+      writable = mounted;
+      break;
+    case TRACE_WRITE_PERMIT_REVOKE:
+      writable = 0;
+      break;
+    case TRACE_WRITE:
+      if (mounted && writable && rec->len <= 2048 && (uint64_t)rec->addr + rec->len <= ARRAY_SIZE)
+        memset(array + rec->addr, rec->ch, rec->len);
+      break;
+    case TRACE_SIGNALL:
+      for (uint32_t a = 0; a < ARRAY_SIZE; a += JBOD_BLOCK_SIZE) {
+        int disk, block;
+        locate(a, &disk, &block);
+        fprintf(expected, "SIG(disk,block) %2d %3d : %s\n", disk, block, sha1_sig(array + a, JBOD_BLOCK_SIZE));
+      }
+      break;
+  }
+}
+
+static int parse_pair(const char *s, int *a, int *b) {
+  return sscanf(s, "%d:%d", a, b) == 2 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+  int ch, num_requests = 10000, read_pct = 50, straddle_pct = 1, min_len = 1, max_len = MAX_IO_SIZE;
+  int hot_pct = 10, hot_share = 90, binary = 0;
+  double skew = 0.99;
+  uint64_t seed = 1, num_records = 0;
+  distribution_t dist = DIST_UNIFORM;
+  const char *out_file = NULL, *expected_file = NULL, *existing = NULL;
+  FILE *out = stdout, *expected = NULL;
+  trace_record_t rec;
+
+  while ((ch = getopt(argc, argv, WORKLOAD_GEN_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'n':
+        num_requests = atoi(optarg);
+        break;
+      case 'd':
+        if (strcmp(optarg, "uniform") == 0)
+          dist = DIST_UNIFORM;
+        else if (strcmp(optarg, "zipf") == 0)
+          dist = DIST_ZIPF;
+        else if (strcmp(optarg, "seq") == 0)
+          dist = DIST_SEQ;
+        else if (strcmp(optarg, "hotcold") == 0)
+          dist = DIST_HOTCOLD;
+        else
+          errx(1, "Unknown distribution %s", optarg);
+        break;
+      case 'z':
+        skew = atof(optarg);
+        break;
+      case 'H':
+        if (parse_pair(optarg, &hot_pct, &hot_share) == -1 || hot_pct < 0 || hot_pct > 100 || hot_share < 0 || hot_share > 100)
+          errx(1, "Bad hot set %s", optarg);
+        break;
+      case 'r':
+        read_pct = atoi(optarg);
+        break;
+      case 'l':
+        if (parse_pair(optarg, &min_len, &max_len) == -1 || min_len < 0 || min_len > max_len || max_len > MAX_IO_SIZE)
+          errx(1, "Lengths must be within 0:%d", MAX_IO_SIZE);
+        break;
+      case 'D':
+        straddle_pct = atoi(optarg);
+        break;
+      case 'S':
+        seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'u':
+        stripe_unit = atoi(optarg);
+        if (stripe_unit != 0 && (stripe_unit < JBOD_BLOCK_SIZE || stripe_unit > JBOD_DISK_SIZE || (stripe_unit & (stripe_unit - 1))))
+          errx(1, "Bad stripe unit %s", optarg);
+        break;
+      case 'o':
+        out_file = optarg;
+        break;
+      case 'b':
+        binary = 1;
+        break;
+      case 'e':
+        expected_file = optarg;
+        break;
+      case 'x':
+        existing = optarg;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+
+  if (expected_file && !(expected = fopen(expected_file, "w")))
+    err(1, "Cannot create %s", expected_file);
+
+  if (existing) {                                       //only simulate
+    const trace_record_t *r;
+    trace_t t;
+    int more;
+    if (trace_open(&t, existing) == -1)
+      err(1, "Cannot open trace %s", existing);
+    while ((more = trace_next(&t, &r)) == 1)
+      simulate(r, expected ? expected : stdout);
+    if (more == -1)
+      errx(1, "Failed to parse command: [%s] on line %llu, aborting.", t.line, (unsigned long long)t.position);
+    trace_close(&t);
+    if (expected && fclose(expected) != 0)
+      err(1, "Cannot write %s", expected_file);
+    return 0;
+  }
+
+  if (binary && !out_file)
+    errx(1, "A binary trace needs an output file (-o)");
+  if (out_file && !(out = fopen(out_file, "w")))
+    err(1, "Cannot create %s", out_file);
+  if (trace_write_begin(out, binary) == -1)
+    err(1, "Cannot write trace");
+
+  rng_state = seed;
+  if (dist == DIST_ZIPF)
+    zipf_init(skew);
+
+  for (int i = 0; i < num_requests + 4; i++) {
+    memset(&rec, 0, sizeof(rec));
+    if (i == 0) {
+      rec.cmd = TRACE_MOUNT;
+    } else if (i == 1) {
+      rec.cmd = TRACE_WRITE_PERMIT;
+    } else if (i == num_requests + 2) {
+      rec.cmd = TRACE_SIGNALL;
+    } else if (i == num_requests + 3) {
+      rec.cmd = TRACE_UNMOUNT;
+    } else {
+      rec.cmd = (int)rng_range(0, 99) < read_pct ? TRACE_READ : TRACE_WRITE;
+      rec.len = rng_range(min_len, max_len);
+      if (rec.len >= 2 && (int)rng_range(0, 99) < straddle_pct) {  //across the end of a disk
+        uint32_t boundary = rng_range(1, JBOD_NUM_DISKS - 1) * JBOD_DISK_SIZE;
+        rec.addr = boundary - rng_range(1, rec.len - 1);
+      } else {
+        rec.addr = next_addr(dist, rec.len, hot_pct, hot_share);
+      }
+      rec.ch = rec.cmd == TRACE_WRITE ? rng_range(0, 255) : 0;
+    }
+    if (trace_write(out, binary, &rec) == -1)
+      err(1, "Cannot write trace");
+    if (expected)
+      simulate(&rec, expected);
+    num_records++;
+  }
+
+  if (trace_write_end(out, binary, num_records) == -1 || (out_file && fclose(out) != 0))
+    err(1, "Cannot write trace");
+  if (expected && fclose(expected) != 0)
+    err(1, "Cannot write %s", expected_file);
+  return 0;
+}